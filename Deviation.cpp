@@ -0,0 +1,284 @@
+// Deviation.cpp
+// Per heading compass deviation table
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include "Deviation.h"
+
+//-------------------------------------------
+// Local defines
+
+#define DEVIATION_FILE_HEADER	"deviation 1"
+
+//-----------------------------------------------------------------------------
+// a - b folded into -180 to 180 degrees
+static float AngleDifference( float a, float b )
+{
+	return fmodf( a - b + 540.0f, 360.0f ) - 180.0f;
+}
+
+//-----------------------------------------------------------------------------
+// Table position of a heading: the entry at or below it, and how far it is
+// towards the next one. Any heading, even negative or past 360, maps into
+// the table.
+static inline int Position( float fHeading, float *pfFraction )
+{
+	float x = fHeading * ( 1.0f / DEVIATION_STEP_DEG );
+	float whole = floorf( x );
+	int i = (int)whole % DEVIATION_ENTRIES;
+
+	*pfFraction = x - whole;
+
+	return ( i + DEVIATION_ENTRIES ) % DEVIATION_ENTRIES;
+}
+
+//-----------------------------------------------------------------------------
+// No correction
+void DEVIATION_Identity( DEVIATION_TABLE *ptTable )
+{
+	memset( ptTable, 0, sizeof(*ptTable) );
+}
+
+//*****************************************************************************
+//
+//	DEVIATION_Correct
+//
+//	Corrects a compass heading for deviation, interpolating between the
+//	table entries either side of it
+//
+//	Parameters:
+//		ptTable - the deviation table
+//		fHeading - compass heading, degrees
+//
+//	Returns:
+//		the corrected heading, degrees. It's fHeading plus the deviation,
+//		so may be a little below 0 or above 360.
+//
+//*****************************************************************************
+float DEVIATION_Correct( const DEVIATION_TABLE *ptTable, float fHeading )
+{
+	float f;
+	int i = Position( fHeading, &f );
+	float d0 = ptTable->afDeviation[i];
+
+	return fHeading + d0 + f * ( ptTable->afDeviation[i + 1] - d0 );
+}
+
+//-----------------------------------------------------------------------------
+void DEVIATION_BuilderInit( DEVIATION_BUILDER *ptBuilder )
+{
+	memset( ptBuilder, 0, sizeof(*ptBuilder) );
+}
+
+//*****************************************************************************
+//
+//	DEVIATION_AddSample
+//
+//	Adds a compass heading and the course actually made good on it. Only
+//	take samples on a straight leg at speed, where the GPS course is steady
+//	and the boat's pointing where it's going.
+//
+//	Parameters:
+//		ptBuilder - the table being built
+//		fCompass - compass heading, uncorrected, degrees magnetic
+//		fCourse - GPS course over ground, degrees magnetic
+//
+//	Returns:
+//		true if taken, false if they differ by more than DEVIATION_MAX_DEG
+//
+//*****************************************************************************
+bool DEVIATION_AddSample( DEVIATION_BUILDER *ptBuilder, float fCompass, float fCourse )
+{
+	float fDeviation = AngleDifference( fCourse, fCompass );
+	float f;
+	int i;
+
+	if( fabsf( fDeviation ) > DEVIATION_MAX_DEG )
+	{
+		return false;
+	}
+
+	i = Position( fCompass, &f );
+
+	ptBuilder->adSum[i] += ( 1 - f ) * fDeviation;
+	ptBuilder->adWeight[i] += 1 - f;
+
+	i = ( i + 1 ) % DEVIATION_ENTRIES;
+	ptBuilder->adSum[i] += f * fDeviation;
+	ptBuilder->adWeight[i] += f;
+
+	ptBuilder->u32Samples++;
+
+	return true;
+}
+
+//*****************************************************************************
+//
+//	DEVIATION_Build
+//
+//	Makes a table from the samples so far. Entries with less than
+//	DEVIATION_MIN_WEIGHT of samples are interpolated round the circle from
+//	the nearest measured ones.
+//
+//	Parameters:
+//		ptBuilder - the samples
+//		ptTable - filled in with the table, no correction if nothing was
+//				  measured
+//
+//	Returns:
+//		the number of measured entries, out of DEVIATION_ENTRIES
+//
+//*****************************************************************************
+int DEVIATION_Build( const DEVIATION_BUILDER *ptBuilder, DEVIATION_TABLE *ptTable )
+{
+	bool abMeasured[DEVIATION_ENTRIES];
+	int i, measured = 0, first = -1;
+
+	DEVIATION_Identity( ptTable );
+
+	for( i = 0; i < DEVIATION_ENTRIES; i++ )
+	{
+		abMeasured[i] = ( ptBuilder->adWeight[i] >= DEVIATION_MIN_WEIGHT );
+
+		if( abMeasured[i] )
+		{
+			ptTable->afDeviation[i] = ptBuilder->adSum[i] / ptBuilder->adWeight[i];
+			measured++;
+
+			if( first < 0 )
+			{
+				first = i;
+			}
+		}
+	}
+
+	if( measured == 0 )
+	{
+		return 0;
+	}
+
+	// Fill each gap from the measured entries either side, going round
+	// from the first measured one
+	for( i = 0; i < DEVIATION_ENTRIES; )
+	{
+		int from = ( first + i ) % DEVIATION_ENTRIES;
+		int gap = 1;
+
+		while( gap <= DEVIATION_ENTRIES && !abMeasured[( from + gap ) % DEVIATION_ENTRIES] )
+		{
+			gap++;
+		}
+
+		for( int k = 1; k < gap; k++ )
+		{
+			float d0 = ptTable->afDeviation[from];
+			float d1 = ptTable->afDeviation[( from + gap ) % DEVIATION_ENTRIES];
+
+			ptTable->afDeviation[( from + k ) % DEVIATION_ENTRIES] = d0 + ( d1 - d0 ) * k / gap;
+		}
+
+		i += gap;
+	}
+
+	ptTable->afDeviation[DEVIATION_ENTRIES] = ptTable->afDeviation[0];
+
+	return measured;
+}
+
+//*****************************************************************************
+//
+//	DEVIATION_Save
+//
+//	Writes a table to a text file, one "heading deviation" line per entry
+//
+//	Parameters:
+//		path - the file
+//		ptTable - the table
+//
+//	Returns:
+//		true on success
+//
+//*****************************************************************************
+bool DEVIATION_Save( const char *path, const DEVIATION_TABLE *ptTable )
+{
+	FILE *fp = fopen( path, "w" );
+	bool bStatus;
+
+	if( fp == NULL )
+	{
+		fprintf (stderr, "Deviation: unable to write %s: %s\n", path, strerror (errno)) ;
+		return false;
+	}
+
+	fprintf( fp, DEVIATION_FILE_HEADER "\n" );
+
+	for( int i = 0; i < DEVIATION_ENTRIES; i++ )
+	{
+		fprintf( fp, "%d %.2f\n", i * DEVIATION_STEP_DEG, ptTable->afDeviation[i] );
+	}
+
+	bStatus = !ferror( fp );
+
+	if( fclose( fp ) != 0 || !bStatus )
+	{
+		fprintf (stderr, "Deviation: unable to write %s: %s\n", path, strerror (errno)) ;
+		return false;
+	}
+
+	return true;
+}
+
+//*****************************************************************************
+//
+//	DEVIATION_Load
+//
+//	Reads a table written by DEVIATION_Save()
+//
+//	Parameters:
+//		path - the file
+//		ptTable - filled in with the table, or no correction if the file
+//				  can't be read
+//
+//	Returns:
+//		true on success
+//
+//*****************************************************************************
+bool DEVIATION_Load( const char *path, DEVIATION_TABLE *ptTable )
+{
+	FILE *fp = fopen( path, "r" );
+	char szHeader[32];
+	bool bStatus;
+
+	DEVIATION_Identity( ptTable );
+
+	if( fp == NULL )
+	{
+		return false;
+	}
+
+	bStatus = fgets( szHeader, sizeof(szHeader), fp ) != NULL
+			  && strncmp( szHeader, DEVIATION_FILE_HEADER "\n", sizeof(szHeader) ) == 0;
+
+	for( int i = 0; bStatus && i < DEVIATION_ENTRIES; i++ )
+	{
+		int heading;
+
+		bStatus = fscanf( fp, "%d %f", &heading, &ptTable->afDeviation[i] ) == 2
+				  && heading == i * DEVIATION_STEP_DEG;
+	}
+
+	fclose( fp );
+
+	if( !bStatus )
+	{
+		fprintf (stderr, "Deviation: %s is not a deviation table\n", path) ;
+		DEVIATION_Identity( ptTable );
+		return false;
+	}
+
+	ptTable->afDeviation[DEVIATION_ENTRIES] = ptTable->afDeviation[0];
+
+	return true;
+}
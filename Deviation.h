@@ -0,0 +1,58 @@
+// Deviation.h
+// Per heading compass deviation table
+//
+// The boat's own iron and currents (motor, battery, wiring) turn the compass
+// by an amount that depends on the heading. The table holds the correction
+// every DEVIATION_STEP_DEG of compass heading, and DEVIATION_Correct()
+// interpolates it with no branches.
+//
+// A table is built from a run on straight, steady legs in calm water on as
+// many headings as possible: each sample pairs the compass heading with the
+// GPS course over ground (both magnetic), and is shared between the two
+// nearest table entries by distance. Entries with no samples are
+// interpolated from their neighbours.
+
+#ifndef DEVIATION_H
+#define DEVIATION_H
+
+#include "includes.h"	// for typedef's, etc.
+
+//-------------------------------------------
+// Global defines
+
+#define DEVIATION_STEP_DEG			5
+#define DEVIATION_ENTRIES			( 360 / DEVIATION_STEP_DEG )
+#define DEVIATION_MAX_DEG			30.0	// larger differences are leeway, turns, etc.
+#define DEVIATION_MIN_WEIGHT		2.0		// samples' worth for an entry to count as measured
+
+//-------------------------------------------
+// Global typedefs
+
+typedef struct
+{
+	// Degrees to add to the compass heading at 0, DEVIATION_STEP_DEG, ...
+	// and 360 again, so a lookup never has to wrap
+	float afDeviation[DEVIATION_ENTRIES + 1];
+} DEVIATION_TABLE;
+
+typedef struct
+{
+	double adSum[DEVIATION_ENTRIES];		// weighted deviations
+	double adWeight[DEVIATION_ENTRIES];
+	U32 u32Samples;
+} DEVIATION_BUILDER;
+
+//-------------------------------------------
+// Function prototypes
+
+void	DEVIATION_Identity( DEVIATION_TABLE *ptTable );
+float	DEVIATION_Correct( const DEVIATION_TABLE *ptTable, float fHeading );
+
+void	DEVIATION_BuilderInit( DEVIATION_BUILDER *ptBuilder );
+bool	DEVIATION_AddSample( DEVIATION_BUILDER *ptBuilder, float fCompass, float fCourse );
+int		DEVIATION_Build( const DEVIATION_BUILDER *ptBuilder, DEVIATION_TABLE *ptTable );
+
+bool	DEVIATION_Save( const char *path, const DEVIATION_TABLE *ptTable );
+bool	DEVIATION_Load( const char *path, DEVIATION_TABLE *ptTable );
+
+#endif
@@ -0,0 +1,212 @@
+// GpsConfig.cpp
+// Startup negotiation of baud, fix rate and sentences with an MTK receiver
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "GpsConfig.h"
+#include "GpsReader.h"
+#include "config.h"
+
+//*** local defines and typedefs **********************************************
+
+#define PMTK_SET_NMEA_BAUDRATE		251
+#define PMTK_SET_NMEA_UPDATERATE	220
+#define PMTK_SET_NMEA_OUTPUT		314
+
+#define PMTK_MAX_COMMAND_LENGTH		80
+
+// GLL, RMC, VTG, GGA, GSA, GSV, then 13 reserved/unused fields
+#define PMTK_OUTPUT_RMC_GGA			"0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0"
+
+//*** local function declarations *********************************************
+static bool SendCommand( Transport *ptPort, const char *body );
+static bool WaitForTraffic( TinyGPSPlus *pGps, int timeout_ms );
+static bool WaitForAck( TinyGPSPlus *pGps, U16 command, int timeout_ms );
+static bool SendWithAck( Transport *ptPort, TinyGPSPlus *pGps, U16 command, const char *body );
+static bool SwitchBaud( Transport *ptPort, int baud );
+
+//*** local function definitions **********************************************
+
+// Frames body as $body*CS\r\n and sends it
+static bool SendCommand( Transport *ptPort, const char *body )
+{
+	char szCommand[PMTK_MAX_COMMAND_LENGTH];
+	U8 checksum = 0;
+	const char *p;
+	int len;
+
+	for( p = body; *p; p++ )
+	{
+		checksum ^= (U8)*p;
+	}
+
+	len = snprintf( szCommand, sizeof(szCommand), "$%s*%02X\r\n", body, checksum );
+
+	return ( len < (int)sizeof(szCommand) && ptPort->Write( (const U8 *)szCommand, len ) == len );
+}
+
+//------------------------------------------------------------------------------
+// True once a sentence passes its checksum, i.e. both ends agree on the baud
+static bool WaitForTraffic( TinyGPSPlus *pGps, int timeout_ms )
+{
+	U32 u32Passed = pGps->passedChecksum();
+	int start = millis();
+	int remaining;
+
+	while( ( remaining = timeout_ms - ( millis() - start ) ) > 0 )
+	{
+		if( GPSREADER_Service( pGps, remaining ) < 0 )
+		{
+			return false;
+		}
+
+		if( pGps->passedChecksum() != u32Passed )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------------
+// True if the receiver acknowledges command as carried out
+static bool WaitForAck( TinyGPSPlus *pGps, U16 command, int timeout_ms )
+{
+	int start = millis();
+	int remaining;
+
+	while( ( remaining = timeout_ms - ( millis() - start ) ) > 0 )
+	{
+		if( GPSREADER_Service( pGps, remaining ) < 0 )
+		{
+			return false;
+		}
+
+		if( pGps->pmtkAck.isUpdated() && pGps->pmtkAck.command() == command )
+		{
+			return pGps->pmtkAck.succeeded();
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------------
+static bool SendWithAck( Transport *ptPort, TinyGPSPlus *pGps, U16 command, const char *body )
+{
+	int retry;
+
+	for( retry = 0; retry < GPS_CONFIG_RETRIES; retry++ )
+	{
+		// Forget any ACK left over from an earlier attempt
+		pGps->pmtkAck.command();
+
+		if( SendCommand( ptPort, body ) && WaitForAck( pGps, command, GPS_ACK_TIMEOUT_MS ) )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------------
+static bool SwitchBaud( Transport *ptPort, int baud )
+{
+	if( !ptPort->SetBaud( baud ) )
+	{
+		return false;
+	}
+
+	GPSREADER_SetBaud( baud );
+
+	return true;
+}
+
+//*** global function definitions *********************************************
+
+//******************************************************************************
+//
+//	GPSCONFIG_Negotiate
+//
+//	Brings the receiver up to GPS_TARGET_BAUD, RMC + GGA only and as close
+//	to GPS_FIX_RATE_HZ as the final baud can carry. Call after GPSREADER_Init()
+//	and before the GPS thread is started.
+//
+//	Parameters:
+//		ptPort - open GPS transport, currently at baud
+//		pGps - parser fed by the GPS reader
+//		baud - the receiver's power-on baud rate
+//
+//	Returns:
+//		int: the baud rate in use afterwards, -1 if the receiver wasn't heard
+//
+//******************************************************************************
+int GPSCONFIG_Negotiate( Transport *ptPort, TinyGPSPlus *pGps, int baud )
+{
+	char szBody[PMTK_MAX_COMMAND_LENGTH];
+	bool bTrimmed;
+	int rate;
+
+	// Find the receiver. It keeps its baud across a warm restart, so it may
+	// still be at the target rate from the last run
+	if( !WaitForTraffic( pGps, GPS_PROBE_TIMEOUT_MS ) )
+	{
+		if( baud == GPS_TARGET_BAUD || !SwitchBaud( ptPort, GPS_TARGET_BAUD ) ||
+			!WaitForTraffic( pGps, GPS_PROBE_TIMEOUT_MS ) )
+		{
+			SwitchBaud( ptPort, baud );
+			fprintf (stderr, "GPS config: no NMEA from the receiver\n") ;
+			return -1;
+		}
+
+		baud = GPS_TARGET_BAUD;
+	}
+
+	// Baud rate. PMTK251 isn't acknowledged, the check is hearing valid NMEA
+	// at the new rate
+	if( baud != GPS_TARGET_BAUD )
+	{
+		snprintf( szBody, sizeof(szBody), "PMTK%d,%d", PMTK_SET_NMEA_BAUDRATE, GPS_TARGET_BAUD );
+		SendCommand( ptPort, szBody );
+		ptPort->Drain();
+		usleep( GPS_BAUD_SWITCH_DELAY_MS * 1000 );
+
+		if( SwitchBaud( ptPort, GPS_TARGET_BAUD ) && WaitForTraffic( pGps, GPS_PROBE_TIMEOUT_MS ) )
+		{
+			baud = GPS_TARGET_BAUD;
+		}
+		else
+		{
+			printf("GPS config: receiver stayed at %i baud\n", baud);
+			SwitchBaud( ptPort, baud );
+		}
+	}
+
+	// Sentences
+	snprintf( szBody, sizeof(szBody), "PMTK%d,%s", PMTK_SET_NMEA_OUTPUT, PMTK_OUTPUT_RMC_GGA );
+	bTrimmed = SendWithAck( ptPort, pGps, PMTK_SET_NMEA_OUTPUT, szBody );
+
+	if( !bTrimmed )
+	{
+		printf("GPS config: sentence set not acknowledged, keeping defaults\n");
+	}
+
+	// Fix rate, limited to what fits down the link (8N1)
+	rate = ( baud / 10 ) / ( bTrimmed ? GPS_BYTES_PER_FIX_TRIMMED : GPS_BYTES_PER_FIX_DEFAULT );
+	rate = constrain( rate, 1, GPS_FIX_RATE_HZ );
+
+	snprintf( szBody, sizeof(szBody), "PMTK%d,%d", PMTK_SET_NMEA_UPDATERATE, 1000 / rate );
+
+	if( !SendWithAck( ptPort, pGps, PMTK_SET_NMEA_UPDATERATE, szBody ) )
+	{
+		printf("GPS config: fix rate not acknowledged, keeping 1 Hz\n");
+		rate = 1;
+	}
+
+	printf("GPS config: %i baud, %i Hz, %s\n", baud, rate, bTrimmed ? "RMC+GGA" : "default sentences");
+
+	return baud;
+}
@@ -0,0 +1,32 @@
+// GpsConfig.h
+// Startup negotiation of baud, fix rate and sentences with an MTK receiver
+//
+// Raises the link to GPS_TARGET_BAUD with PMTK251, trims the output to
+// RMC and GGA with PMTK314 and sets the fix interval with PMTK220. Each
+// step is confirmed (by fresh NMEA at the new baud, or by a PMTK001 ACK)
+// and a step that isn't confirmed is backed out, leaving the receiver at
+// whatever it was already doing.
+
+#ifndef GPS_CONFIG_H
+#define GPS_CONFIG_H
+
+#include "TinyGPS++.h"	// pulls in includes.h after <math.h>
+#include "Transport.h"
+
+//-------------------------------------------
+// Global defines
+
+#define GPS_PROBE_TIMEOUT_MS		2000	// wait for valid NMEA at a baud rate
+#define GPS_ACK_TIMEOUT_MS			1000	// wait for a PMTK001 reply
+#define GPS_CONFIG_RETRIES			3
+#define GPS_BAUD_SWITCH_DELAY_MS	100		// receiver settle time after PMTK251
+
+#define GPS_BYTES_PER_FIX_TRIMMED	160		// RMC + GGA
+#define GPS_BYTES_PER_FIX_DEFAULT	500		// MTK default set, GSV averaged
+
+//-------------------------------------------
+// Function prototypes
+
+int		GPSCONFIG_Negotiate( Transport *ptPort, TinyGPSPlus *pGps, int baud );
+
+#endif
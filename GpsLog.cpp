@@ -0,0 +1,350 @@
+// GpsLog.cpp
+// Parallel decoder for recorded NMEA captures
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "TinyGPS++.h"
+#include "GpsLog.h"
+
+//-------------------------------------------
+// Local typedefs
+
+typedef struct
+{
+	const char	*pData;			// the whole capture
+	size_t		warmup;			// replay from here ...
+	size_t		start;			// ... then record fixes from here ...
+	size_t		end;			// ... up to here
+	GPSLOG_FIX	*ptFixes;
+	size_t		nFixes;
+	size_t		nCapacity;
+	uint64_t	u64Chars;
+	uint32_t	u32PassedChecksum;
+	uint32_t	u32FailedChecksum;
+	uint32_t	u32SentencesWithFix;
+	bool		bOutOfMemory;
+} GPSLOG_CHUNK;
+
+//-----------------------------------------------------------------------------
+// Returns the offset of the first sentence start at or after pos, or size if
+// there isn't one. Only a '$' at the beginning of a line counts, so one
+// inside a damaged sentence doesn't split there.
+static size_t NextSentence( const char *pData, size_t size, size_t pos )
+{
+	while( pos < size )
+	{
+		const char *p = (const char *)memchr( pData + pos, '$', size - pos );
+
+		if( p == NULL )
+		{
+			break;
+		}
+
+		pos = p - pData;
+
+		if( pos == 0 || pData[pos - 1] == '\n' )
+		{
+			return pos;
+		}
+
+		pos++;
+	}
+
+	return size;
+}
+
+//-----------------------------------------------------------------------------
+static bool AddFix( GPSLOG_CHUNK *ptChunk, TinyGPSPlus *pGps, size_t offset )
+{
+	GPSLOG_FIX *ptFix;
+
+	if( ptChunk->nFixes == ptChunk->nCapacity )
+	{
+		size_t nCapacity = ptChunk->nCapacity ? 2 * ptChunk->nCapacity : 256;
+		GPSLOG_FIX *ptFixes = (GPSLOG_FIX *)realloc( ptChunk->ptFixes, nCapacity * sizeof(GPSLOG_FIX) );
+
+		if( ptFixes == NULL )
+		{
+			return false;
+		}
+
+		ptChunk->ptFixes = ptFixes;
+		ptChunk->nCapacity = nCapacity;
+	}
+
+	ptFix = &ptChunk->ptFixes[ptChunk->nFixes++];
+	ptFix->u64Offset		= offset;
+	ptFix->s64LatNano		= pGps->location.latNanodegrees();
+	ptFix->s64LngNano		= pGps->location.lngNanodegrees();
+	ptFix->u32Date			= pGps->date.isValid() ? pGps->date.value() : 0;
+	ptFix->u32Time			= pGps->time.isValid() ? pGps->time.value() : 0;
+	ptFix->s32Altitude		= pGps->altitude.value();
+	ptFix->s32Speed			= pGps->speed.value();
+	ptFix->s32Course		= pGps->course.value();
+	ptFix->s32Hdop			= pGps->hdop.value();
+	ptFix->u32Satellites	= pGps->satellites.value();
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Feeds [from, to) to the parser a sentence at a time, recording a fix after
+// each sentence that commits one if bRecord is set
+static bool DecodeSpan( GPSLOG_CHUNK *ptChunk, TinyGPSPlus *pGps, size_t from, size_t to, bool bRecord )
+{
+	const char *pData = ptChunk->pData;
+
+	while( from < to )
+	{
+		const char *pNext = (const char *)memchr( pData + from + 1, '$', to - from - 1 );
+		size_t next = pNext ? (size_t)(pNext - pData) : to;
+
+		// Offline, so there's no arrival time to stamp
+		pGps->encode( pData + from, next - from, 0, 0 );
+
+		if( bRecord && pGps->location.isUpdated() && !AddFix( ptChunk, pGps, from ) )
+		{
+			return false;
+		}
+
+		from = next;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static void *DecodeChunk( void *pArg )
+{
+	GPSLOG_CHUNK *ptChunk = (GPSLOG_CHUNK *)pArg;
+	TinyGPSPlus gps;
+	uint32_t u32Chars, u32Passed, u32Failed, u32WithFix;
+
+	DecodeSpan( ptChunk, &gps, ptChunk->warmup, ptChunk->start, false );
+
+	// Fixes from the warm-up belong to the previous chunk
+	gps.location.latNanodegrees();
+
+	u32Chars	= gps.charsProcessed();
+	u32Passed	= gps.passedChecksum();
+	u32Failed	= gps.failedChecksum();
+	u32WithFix	= gps.sentencesWithFix();
+
+	ptChunk->bOutOfMemory = !DecodeSpan( ptChunk, &gps, ptChunk->start, ptChunk->end, true );
+
+	ptChunk->u64Chars				= gps.charsProcessed() - u32Chars;
+	ptChunk->u32PassedChecksum		= gps.passedChecksum() - u32Passed;
+	ptChunk->u32FailedChecksum		= gps.failedChecksum() - u32Failed;
+	ptChunk->u32SentencesWithFix	= gps.sentencesWithFix() - u32WithFix;
+
+	return NULL;
+}
+
+//*****************************************************************************
+//
+//	GPSLOG_DecodeBuffer
+//
+//	Decodes an NMEA capture already in memory, using up to "threads"
+//	threads in parallel.
+//
+//	Parameters:
+//		pData - the capture
+//		size - its length in bytes
+//		threads - number of threads, or 0 for one per online CPU
+//		ptResult - filled in with the fixes and counters. Release with
+//				   GPSLOG_Free()
+//
+//	Returns:
+//		true on success, false if out of memory
+//
+//*****************************************************************************
+bool GPSLOG_DecodeBuffer( const char *pData, size_t size, int threads, GPSLOG_RESULT *ptResult )
+{
+	GPSLOG_CHUNK *ptChunks;
+	pthread_t *ptThreads;
+	bool *pbStarted;
+	size_t nChunks, nFixes, i;
+	bool bStatus = true;
+
+	memset( ptResult, 0, sizeof(*ptResult) );
+
+	if( threads <= 0 )
+	{
+		threads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+	}
+
+	nChunks = size / GPSLOG_MIN_CHUNK_BYTES + 1;
+
+	if( threads > 0 && nChunks > (size_t)threads )
+	{
+		nChunks = threads;
+	}
+
+	ptChunks	= (GPSLOG_CHUNK *)calloc( nChunks, sizeof(GPSLOG_CHUNK) );
+	ptThreads	= (pthread_t *)calloc( nChunks, sizeof(pthread_t) );
+	pbStarted	= (bool *)calloc( nChunks, sizeof(bool) );
+
+	if( ptChunks == NULL || ptThreads == NULL || pbStarted == NULL )
+	{
+		fprintf (stderr, "GPS log: out of memory\n") ;
+		free( ptChunks );
+		free( ptThreads );
+		free( pbStarted );
+		return false;
+	}
+
+	// Cut at sentence starts near even splits
+	for( i = 0; i < nChunks; i++ )
+	{
+		size_t warmup;
+
+		ptChunks[i].pData = pData;
+		ptChunks[i].start = ( i == 0 ) ? 0 : NextSentence( pData, size, i * ( size / nChunks ) );
+
+		warmup = ( ptChunks[i].start > GPSLOG_WARMUP_BYTES ) ? ptChunks[i].start - GPSLOG_WARMUP_BYTES : 0;
+		ptChunks[i].warmup = ( i == 0 ) ? 0 : NextSentence( pData, ptChunks[i].start, warmup );
+
+		if( i > 0 )
+		{
+			ptChunks[i - 1].end = ptChunks[i].start;
+		}
+	}
+	ptChunks[nChunks - 1].end = size;
+
+	// The first chunk runs here; any thread that can't be started runs here too
+	for( i = 1; i < nChunks; i++ )
+	{
+		pbStarted[i] = ( pthread_create( &ptThreads[i], NULL, DecodeChunk, &ptChunks[i] ) == 0 );
+	}
+
+	DecodeChunk( &ptChunks[0] );
+
+	for( i = 1; i < nChunks; i++ )
+	{
+		if( pbStarted[i] )
+		{
+			pthread_join( ptThreads[i], NULL );
+		}
+		else
+		{
+			DecodeChunk( &ptChunks[i] );
+		}
+	}
+
+	// Merge in file order
+	for( nFixes = 0, i = 0; i < nChunks; i++ )
+	{
+		nFixes += ptChunks[i].nFixes;
+		bStatus = bStatus && !ptChunks[i].bOutOfMemory;
+	}
+
+	if( bStatus && nFixes > 0 )
+	{
+		ptResult->ptFixes = (GPSLOG_FIX *)malloc( nFixes * sizeof(GPSLOG_FIX) );
+		bStatus = ( ptResult->ptFixes != NULL );
+	}
+
+	for( i = 0; i < nChunks; i++ )
+	{
+		if( bStatus && ptChunks[i].nFixes > 0 )
+		{
+			memcpy( &ptResult->ptFixes[ptResult->nFixes], ptChunks[i].ptFixes, ptChunks[i].nFixes * sizeof(GPSLOG_FIX) );
+			ptResult->nFixes += ptChunks[i].nFixes;
+		}
+
+		ptResult->u64Chars				+= ptChunks[i].u64Chars;
+		ptResult->u32PassedChecksum		+= ptChunks[i].u32PassedChecksum;
+		ptResult->u32FailedChecksum		+= ptChunks[i].u32FailedChecksum;
+		ptResult->u32SentencesWithFix	+= ptChunks[i].u32SentencesWithFix;
+
+		free( ptChunks[i].ptFixes );
+	}
+
+	ptResult->nChunks = (int)nChunks;
+
+	free( ptChunks );
+	free( ptThreads );
+	free( pbStarted );
+
+	if( !bStatus )
+	{
+		fprintf (stderr, "GPS log: out of memory\n") ;
+		GPSLOG_Free( ptResult );
+	}
+
+	return bStatus;
+}
+
+//*****************************************************************************
+//
+//	GPSLOG_Decode
+//
+//	Memory maps an NMEA capture and decodes it with GPSLOG_DecodeBuffer()
+//
+//	Parameters:
+//		path - the capture file
+//		threads - number of threads, or 0 for one per online CPU
+//		ptResult - filled in with the fixes and counters. Release with
+//				   GPSLOG_Free()
+//
+//	Returns:
+//		true on success, false if the file can't be read or out of memory
+//
+//*****************************************************************************
+bool GPSLOG_Decode( const char *path, int threads, GPSLOG_RESULT *ptResult )
+{
+	struct stat tStat;
+	void *pMap;
+	bool bStatus;
+	int fd;
+
+	memset( ptResult, 0, sizeof(*ptResult) );
+
+	fd = open( path, O_RDONLY );
+
+	if( fd < 0 || fstat( fd, &tStat ) < 0 )
+	{
+		fprintf (stderr, "GPS log: unable to open %s: %s\n", path, strerror (errno)) ;
+		if( fd >= 0 ) close( fd );
+		return false;
+	}
+
+	if( tStat.st_size == 0 )
+	{
+		close( fd );
+		return GPSLOG_DecodeBuffer( "", 0, threads, ptResult );
+	}
+
+	pMap = mmap( NULL, tStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if( pMap == MAP_FAILED )
+	{
+		fprintf (stderr, "GPS log: unable to map %s: %s\n", path, strerror (errno)) ;
+		return false;
+	}
+
+	// Every chunk is read front to back
+	madvise( pMap, tStat.st_size, MADV_WILLNEED );
+
+	bStatus = GPSLOG_DecodeBuffer( (const char *)pMap, tStat.st_size, threads, ptResult );
+
+	munmap( pMap, tStat.st_size );
+
+	return bStatus;
+}
+
+//-----------------------------------------------------------------------------
+void GPSLOG_Free( GPSLOG_RESULT *ptResult )
+{
+	free( ptResult->ptFixes );
+	ptResult->ptFixes = NULL;
+	ptResult->nFixes = 0;
+}
@@ -0,0 +1,62 @@
+// GpsLog.h
+// Parallel decoder for recorded NMEA captures
+//
+// The capture is memory mapped and cut into one chunk per core at sentence
+// starts ('$' at the beginning of a line). Each chunk is parsed by its own
+// TinyGPSPlus on its own thread and the fixes are merged back in file
+// order. A worker first replays the GPSLOG_WARMUP_BYTES before its chunk
+// without recording anything, so values that only some sentences carry
+// (date, altitude, satellites) are already known at the chunk's first fix,
+// as they would be in a single pass.
+//
+// Meant for offline analysis on the host; not part of the boat build.
+
+#ifndef GPS_LOG_H
+#define GPS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//-------------------------------------------
+// Global defines
+
+#define GPSLOG_WARMUP_BYTES			16384	// replayed ahead of each chunk, > one 10 Hz multi-GNSS epoch
+#define GPSLOG_MIN_CHUNK_BYTES		(256 * 1024)	// smaller logs use fewer threads
+
+//-------------------------------------------
+// Global typedefs
+
+// One committed fix, with the other fields as they stood when it committed
+typedef struct
+{
+	uint64_t	u64Offset;		// file offset of the sentence that completed the fix
+	int64_t		s64LatNano;		// nanodegrees, + north
+	int64_t		s64LngNano;		// nanodegrees, + east
+	uint32_t	u32Date;		// DDMMYY, 0 if no date seen yet
+	uint32_t	u32Time;		// HHMMSSCC, 0 if no time seen yet
+	int32_t		s32Altitude;	// centimeters
+	int32_t		s32Speed;		// hundredths of a knot
+	int32_t		s32Course;		// hundredths of a degree
+	int32_t		s32Hdop;		// hundredths
+	uint32_t	u32Satellites;
+} GPSLOG_FIX;
+
+typedef struct
+{
+	GPSLOG_FIX	*ptFixes;		// in file order, NULL if there are none
+	size_t		nFixes;
+	uint64_t	u64Chars;		// the TinyGPSPlus counters, summed over all chunks
+	uint32_t	u32PassedChecksum;
+	uint32_t	u32FailedChecksum;
+	uint32_t	u32SentencesWithFix;
+	int			nChunks;		// threads actually used
+} GPSLOG_RESULT;
+
+//-------------------------------------------
+// Function prototypes
+
+bool	GPSLOG_Decode( const char *path, int threads, GPSLOG_RESULT *ptResult );
+bool	GPSLOG_DecodeBuffer( const char *pData, size_t size, int threads, GPSLOG_RESULT *ptResult );
+void	GPSLOG_Free( GPSLOG_RESULT *ptResult );
+
+#endif
@@ -0,0 +1,122 @@
+// GpsReader.cpp
+// Event driven GPS serial reader
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "GpsReader.h"
+#include "RingBuffer.h"
+#include "config.h"
+
+//-------------------------------------------
+// Local data
+
+static int gReaderFd = -1;
+static U32 gu32MicrosPerChar;	// 8N1 character time, 0 if unknown
+static RING_BUFFER gtRing;
+
+//-----------------------------------------------------------------------------
+// Switches the (already open) port to non-blocking so the drain loop below
+// stops at EAGAIN instead of waiting out the tty's VTIME. The baud rate
+// is used to back-date sentences that arrived earlier in a read.
+bool GPSREADER_Init( int fd, int baud )
+{
+	int flags = fcntl( fd, F_GETFL );
+
+	if( flags < 0 || fcntl( fd, F_SETFL, flags | O_NONBLOCK ) < 0 )
+	{
+		fprintf (stderr, "GPS reader: unable to set non-blocking: %s\n", strerror (errno)) ;
+		return false;
+	}
+
+	if( gtRing.pu8Data == NULL && !RING_Init( &gtRing, GPS_RING_BUFFER_SIZE ) )
+	{
+		fprintf (stderr, "GPS reader: out of memory\n") ;
+		return false;
+	}
+
+	gReaderFd = fd;
+	gu32MicrosPerChar = ( baud > 0 ) ? 10000000 / baud : 0;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Call after the port's baud rate changes. Anything still buffered was
+// received at the old rate and is dropped.
+void GPSREADER_SetBaud( int baud )
+{
+	gu32MicrosPerChar = ( baud > 0 ) ? 10000000 / baud : 0;
+	RING_Consume( &gtRing, RING_Used( &gtRing ) );
+}
+
+//-----------------------------------------------------------------------------
+// Waits up to timeout_ms for GPS data, then reads and parses everything
+// that's arrived.
+// Returns the number of sentences committed, 0 on timeout, -1 on error
+// (errno set), or GPS_READER_END_OF_STREAM once the source has closed and
+// everything before that has been parsed.
+int GPSREADER_Service( TinyGPSPlus *pGps, int timeout_ms )
+{
+	struct pollfd tPoll;
+	int sentences = 0;
+	int rc, len;
+
+	tPoll.fd = gReaderFd;
+	tPoll.events = POLLIN;
+	tPoll.revents = 0;
+
+	rc = poll( &tPoll, 1, timeout_ms );
+
+	if( rc < 0 )
+	{
+		return ( errno == EINTR ) ? 0 : -1;
+	}
+
+	if( rc == 0 )
+	{
+		return 0;
+	}
+
+	if( tPoll.revents & ( POLLERR | POLLNVAL ) )
+	{
+		errno = ( tPoll.revents & POLLNVAL ) ? EBADF : EIO;
+		return -1;
+	}
+
+	// Drain the port, parsing whenever the ring fills up
+	do
+	{
+		const U8 *pu8Data;
+		U32 u32Len, u32Arrival;
+
+		len = RING_ReadFromFd( &gtRing, gReaderFd );
+
+		// Everything buffered had arrived by now, the last byte most recently
+		u32Arrival = micros();
+
+		while( ( u32Len = RING_Peek( &gtRing, &pu8Data ) ) > 0 )
+		{
+			// Bytes still behind this span (after a ring wrap) came in later
+			U32 u32After = RING_Used( &gtRing ) - u32Len;
+
+#if DO_GPS_TEST
+			fwrite( pu8Data, 1, u32Len, stdout );
+			fflush( stdout );
+#endif
+			sentences += pGps->encode( (const char *)pu8Data, u32Len,
+									   u32Arrival - u32After * gu32MicrosPerChar, gu32MicrosPerChar );
+			RING_Consume( &gtRing, u32Len );
+		}
+	} while( len > 0 );
+
+	if( len == RING_END_OF_FILE )
+	{
+		// Report the last sentences now and the end on the next call
+		return ( sentences > 0 ) ? sentences : GPS_READER_END_OF_STREAM;
+	}
+
+	return ( len < 0 ) ? -1 : sentences;
+}
@@ -0,0 +1,28 @@
+// GpsReader.h
+// Event driven GPS serial reader
+//
+// Sleeps in poll() until the port has data, drains it with bulk read()s
+// into a ring buffer and hands the buffered bytes to TinyGPSPlus straight
+// away, so a sentence is parsed as soon as its last byte arrives. Each read
+// is timestamped so sentences carry the time they arrived on the wire.
+
+#ifndef GPS_READER_H
+#define GPS_READER_H
+
+#include "TinyGPS++.h"	// pulls in includes.h after <math.h>
+
+//-------------------------------------------
+// Global defines
+
+#define GPS_RING_BUFFER_SIZE		4096	// bytes
+#define GPS_POLL_TIMEOUT_MS			1000	// longest wait for data before returning
+#define GPS_READER_END_OF_STREAM	-2		// GPSREADER_Service(): port or replay closed
+
+//-------------------------------------------
+// Function prototypes
+
+bool	GPSREADER_Init( int fd, int baud );
+void	GPSREADER_SetBaud( int baud );
+int		GPSREADER_Service( TinyGPSPlus *pGps, int timeout_ms );
+
+#endif
@@ -30,15 +30,31 @@
 #include <math.h>
 #include <string.h>
 #include <errno.h>
-
-#include <wiringPi.h>
-#include <wiringSerial.h>
+#include <poll.h>
 
 #include "includes.h"
+#include "Transport.h"
 #include "HMC6343.h"
 
 //*** local defines and typedefs *********************************************
 
+#define COMPASS_BAUD						9600
+#define COMPASS_CHAR_US						(10000000 / COMPASS_BAUD)	// 8N1 character time
+
+// SC18IM700 I2C frame: 'S' <address> <count> [data ...] 'P'
+#define SC18IM700__START					'S'
+#define SC18IM700__STOP						'P'
+#define SC18IM700__FRAME_OVERHEAD			(4)
+#define SC18IM700__MAX_FRAMES_SIZE			(2 * SC18IM700__FRAME_OVERHEAD + HMC6343__MAX_CMD_SIZE)
+
+// Most single byte commands sent chained in one write() by Pipeline()
+#define PIPELINE_MAX_COMMANDS				(3)
+
+// The bridge can't start a read until the read frame's header is in, so a
+// read frame sent straight behind a command starts at least this long
+// after the command
+#define SC18IM700__CHAINED_READ_US			((SC18IM700__FRAME_OVERHEAD - 1) * COMPASS_CHAR_US)
+
 #define REGISTER__SETUP(reg)				{ HMC6343__##reg##_REG, HMC6343__##reg##_REG__SETUP }
 
 typedef struct
@@ -47,54 +63,197 @@ typedef struct
 	U8	u8Setup;
 } REGISTER_SETUP;
 
-//*** global variable definitions ********************************************
-int gfd;
+//*** local variable definitions *********************************************
+
+// Link to the SC18IM700 (Master I2C controller with uart interface)
+static Transport *gptCompassPort = NULL;
+
+static int gResponseTimeoutMs = HMC6343__RESPONSE_TIMEOUT_MS;
+
+static HMC6343_LATENCY gtLatency;
+
+// micros() when the last frame written will have crossed the serial line
+static U32 gu32LineClearUs;
 
 //*** local function declarations ********************************************
 
+static int AddWriteFrame( U8 *pFrame, U8 cmd, U8 arg1, U8 arg2, U8 size );
+
+static int AddReadFrame( U8 *pFrame, U8 size );
+
+static bool SendFrames( const U8 *pFrames, int size );
+
+static void WaitAfterCommand( int ms );
+
 static bool SendCommand( U8 cmd, U8 arg1, U8 arg2, U8 size);
 
+static void RecordLatency( bool bStatus, U32 u32LatencyUs );
+
+static bool CollectResponse( U8 *pBuffer, U8 size, U32 u32SentUs, int wireChars );
+
 static bool ReadResponseBytes( U8 *pBuffer, U8 size);
 
+static bool Transaction( U8 cmd, U8 arg1, U8 arg2, U8 cmdSize, int cmdDelayMs, U8 *pBuffer, U8 size );
+
+static bool Pipeline( const U8 *pu8Cmds, int count, int cmdDelayMs, U8 *pBuffer, U8 size, U32 *pu32SentUs );
+
+static S16 GetS16( const U8 *pu8Data );
+
 //*** local function definitions ********************************************
+
+//-----------------------------------------------------------------------------
+// Builds the frame that writes a 1 to 3 byte command to the compass.
+// Returns the frame length.
+static int AddWriteFrame( U8 *pFrame, U8 cmd, U8 arg1, U8 arg2, U8 size )
+{
+	int len = 0;
+
+	pFrame[len++] = SC18IM700__START;
+	pFrame[len++] = (U8)HMC6343__ADDRESS;
+
+	// Size, one more than the data bytes, byte for byte as the per-byte
+	// version of this driver sent it
+	pFrame[len++] = size + 1;
+
+	// Data
+	pFrame[len++] = cmd;
+
+	if( size >= 2 )
+	{
+		pFrame[len++] = arg1;
+	}
+
+	if( size >= 3 )
+	{
+		pFrame[len++] = arg2;
+	}
+
+	pFrame[len++] = SC18IM700__STOP;
+
+	return len;
+}
+
+//-----------------------------------------------------------------------------
+// Builds the frame that reads "size" bytes back from the compass.
+// Returns the frame length.
+static int AddReadFrame( U8 *pFrame, U8 size )
+{
+	pFrame[0] = SC18IM700__START;
+	pFrame[1] = (U8)HMC6343__ADDRESS | 0x01;
+	pFrame[2] = size;
+	pFrame[3] = SC18IM700__STOP;
+
+	return SC18IM700__FRAME_OVERHEAD;
+}
+
+//-----------------------------------------------------------------------------
+// One write() for any number of frames
+static bool SendFrames( const U8 *pFrames, int size )
+{
+	U32 u32NowUs = micros();
+
+	// Behind whatever is still going out
+	if( (S32)( gu32LineClearUs - u32NowUs ) < 0 )
+	{
+		gu32LineClearUs = u32NowUs;
+	}
+
+	gu32LineClearUs += size * COMPASS_CHAR_US;
+
+	return ( gptCompassPort->Write( pFrames, size ) == size );
+}
+
+//-----------------------------------------------------------------------------
+// Waits until the last command has had ms milliseconds at the compass.
+// write() returns as soon as the frame is queued, and the compass only
+// gets the command once the frame has crossed the serial line, so the
+// wait starts from then.
+static void WaitAfterCommand( int ms )
+{
+	S32 s32WaitUs = (S32)( gu32LineClearUs - micros() ) + ms * 1000;
+
+	if( s32WaitUs > 0 )
+	{
+		TOOLS_delay( ( s32WaitUs + 999 ) / 1000 );
+	}
+}
+
+//-----------------------------------------------------------------------------
 bool SendCommand( U8 cmd, U8 arg1, U8 arg2, U8 size)
 {
-	U8 au8CommandStream[HMC6343__MAX_CMD_SIZE];
-	int i;
+	U8 au8Frame[SC18IM700__MAX_FRAMES_SIZE];
+
+	return SendFrames( au8Frame, AddWriteFrame( au8Frame, cmd, arg1, arg2, size ) );
+}
+
+//-----------------------------------------------------------------------------
+static void RecordLatency( bool bStatus, U32 u32LatencyUs )
+{
+	U32 u32Bucket = min( u32LatencyUs / HMC6343__LATENCY_BUCKET_US, HMC6343__LATENCY_BUCKETS - 1 );
 
-	switch (size)
+	if( !bStatus )
 	{
-		case 3:
-			au8CommandStream[2] = arg2;
-			// fall through
-		case 2:
-			au8CommandStream[1] = arg1;
-			// fall through
-		case 1:
-			au8CommandStream[0] = cmd;
-			break;
+		gtLatency.u32Timeouts++;
+		return;
 	}
 
-	// Start
-	serialPutchar( gfd, 'S' );
+	gtLatency.au32Count[u32Bucket]++;
+	gtLatency.u32MaxUs = max( gtLatency.u32MaxUs, u32LatencyUs );
+}
 
-	// I2C Address
-	serialPutchar( gfd, (U8)HMC6343__ADDRESS );
+//-----------------------------------------------------------------------------
+// Collects the bytes a read frame asked for as they arrive, returning as soon
+// as the last one is in. Gives up once the transaction's serial time
+// (wireChars characters, both ways) plus the response timeout has passed
+// since u32SentUs.
+static bool CollectResponse( U8 *pBuffer, U8 size, U32 u32SentUs, int wireChars )
+{
+	U32 u32TimeoutUs = wireChars * COMPASS_CHAR_US + gResponseTimeoutMs * 1000;
+	U32 u32ElapsedUs = 0;
+	int received = 0;
 
-	// Size
-	serialPutchar( gfd, (U8)size + 1 );
+	while( received < size )
+	{
+		struct pollfd tPoll = { gptCompassPort->GetFd(), POLLIN, 0 };
+		int len;
 
-	// Data
-	for(i=0; i<size; i++ )
+		u32ElapsedUs = micros() - u32SentUs;
+
+		if( u32ElapsedUs >= u32TimeoutUs )
+		{
+			break;
+		}
+
+		if( poll( &tPoll, 1, ( u32TimeoutUs - u32ElapsedUs + 999 ) / 1000 ) < 0 && errno != EINTR )
+		{
+			break;
+		}
+
+		// Take whatever is there; a short read is finished on the next pass
+		len = gptCompassPort->Read( pBuffer + received, size - received );
+
+		if( len < 0 )
+		{
+			break;
+		}
+
+		received += len;
+	}
+
+	if( received == size )
 	{
-		serialPutchar( gfd, (U8)au8CommandStream[i] );
+		u32ElapsedUs = micros() - u32SentUs;
 	}
 
-	// Stop
-	serialPutchar( gfd, 'P' );
-
-	return true;
+	RecordLatency( received == size, u32ElapsedUs );
+
+	if( received < size )
+	{
+		printf("ReadResponseBytes failed. Bytes received: %i of %i\n", received, size);
+		gptCompassPort->Flush();
+	}
 
+	return ( received == size );
 }
 
 //*****************************************************************************
@@ -108,49 +267,123 @@ bool SendCommand( U8 cmd, U8 arg1, U8 arg2, U8 size)
 //		size - number of expected return bytes
 //
 //	Returns:
-//		nothing
+//		true if all the bytes were read
 //
 //*****************************************************************************
 bool ReadResponseBytes( U8 *pBuffer, U8 size)
 {
-	int i;
-	int size_avail;
-	bool bStatus = false;
+	U8 au8Frame[SC18IM700__FRAME_OVERHEAD];
+	U32 u32SentUs = micros();
+	int len = AddReadFrame( au8Frame, size );
 
-	// Start
-	serialPutchar( gfd, 'S' );
+	return SendFrames( au8Frame, len ) &&
+		   CollectResponse( pBuffer, size, u32SentUs, len + size );
+}
 
-	// I2C Address
-	serialPutchar( gfd, (U8)HMC6343__ADDRESS | 0x01 );
+//*****************************************************************************
+//
+//	Transaction
+//
+//	Sends a command and reads back its response. If the compass answers
+//	within the time the read frame takes to cross the wire, both frames go
+//	out in a single write(). Otherwise the command is sent on its own and
+//	the read follows once the command has had cmdDelayMs at the compass.
+//
+//	Parameters:
+//		cmd, arg1, arg2, cmdSize - the command, as for SendCommand()
+//		cmdDelayMs - time the compass needs before the response is ready
+//		buffer - pointer to U8 buffer to fill
+//		size - number of expected return bytes
+//
+//	Returns:
+//		true if all the bytes were read
+//
+//*****************************************************************************
+static bool Transaction( U8 cmd, U8 arg1, U8 arg2, U8 cmdSize, int cmdDelayMs, U8 *pBuffer, U8 size )
+{
+	U8 au8Frames[SC18IM700__MAX_FRAMES_SIZE];
+	U32 u32SentUs;
+	int len;
+
+	if( cmdDelayMs * 1000 >= SC18IM700__CHAINED_READ_US )
+	{
+		if( !SendCommand( cmd, arg1, arg2, cmdSize ) )
+		{
+			return false;
+		}
+
+		WaitAfterCommand( cmdDelayMs );
 
-	// Size
-	serialPutchar( gfd, (U8)size );
+		return ReadResponseBytes( pBuffer, size );
+	}
 
-	// Stop
-	serialPutchar( gfd, 'P' );
+	len = AddWriteFrame( au8Frames, cmd, arg1, arg2, cmdSize );
+	len += AddReadFrame( au8Frames + len, size );
 
-	delay(5);
+	u32SentUs = micros();
 
-	size_avail = serialDataAvail( gfd );
+	return SendFrames( au8Frames, len ) &&
+		   CollectResponse( pBuffer, size, u32SentUs, len + size );
+}
 
-	if( size_avail == size )
+//*****************************************************************************
+//
+//	Pipeline
+//
+//	Runs several single byte commands that each answer with "size" bytes as
+//	one write() of chained command and read frames, then collects all the
+//	answers. Each read frame still reaches the bridge after its command has
+//	had cmdDelayMs, so this is only for commands that qualify for chaining
+//	in Transaction(); others are run one at a time.
+//
+//	Parameters:
+//		pu8Cmds - the commands, at most PIPELINE_MAX_COMMANDS
+//		count - number of commands
+//		cmdDelayMs - time the compass needs before each response is ready
+//		buffer - filled with the responses, in command order
+//		size - bytes per response
+//		pu32SentUs - set to micros() when the commands were sent
+//
+//	Returns:
+//		true if every response was read
+//
+//*****************************************************************************
+static bool Pipeline( const U8 *pu8Cmds, int count, int cmdDelayMs, U8 *pBuffer, U8 size, U32 *pu32SentUs )
+{
+	U8 au8Frames[PIPELINE_MAX_COMMANDS * ( 2 * SC18IM700__FRAME_OVERHEAD + 1 )];
+	int len = 0;
+	int i;
+
+	*pu32SentUs = micros();
+
+	if( cmdDelayMs * 1000 >= SC18IM700__CHAINED_READ_US )
 	{
-		// Get Data
-		for(i=0; i<size_avail; i++ )
+		for( i = 0; i < count; i++ )
 		{
-			*pBuffer++ = serialGetchar ( gfd );
+			if( !Transaction( pu8Cmds[i], 0, 0, 1, cmdDelayMs, pBuffer + i * size, size ) )
+			{
+				return false;
+			}
 		}
 
-		bStatus = true;
+		return true;
 	}
 
-	if( !bStatus )
+	for( i = 0; i < count; i++ )
 	{
-		printf("ReadResponseBytes failed. Bytes available: %i\n", size_avail);
-		serialFlush( gfd );
+		len += AddWriteFrame( au8Frames + len, pu8Cmds[i], 0, 0, 1 );
+		len += AddReadFrame( au8Frames + len, size );
 	}
 
-	return bStatus;
+	return SendFrames( au8Frames, len ) &&
+		   CollectResponse( pBuffer, count * size, *pu32SentUs, len + count * size );
+}
+
+//-----------------------------------------------------------------------------
+// MSB first, two's complement
+static S16 GetS16( const U8 *pu8Data )
+{
+	return (short)( pu8Data[0] << 8 | pu8Data[1] );
 }
 
 //*** global function declarations ********************************************
@@ -193,13 +426,14 @@ void HMC6343_SendCommand( U8 cmd )
 //	Initializes the default state of the compass.
 //
 //	Parameters:
-//		none
+//		port - transport spec for the SC18IM700 link (see Transport.h),
+//			   normally COMPASS_SERIAL_PORT
 //
 //	Returns:
-//		nothing
+//		true if the link opened
 //
 //*****************************************************************************
-void HMC6343_Setup( void )
+bool HMC6343_Setup( const char *port )
 {
 	static const REGISTER_SETUP atRegisterSetup[] =
 	{
@@ -210,27 +444,28 @@ void HMC6343_Setup( void )
 	REGISTER_SETUP const* ptRegisterSetup;
 	S16 s16Size;
 	U8 u8RegData;
+	bool bUpdated = false;
 
-	// Open the WiringPi serial port to SC18IM700 (Master I2C controller with uart interface)
-	printf("Opening serial port ... ");
-	gfd = serialOpen( COMPASS_SERIAL_PORT , 9600 );
+	// Open the link to SC18IM700 (Master I2C controller with uart interface)
+	printf("Opening %s ... ", port);
+	gptCompassPort = TRANSPORT_Open( port, COMPASS_BAUD );
 
-	if( !gfd )
+	if( gptCompassPort == NULL )
 	{
 		fprintf (stderr, "Unable to open serial port: %s\n", strerror (errno)) ;
-		return;
+		return false;
 	}
 	else
 	{
 		printf("Serial Port opened\n");
-		serialFlush( gfd );
+		gptCompassPort->Flush();
 	}
 
 	// reset the compass
 	HMC6343_SendCommand( HMC6343__RESET_CPU__CMD );
 
 	// per chip spec, wait 500ms after reset
-	delay( 500 );
+	WaitAfterCommand( 500 );
 
 	// Verify operational mode registers are set correctly
 	for (
@@ -240,21 +475,16 @@ void HMC6343_Setup( void )
 		ptRegisterSetup++
 	)
 	{
-		// Read
-		SendCommand(
+		// Read. EEPROM read/writes need 10ms delay per spec
+		bool bRead = Transaction(
 			HMC6343__READ_EEPROM__CMD,
 			ptRegisterSetup->u8Register, 0,
-			HMC6343__READ_EEPROM__CMD_SIZE );
-
-		// EEPROM read/writes need 10ms delay per spec
-		delay( 10 );
-
-		ReadResponseBytes(
+			HMC6343__READ_EEPROM__CMD_SIZE, 10,
 			&u8RegData,
 			HMC6343__READ_EEPROM__DATA_SIZE );
 
-		// Verify
-		if( ptRegisterSetup->u8Setup != u8RegData )
+		// Verify. If the read failed, writing it anyway is harmless
+		if( !bRead || ptRegisterSetup->u8Setup != u8RegData )
 		{
 			// Update
 			SendCommand(
@@ -264,14 +494,26 @@ void HMC6343_Setup( void )
 				HMC6343__WRITE_EEPROM__CMD_SIZE
 			);
 
-			delay(10);
+			WaitAfterCommand( 10 );
+
+			bUpdated = true;
 		}
 	}
 
+	// Operational modes (e.g. the measurement rate) are loaded from EEPROM
+	// at reset, so reset again for updated ones to take effect
+	if( bUpdated )
+	{
+		HMC6343_SendCommand( HMC6343__RESET_CPU__CMD );
+		WaitAfterCommand( 500 );
+	}
+
 	SendCommand(
 			HMC6343__SET_UP_FLAT_ORIENT__CMD, 0, 0,
 			HMC6343__SET_UP_FLAT_ORIENT__CMD_SIZE
 	);
+
+	return true;
 }
 
 //*****************************************************************************
@@ -306,23 +548,244 @@ void HMC6343_Shutdown( void )
 //
 //*****************************************************************************
 S16 HMC6343_GetHeading( void )
+{
+	S16 s16Heading, s16Pitch, s16Roll;
+
+	if( !HMC6343_GetHeadingData( &s16Heading, &s16Pitch, &s16Roll ) )
+	{
+		s16Heading = COMPASS_HEADING_INVALID;
+	}
+
+	return s16Heading;
+}
+
+//*****************************************************************************
+//
+//	HMC6343_GetHeadingData
+//
+//	Gets the current heading, pitch and roll in tenths of degrees, from the
+//	one heading data frame
+//
+//	Parameters:
+//		ps16Heading - heading, 0 to 3599
+//		ps16Pitch - pitch, -900 to 900
+//		ps16Roll - roll, -900 to 900
+//
+//	Returns:
+//		true if the compass answered; the outputs are untouched otherwise
+//
+//*****************************************************************************
+bool HMC6343_GetHeadingData( S16 *ps16Heading, S16 *ps16Pitch, S16 *ps16Roll )
 {
 	U8 u8HeadPitchRoll[HMC6343__GET_HEADING_DATA__DATA_SIZE];
-	S16 s16Heading = COMPASS_HEADING_INVALID;
 
-	if (SendCommand(
+	// Heading data is ready 1ms after the command
+	if( !Transaction(
 			HMC6343__GET_HEADING_DATA__CMD, 0, 0,
-			HMC6343__GET_HEADING_DATA__CMD_SIZE
+			HMC6343__GET_HEADING_DATA__CMD_SIZE, 1,
+			u8HeadPitchRoll, HMC6343__GET_HEADING_DATA__DATA_SIZE
 		)
 	)
 	{
-		delay(1);
+		return false;
+	}
+
+	*ps16Heading	= (U16)(u8HeadPitchRoll[0]<<8 | u8HeadPitchRoll[1]);
+	*ps16Pitch		= GetS16( &u8HeadPitchRoll[2] );
+	*ps16Roll		= GetS16( &u8HeadPitchRoll[4] );
+
+	return true;
+}
+
+//*****************************************************************************
+//
+//	HMC6343_GetAttitude
+//
+//	Gets heading, pitch, roll, acceleration and magnetic field together.
+//	The three data commands and their reads go out chained in one write()
+//	and the answers come back in one stream, so this costs about the same
+//	as a heading read plus the extra bytes on the wire.
+//
+//	Parameters:
+//		ptAttitude - filled in with the readings and when they were taken
+//
+//	Returns:
+//		true if the compass answered; ptAttitude is untouched otherwise
+//
+//*****************************************************************************
+bool HMC6343_GetAttitude( HMC6343_ATTITUDE *ptAttitude )
+{
+	static const U8 au8Cmds[] =
+	{
+		HMC6343__GET_HEADING_DATA__CMD,
+		HMC6343__GET_ACCEL_DATA__CMD,
+		HMC6343__GET_MAG_DATA__CMD
+	};
+	U8 au8Data[sizeof(au8Cmds) * HMC6343__GET_HEADING_DATA__DATA_SIZE];
+	U32 u32SentUs;
+	int i;
+
+	// All three answer with 6 bytes, 1ms after the command
+	if( !Pipeline( au8Cmds, sizeof(au8Cmds), 1, au8Data, HMC6343__GET_HEADING_DATA__DATA_SIZE, &u32SentUs ) )
+	{
+		return false;
+	}
+
+	ptAttitude->s16Heading	= (U16)(au8Data[0]<<8 | au8Data[1]);
+	ptAttitude->s16Pitch	= GetS16( &au8Data[2] );
+	ptAttitude->s16Roll		= GetS16( &au8Data[4] );
+
+	for( i = 0; i < 3; i++ )
+	{
+		ptAttitude->as16Accel[i]	= GetS16( &au8Data[HMC6343__GET_HEADING_DATA__DATA_SIZE + 2 * i] );
+		ptAttitude->as16Mag[i]		= GetS16( &au8Data[2 * HMC6343__GET_HEADING_DATA__DATA_SIZE + 2 * i] );
+	}
+
+	ptAttitude->u32SampleTime = u32SentUs;
 
-		if( ReadResponseBytes( u8HeadPitchRoll, HMC6343__GET_HEADING_DATA__DATA_SIZE) )
+	return true;
+}
+
+//*****************************************************************************
+//
+//	HMC6343_GetOffsets
+//
+//	Reads the hard iron offsets in EEPROM. The chip has already taken these
+//	off every magnetometer reading, so a calibration fitted to those
+//	readings is relative to them.
+//
+//	Parameters:
+//		ps16X, ps16Y, ps16Z - filled in with the offsets, in the chip's axes
+//			and magnetometer counts
+//
+//	Returns:
+//		true if every byte was read
+//
+//*****************************************************************************
+bool HMC6343_GetOffsets( S16 *ps16X, S16 *ps16Y, S16 *ps16Z )
+{
+	S16 *aps16Offset[3] = { ps16X, ps16Y, ps16Z };
+	U8 au8Data[2];
+	int i, j;
+
+	for( i = 0; i < 3; i++ )
+	{
+		// LSB, then MSB in the next register. EEPROM reads need 10ms per spec
+		for( j = 0; j < 2; j++ )
 		{
-			s16Heading = (U16)(u8HeadPitchRoll[0]<<8 | u8HeadPitchRoll[1]);
+			if( !Transaction(
+					HMC6343__READ_EEPROM__CMD,
+					HMC6343__X_OFFSET_LSB_REG + 2 * i + j, 0,
+					HMC6343__READ_EEPROM__CMD_SIZE, 10,
+					&au8Data[j],
+					HMC6343__READ_EEPROM__DATA_SIZE ) )
+			{
+				return false;
+			}
 		}
+
+		// Two's complement, LSB first unlike the measurement data
+		*aps16Offset[i] = (short)( au8Data[1] << 8 | au8Data[0] );
 	}
 
-	return s16Heading;
+	return true;
+}
+
+//*****************************************************************************
+//
+//	HMC6343_SetOffsets
+//
+//	Writes hard iron offsets to EEPROM, replacing the ones from the chip's
+//	own calibration mode, and resets the compass so it uses them.
+//
+//	Parameters:
+//		s16X, s16Y, s16Z - offsets, in the chip's axes and magnetometer counts
+//
+//	Returns:
+//		true if every byte was sent
+//
+//*****************************************************************************
+bool HMC6343_SetOffsets( S16 s16X, S16 s16Y, S16 s16Z )
+{
+	const struct
+	{
+		U8	u8LsbRegister;
+		S16	s16Offset;
+	} atOffsets[] =
+	{
+		{ HMC6343__X_OFFSET_LSB_REG, s16X },
+		{ HMC6343__Y_OFFSET_LSB_REG, s16Y },
+		{ HMC6343__Z_OFFSET_LSB_REG, s16Z }
+	};
+	bool bStatus = true;
+	int i;
+
+	for( i = 0; i < 3; i++ )
+	{
+		// LSB, then MSB in the next register. EEPROM writes need 10ms per spec
+		bStatus = SendCommand(
+				HMC6343__WRITE_EEPROM__CMD,
+				atOffsets[i].u8LsbRegister,
+				atOffsets[i].s16Offset & 0xFF,
+				HMC6343__WRITE_EEPROM__CMD_SIZE ) && bStatus;
+		WaitAfterCommand( 10 );
+
+		bStatus = SendCommand(
+				HMC6343__WRITE_EEPROM__CMD,
+				atOffsets[i].u8LsbRegister + 1,
+				( atOffsets[i].s16Offset >> 8 ) & 0xFF,
+				HMC6343__WRITE_EEPROM__CMD_SIZE ) && bStatus;
+		WaitAfterCommand( 10 );
+	}
+
+	// Offsets are loaded from EEPROM at reset. The reset also drops the
+	// orientation set in HMC6343_Setup(), so set it again
+	HMC6343_SendCommand( HMC6343__RESET_CPU__CMD );
+	WaitAfterCommand( 500 );
+
+	SendCommand(
+			HMC6343__SET_UP_FLAT_ORIENT__CMD, 0, 0,
+			HMC6343__SET_UP_FLAT_ORIENT__CMD_SIZE
+	);
+
+	return bStatus;
+}
+
+//*****************************************************************************
+//
+//	HMC6343_SetResponseTimeout
+//
+//	Sets how long to wait for a response beyond the time the transaction
+//	itself takes on the serial line. Responses are taken as soon as they
+//	arrive; this only bounds the wait for one that doesn't.
+//
+//	Parameters:
+//		timeout_ms - milliseconds, HMC6343__RESPONSE_TIMEOUT_MS by default
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void HMC6343_SetResponseTimeout( int timeout_ms )
+{
+	gResponseTimeoutMs = max( timeout_ms, 0 );
+}
+
+//*****************************************************************************
+//
+//	HMC6343_GetLatency
+//
+//	Copies out the response latency histogram: transactions counted by the
+//	time from sending them to their last response byte.
+//
+//	Parameters:
+//		ptLatency - filled in with the histogram
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void HMC6343_GetLatency( HMC6343_LATENCY *ptLatency )
+{
+	*ptLatency = gtLatency;
 }
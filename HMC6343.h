@@ -49,6 +49,32 @@
 
 #define COMPASS_HEADING_INVALID													-1
 
+// How long to wait for a response beyond the transaction's own serial time
+// (see HMC6343_SetResponseTimeout)
+#define HMC6343__RESPONSE_TIMEOUT_MS											10
+
+// Response latency histogram, from sending a transaction to its last byte
+#define HMC6343__LATENCY_BUCKET_US												1000
+#define HMC6343__LATENCY_BUCKETS												32		// the last also counts anything slower
+
+typedef struct
+{
+	U32	au32Count[HMC6343__LATENCY_BUCKETS];
+	U32	u32Timeouts;
+	U32	u32MaxUs;
+} HMC6343_LATENCY;
+
+// Everything the compass measures, from one pipelined acquisition
+typedef struct
+{
+	S16	s16Heading;			// tenths of degrees, 0 to 3599
+	S16	s16Pitch;			// tenths of degrees, -900 to 900
+	S16	s16Roll;			// tenths of degrees, -900 to 900
+	S16	as16Accel[3];		// X, Y, Z, raw accelerometer counts
+	S16	as16Mag[3];			// X, Y, Z, raw magnetometer counts
+	U32	u32SampleTime;		// micros() when the acquisition was sent
+} HMC6343_ATTITUDE;
+
 //
 //	HMC6343 byte stream:
 //	#---#-----+-----+-----+-----+-----+-----+-----+-----#---#-----+-----+-----+-----+-----+-----+-----+-----#---#----+----+----+----+----+----+----+----#---#---#
@@ -431,9 +457,15 @@ Byte
 
 //*** global function prototypes *********************************************
 
-void	HMC6343_Setup( void );
+bool	HMC6343_Setup( const char *port );
 void	HMC6343_Shutdown( void );
 void	HMC6343_SendCommand( U8 cmd );
 S16		HMC6343_GetHeading( void );
+bool	HMC6343_GetHeadingData( S16 *ps16Heading, S16 *ps16Pitch, S16 *ps16Roll );
+bool	HMC6343_GetAttitude( HMC6343_ATTITUDE *ptAttitude );
+bool	HMC6343_GetOffsets( S16 *ps16X, S16 *ps16Y, S16 *ps16Z );
+bool	HMC6343_SetOffsets( S16 s16X, S16 s16Y, S16 s16Z );
+void	HMC6343_SetResponseTimeout( int timeout_ms );
+void	HMC6343_GetLatency( HMC6343_LATENCY *ptLatency );
 
 #endif // _HMC6343_H
@@ -0,0 +1,255 @@
+// Heading.cpp
+// Tilt compensated heading from raw accelerometer and magnetometer vectors
+
+#include <math.h>
+#include <string.h>
+#include "Heading.h"
+
+//-------------------------------------------
+// Local defines and typedefs
+
+#define DEGREES_PER_RADIAN_F	57.2957795f
+
+// Four samples at a time; SSE on x86, NEON on the Pi, plain code elsewhere
+typedef float v4sf __attribute__((vector_size(16)));
+
+//-----------------------------------------------------------------------------
+// Per type helpers, so the solver below is written once for one sample and
+// for four
+static inline float Sqrt( float x )
+{
+	return sqrtf( x );
+}
+
+static inline v4sf Sqrt( v4sf x )
+{
+	v4sf r;
+
+	for( int i = 0; i < 4; i++ )
+	{
+		r[i] = sqrtf( x[i] );
+	}
+
+	return r;
+}
+
+//-----------------------------------------------------------------------------
+// atan2 without branches or library calls: Abramowitz & Stegun 4.4.49 on
+// the ratio folded into the first octant. Good to about 1e-5 degrees in
+// single precision.
+template <typename T>
+static inline T Atan2( T y, T x )
+{
+	T ax = x < 0 ? -x : x;
+	T ay = y < 0 ? -y : y;
+	T big = ax > ay ? ax : ay;
+	T small = ax > ay ? ay : ax;
+	T t = small / ( big + 1e-30f );
+	T t2 = t * t;
+	T r = t * ( 0.9999993329f + t2 * ( -0.3332985605f + t2 * ( 0.1994653599f + t2 * ( -0.1390853351f +
+			t2 * ( 0.0964200441f + t2 * ( -0.0559098861f + t2 * ( 0.0218612288f + t2 * -0.0040540580f ) ) ) ) ) ) );
+
+	r = ay > ax ? 1.57079633f - r : r;
+	r = x < 0 ? 3.14159265f - r : r;
+
+	return y < 0 ? -r : r;
+}
+
+//-----------------------------------------------------------------------------
+// Down is opposite the specific force. East is perpendicular to down and the
+// field, north is perpendicular to east and down, and the heading is the
+// angle of the bow (body X) from north towards east. No trig beyond atan2.
+template <typename T>
+static inline void Solve( T ax, T ay, T az, T mx, T my, T mz, T &heading, T &pitch, T &roll )
+{
+	T dx = -ax, dy = -ay, dz = -az;
+	T ex = dy * mz - dz * my;
+	T ey = dz * mx - dx * mz;
+	T ez = dx * my - dy * mx;
+	T nx = ey * dz - ez * dy;
+	T dyz = dy * dy + dz * dz;
+	T h;
+
+	// |N| = |E| |D|, so E is scaled by |D| to match
+	h = Atan2( ex * Sqrt( dx * dx + dyz ), nx ) * DEGREES_PER_RADIAN_F;
+
+	heading = h < 0 ? h + 360.0f : h;
+	pitch = Atan2( -dx, Sqrt( dyz ) ) * DEGREES_PER_RADIAN_F;
+	roll = Atan2( dy, dz ) * DEGREES_PER_RADIAN_F;
+}
+
+//-----------------------------------------------------------------------------
+// First order low-pass weight for a sample dt seconds after the last
+static float Smoothing( float fTau, float fDt )
+{
+	if( fTau <= 0 )
+	{
+		return 1;
+	}
+
+	return fDt / ( fTau + fDt );
+}
+
+//*****************************************************************************
+//
+//	HEADING_Compute
+//
+//	Tilt compensated heading, pitch and roll from one sample
+//
+//	Parameters:
+//		afAccel - accelerometer X, Y, Z in the boat frame
+//		afMag - magnetometer X, Y, Z in the boat frame
+//		ptAttitude - filled in with the result
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void HEADING_Compute( const float afAccel[3], const float afMag[3], HEADING_ATTITUDE *ptAttitude )
+{
+	Solve( afAccel[0], afAccel[1], afAccel[2], afMag[0], afMag[1], afMag[2],
+		   ptAttitude->fHeading, ptAttitude->fPitch, ptAttitude->fRoll );
+}
+
+//*****************************************************************************
+//
+//	HEADING_ComputeBatch
+//
+//	HEADING_Compute() over arrays of samples, e.g. a log being reprocessed.
+//	Works four samples at a time and gives the same results.
+//
+//	Parameters:
+//		ptSamples - the accelerometer and magnetometer arrays
+//		count - number of samples
+//		pfHeading, pfPitch, pfRoll - outputs, count long. Pitch and roll
+//			may be NULL if they're not wanted.
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void HEADING_ComputeBatch( const HEADING_SAMPLES *ptSamples, int count, float *pfHeading, float *pfPitch, float *pfRoll )
+{
+	int i = 0;
+
+	for( ; i + 4 <= count; i += 4 )
+	{
+		v4sf ax, ay, az, mx, my, mz, h, p, r;
+
+		// memcpy, as the arrays needn't be 16 byte aligned
+		memcpy( &ax, ptSamples->pfAx + i, sizeof(ax) );
+		memcpy( &ay, ptSamples->pfAy + i, sizeof(ay) );
+		memcpy( &az, ptSamples->pfAz + i, sizeof(az) );
+		memcpy( &mx, ptSamples->pfMx + i, sizeof(mx) );
+		memcpy( &my, ptSamples->pfMy + i, sizeof(my) );
+		memcpy( &mz, ptSamples->pfMz + i, sizeof(mz) );
+
+		Solve( ax, ay, az, mx, my, mz, h, p, r );
+
+		memcpy( pfHeading + i, &h, sizeof(h) );
+
+		if( pfPitch )
+		{
+			memcpy( pfPitch + i, &p, sizeof(p) );
+		}
+
+		if( pfRoll )
+		{
+			memcpy( pfRoll + i, &r, sizeof(r) );
+		}
+	}
+
+	for( ; i < count; i++ )
+	{
+		float p, r;
+
+		Solve( ptSamples->pfAx[i], ptSamples->pfAy[i], ptSamples->pfAz[i],
+			   ptSamples->pfMx[i], ptSamples->pfMy[i], ptSamples->pfMz[i],
+			   pfHeading[i], p, r );
+
+		if( pfPitch )
+		{
+			pfPitch[i] = p;
+		}
+
+		if( pfRoll )
+		{
+			pfRoll[i] = r;
+		}
+	}
+}
+
+//*****************************************************************************
+//
+//	HEADING_FilterInit
+//
+//	Sets up a filter for a live stream of samples
+//
+//	Parameters:
+//		ptFilter - the filter
+//		fGravityTau - time constant for the gravity and field estimates,
+//			seconds. Long enough to average out wave motion.
+//		fHeadingTau - time constant for the heading, seconds. 0 for none.
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void HEADING_FilterInit( HEADING_FILTER *ptFilter, float fGravityTau, float fHeadingTau )
+{
+	memset( ptFilter, 0, sizeof(*ptFilter) );
+
+	ptFilter->fGravityTau = fGravityTau;
+	ptFilter->fHeadingTau = fHeadingTau;
+}
+
+//*****************************************************************************
+//
+//	HEADING_FilterUpdate
+//
+//	Adds a sample to the filter and solves for the smoothed attitude. The
+//	magnetometer is smoothed with the same time constant as gravity: solving
+//	a raw field against a smoothed gravity vector puts the roll of every
+//	wave into the heading. The heading is then smoothed as a unit vector,
+//	so it turns through north rather than swinging round through south.
+//
+//	Parameters:
+//		ptFilter - the filter
+//		afAccel - accelerometer X, Y, Z in the boat frame
+//		afMag - magnetometer X, Y, Z in the boat frame
+//		u32SampleTime - micros() when the sample was taken
+//		ptAttitude - filled in with the result
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void HEADING_FilterUpdate( HEADING_FILTER *ptFilter, const float afAccel[3], const float afMag[3], U32 u32SampleTime, HEADING_ATTITUDE *ptAttitude )
+{
+	float fDt = (U32)( u32SampleTime - ptFilter->u32LastSample ) / 1e6f;
+	float fAlpha;
+	float fHeading;
+	int i;
+
+	fAlpha = ptFilter->bPrimed ? Smoothing( ptFilter->fGravityTau, fDt ) : 1;
+
+	for( i = 0; i < 3; i++ )
+	{
+		ptFilter->afGravity[i] += fAlpha * ( afAccel[i] - ptFilter->afGravity[i] );
+		ptFilter->afField[i] += fAlpha * ( afMag[i] - ptFilter->afField[i] );
+	}
+
+	HEADING_Compute( ptFilter->afGravity, ptFilter->afField, ptAttitude );
+
+	fHeading = radians( ptAttitude->fHeading );
+	fAlpha = ptFilter->bPrimed ? Smoothing( ptFilter->fHeadingTau, fDt ) : 1;
+
+	ptFilter->fNorth += fAlpha * ( cosf( fHeading ) - ptFilter->fNorth );
+	ptFilter->fEast += fAlpha * ( sinf( fHeading ) - ptFilter->fEast );
+
+	fHeading = degrees( atan2f( ptFilter->fEast, ptFilter->fNorth ) );
+	ptAttitude->fHeading = ( fHeading < 0 ) ? fHeading + 360 : fHeading;
+
+	ptFilter->u32LastSample = u32SampleTime;
+	ptFilter->bPrimed = true;
+}
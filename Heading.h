@@ -0,0 +1,58 @@
+// Heading.h
+// Tilt compensated heading from raw accelerometer and magnetometer vectors
+//
+// Vectors are in the boat frame: X forward, Y starboard, Z down. The
+// accelerometer gives specific force, as accelerometers report it: about
+// +1g straight up when still. The magnetometer can be in any units; only
+// its direction is used.
+//
+// HEADING_Compute() solves one sample. A HEADING_FILTER smooths a live
+// stream: gravity and the field together over one time constant, so the
+// two vectors stay consistent while the boat rolls, then the heading over
+// its own. HEADING_ComputeBatch() solves arrays of logged samples four at a
+// time with the same arithmetic as HEADING_Compute().
+
+#ifndef HEADING_H
+#define HEADING_H
+
+#include "includes.h"	// for typedef's, etc.
+
+//-------------------------------------------
+// Global typedefs
+
+typedef struct
+{
+	float fHeading;		// degrees, 0 to 360, magnetic
+	float fPitch;		// degrees, + bow up
+	float fRoll;		// degrees, + starboard down
+} HEADING_ATTITUDE;
+
+typedef struct
+{
+	float fGravityTau;		// seconds, 0 for none; gravity and field
+	float fHeadingTau;		// seconds, 0 for none
+	float afGravity[3];		// smoothed accelerometer
+	float afField[3];		// smoothed magnetometer
+	float fNorth;			// smoothed heading, as a unit vector
+	float fEast;
+	U32 u32LastSample;		// micros()
+	bool bPrimed;			// false until the first sample
+} HEADING_FILTER;
+
+// Logged samples, one array per axis, for HEADING_ComputeBatch()
+typedef struct
+{
+	const float *pfAx, *pfAy, *pfAz;
+	const float *pfMx, *pfMy, *pfMz;
+} HEADING_SAMPLES;
+
+//-------------------------------------------
+// Function prototypes
+
+void	HEADING_Compute( const float afAccel[3], const float afMag[3], HEADING_ATTITUDE *ptAttitude );
+void	HEADING_ComputeBatch( const HEADING_SAMPLES *ptSamples, int count, float *pfHeading, float *pfPitch, float *pfRoll );
+
+void	HEADING_FilterInit( HEADING_FILTER *ptFilter, float fGravityTau, float fHeadingTau );
+void	HEADING_FilterUpdate( HEADING_FILTER *ptFilter, const float afAccel[3], const float afMag[3], U32 u32SampleTime, HEADING_ATTITUDE *ptAttitude );
+
+#endif
@@ -0,0 +1,733 @@
+// MagCal.cpp
+// Hard and soft iron magnetometer calibration
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include "MagCal.h"
+
+//-------------------------------------------
+// Local defines
+
+#define MAGCAL_FILE_HEADER		"magcal 1"
+#define JACOBI_SWEEPS			32
+
+// Indices of the terms in the scatter matrix, and of their coefficients
+// in the conic: a'terms = 0
+enum { T_XX, T_YY, T_ZZ, T_XY, T_XZ, T_YZ, T_X, T_Y, T_Z, T_1 };
+
+// The ellipsoid, trace(A) = 1: the fixed part of its coefficients, then
+// one row per free parameter
+static const double gadFullFixed[MAGCAL_TERMS] = { 1.0 / 3, 1.0 / 3, 1.0 / 3 };
+static const double gadFullBasis[][MAGCAL_TERMS] =
+{
+	{ 1, 0, -1 },
+	{ 0, 1, -1 },
+	{ 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+};
+
+// The horizontal ellipse, A's X/Y block with trace 1. Z is about constant,
+// so its terms fold into the X, Y and constant ones.
+static const double gadPlanarFixed[MAGCAL_TERMS] = { 0.5, 0.5 };
+static const double gadPlanarBasis[][MAGCAL_TERMS] =
+{
+	{ 0.5, -0.5 },
+	{ 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 0, 1 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+};
+
+#define COUNT_OF(a)		( sizeof(a) / sizeof((a)[0]) )
+
+//-----------------------------------------------------------------------------
+// Solves the n x n symmetric positive definite system M x = r in place by
+// Cholesky decomposition. M is only read on and above the diagonal.
+static bool Cholesky( double adM[MAGCAL_TERMS][MAGCAL_TERMS], double adR[MAGCAL_TERMS], int n )
+{
+	double adL[MAGCAL_TERMS][MAGCAL_TERMS];
+	int i, j, k;
+
+	for( i = 0; i < n; i++ )
+	{
+		for( j = 0; j <= i; j++ )
+		{
+			double d = adM[j][i];
+
+			for( k = 0; k < j; k++ )
+			{
+				d -= adL[i][k] * adL[j][k];
+			}
+
+			if( i == j )
+			{
+				if( d <= 0 )
+				{
+					return false;
+				}
+
+				adL[i][i] = sqrt( d );
+			}
+			else
+			{
+				adL[i][j] = d / adL[j][j];
+			}
+		}
+	}
+
+	// L y = r, then L' x = y
+	for( i = 0; i < n; i++ )
+	{
+		for( k = 0; k < i; k++ )
+		{
+			adR[i] -= adL[i][k] * adR[k];
+		}
+
+		adR[i] /= adL[i][i];
+	}
+
+	for( i = n - 1; i >= 0; i-- )
+	{
+		for( k = i + 1; k < n; k++ )
+		{
+			adR[i] -= adL[k][i] * adR[k];
+		}
+
+		adR[i] /= adL[i][i];
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Eigenvalues and vectors (as columns of V) of the n x n symmetric matrix A,
+// n <= 3, by Jacobi rotations. A is destroyed.
+static void Jacobi( double adA[3][3], int n, double adEig[3], double adV[3][3] )
+{
+	int sweep, p, q, k;
+
+	for( p = 0; p < 3; p++ )
+	{
+		for( q = 0; q < 3; q++ )
+		{
+			adV[p][q] = ( p == q ) ? 1 : 0;
+		}
+	}
+
+	for( sweep = 0; sweep < JACOBI_SWEEPS; sweep++ )
+	{
+		double dOff = 0;
+
+		for( p = 0; p < n; p++ )
+		{
+			for( q = p + 1; q < n; q++ )
+			{
+				dOff += adA[p][q] * adA[p][q];
+			}
+		}
+
+		if( dOff < 1e-30 )
+		{
+			break;
+		}
+
+		for( p = 0; p < n; p++ )
+		{
+			for( q = p + 1; q < n; q++ )
+			{
+				double theta, t, c, s;
+
+				if( adA[p][q] == 0 )
+				{
+					continue;
+				}
+
+				theta = ( adA[q][q] - adA[p][p] ) / ( 2 * adA[p][q] );
+				t = ( theta >= 0 ? 1 : -1 ) / ( fabs( theta ) + sqrt( theta * theta + 1 ) );
+				c = 1 / sqrt( t * t + 1 );
+				s = t * c;
+
+				for( k = 0; k < n; k++ )
+				{
+					double akp = adA[k][p], akq = adA[k][q];
+
+					adA[k][p] = c * akp - s * akq;
+					adA[k][q] = s * akp + c * akq;
+				}
+
+				for( k = 0; k < n; k++ )
+				{
+					double apk = adA[p][k], aqk = adA[q][k];
+
+					adA[p][k] = c * apk - s * aqk;
+					adA[q][k] = s * apk + c * aqk;
+				}
+
+				for( k = 0; k < n; k++ )
+				{
+					double vkp = adV[k][p], vkq = adV[k][q];
+
+					adV[k][p] = c * vkp - s * vkq;
+					adV[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+
+	for( p = 0; p < n; p++ )
+	{
+		adEig[p] = adA[p][p];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Fits the conic with coefficients fixed + basis'p to the samples, and turns
+// it into a center and a symmetric matrix W with det(W) = 1 that maps it
+// onto a sphere. n is 2 or 3 (axes).
+static bool FitConic( const MAGCAL *ptCal, const double adFixed[MAGCAL_TERMS], const double adBasis[][MAGCAL_TERMS], int nParams, int n, double adCenter[3], double adW[3][3] )
+{
+	double adS[MAGCAL_TERMS][MAGCAL_TERMS];
+	double adSB[MAGCAL_TERMS][MAGCAL_TERMS];	// S basis'
+	double adM[MAGCAL_TERMS][MAGCAL_TERMS];
+	double adP[MAGCAL_TERMS];
+	double adCoef[MAGCAL_TERMS];
+	double adA[3][3], adB[3], adQ[3][3], adV[3][3], adEig[3];
+	double dK, dDet, dNorm;
+	int i, j, k;
+
+	for( i = 0; i < MAGCAL_TERMS; i++ )
+	{
+		for( j = 0; j < MAGCAL_TERMS; j++ )
+		{
+			adS[i][j] = ( i <= j ) ? ptCal->adScatter[i][j] : ptCal->adScatter[j][i];
+		}
+	}
+
+	// Least squares on a'terms with a = fixed + basis'p:
+	// (basis S basis') p = -basis S fixed
+	for( i = 0; i < MAGCAL_TERMS; i++ )
+	{
+		for( j = 0; j < nParams; j++ )
+		{
+			adSB[i][j] = 0;
+
+			for( k = 0; k < MAGCAL_TERMS; k++ )
+			{
+				adSB[i][j] += adS[i][k] * adBasis[j][k];
+			}
+		}
+	}
+
+	for( i = 0; i < nParams; i++ )
+	{
+		for( j = i; j < nParams; j++ )
+		{
+			adM[i][j] = 0;
+
+			for( k = 0; k < MAGCAL_TERMS; k++ )
+			{
+				adM[i][j] += adBasis[i][k] * adSB[k][j];
+			}
+		}
+
+		adP[i] = 0;
+
+		for( k = 0; k < MAGCAL_TERMS; k++ )
+		{
+			for( j = 0; j < MAGCAL_TERMS; j++ )
+			{
+				adP[i] -= adBasis[i][k] * adS[k][j] * adFixed[j];
+			}
+		}
+	}
+
+	if( !Cholesky( adM, adP, nParams ) )
+	{
+		return false;
+	}
+
+	for( k = 0; k < MAGCAL_TERMS; k++ )
+	{
+		adCoef[k] = adFixed[k];
+
+		for( i = 0; i < nParams; i++ )
+		{
+			adCoef[k] += adBasis[i][k] * adP[i];
+		}
+	}
+
+	adA[0][0] = adCoef[T_XX];
+	adA[1][1] = adCoef[T_YY];
+	adA[2][2] = adCoef[T_ZZ];
+	adA[0][1] = adA[1][0] = adCoef[T_XY] / 2;
+	adA[0][2] = adA[2][0] = adCoef[T_XZ] / 2;
+	adA[1][2] = adA[2][1] = adCoef[T_YZ] / 2;
+	adB[0] = adCoef[T_X] / 2;
+	adB[1] = adCoef[T_Y] / 2;
+	adB[2] = adCoef[T_Z] / 2;
+
+	// Center c = -A^-1 b, from A's eigen decomposition, which is needed
+	// below anyway
+	memcpy( adQ, adA, sizeof(adQ) );
+	Jacobi( adQ, n, adEig, adV );
+
+	for( i = 0; i < n; i++ )
+	{
+		if( adEig[i] == 0 )
+		{
+			return false;
+		}
+	}
+
+	for( i = 0; i < n; i++ )
+	{
+		adCenter[i] = 0;
+
+		for( j = 0; j < n; j++ )
+		{
+			for( k = 0; k < n; k++ )
+			{
+				adCenter[i] -= adV[i][k] * adV[j][k] / adEig[k] * adB[j];
+			}
+		}
+	}
+
+	// (x - c)'A(x - c) = c'Ac - d = k, so Q = A / k and |sqrt(Q)(x - c)| = 1.
+	// Q must be positive definite for an ellipsoid.
+	dK = -adCoef[T_1];
+
+	for( i = 0; i < n; i++ )
+	{
+		for( j = 0; j < n; j++ )
+		{
+			dK += adCenter[i] * adA[i][j] * adCenter[j];
+		}
+	}
+
+	for( i = 0, dDet = 1; i < n; i++ )
+	{
+		adEig[i] /= dK;
+
+		if( adEig[i] <= 0 )
+		{
+			return false;
+		}
+
+		dDet *= adEig[i];
+	}
+
+	// sqrt(Q), scaled to det 1 so the field strength is kept
+	dNorm = pow( dDet, -0.5 / n );
+	memset( adW, 0, 9 * sizeof(double) );
+
+	for( i = 0; i < n; i++ )
+	{
+		for( j = 0; j < n; j++ )
+		{
+			for( k = 0; k < n; k++ )
+			{
+				adW[i][j] += adV[i][k] * sqrt( adEig[k] ) * adV[j][k] * dNorm;
+			}
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Ratio of the least to the most spread of the kept samples, as standard
+// deviations along the principal axes
+static double SpreadRatio( const MAGCAL *ptCal )
+{
+	double adMean[3] = { 0, 0, 0 };
+	double adC[3][3], adV[3][3], adEig[3];
+	double dMin, dMax;
+	int i, j, k;
+
+	for( k = 0; k < ptCal->nSamples; k++ )
+	{
+		for( i = 0; i < 3; i++ )
+		{
+			adMean[i] += ptCal->afSamples[k][i];
+		}
+	}
+
+	for( i = 0; i < 3; i++ )
+	{
+		adMean[i] /= ptCal->nSamples;
+	}
+
+	memset( adC, 0, sizeof(adC) );
+
+	for( k = 0; k < ptCal->nSamples; k++ )
+	{
+		for( i = 0; i < 3; i++ )
+		{
+			for( j = 0; j < 3; j++ )
+			{
+				adC[i][j] += ( ptCal->afSamples[k][i] - adMean[i] ) * ( ptCal->afSamples[k][j] - adMean[j] );
+			}
+		}
+	}
+
+	Jacobi( adC, 3, adEig, adV );
+
+	dMin = min( adEig[0], min( adEig[1], adEig[2] ) );
+	dMax = max( adEig[0], max( adEig[1], adEig[2] ) );
+
+	return ( dMax > 0 && dMin > 0 ) ? sqrt( dMin / dMax ) : 0;
+}
+
+//*****************************************************************************
+//
+//	MAGCAL_Init
+//
+//	Starts a new calibration
+//
+//	Parameters:
+//		ptCal - the calibration. It's about 25K, so best not on a thread's stack.
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void MAGCAL_Init( MAGCAL *ptCal )
+{
+	memset( ptCal, 0, sizeof(*ptCal) );
+}
+
+//*****************************************************************************
+//
+//	MAGCAL_AddSample
+//
+//	Adds a raw magnetometer sample to the fit. Samples closer than
+//	MAGCAL_MIN_SEPARATION to the last one taken are skipped, so the boat
+//	sitting still, or turning slowly through part of the lap, doesn't
+//	outweigh the rest of it.
+//
+//	Parameters:
+//		ptCal - the calibration
+//		afMag - magnetometer X, Y, Z in the boat frame, raw counts
+//
+//	Returns:
+//		true if the sample was taken
+//
+//*****************************************************************************
+bool MAGCAL_AddSample( MAGCAL *ptCal, const float afMag[3] )
+{
+	double adTerm[MAGCAL_TERMS];
+	double x, y, z;
+	int i, j;
+
+	if( ptCal->u32Count == 0 )
+	{
+		double dNorm = sqrt( sq( (double)afMag[0] ) + sq( (double)afMag[1] ) + sq( (double)afMag[2] ) );
+
+		if( dNorm == 0 )
+		{
+			return false;
+		}
+
+		ptCal->dScale = 1 / dNorm;
+	}
+	else
+	{
+		const float *pfLast = ptCal->afSamples[ptCal->nSamples - 1];
+		double dDist = sqrt( sq( (double)afMag[0] - pfLast[0] ) + sq( (double)afMag[1] - pfLast[1] ) + sq( (double)afMag[2] - pfLast[2] ) );
+
+		if( dDist * ptCal->dScale < MAGCAL_MIN_SEPARATION )
+		{
+			return false;
+		}
+	}
+
+	x = afMag[0] * ptCal->dScale;
+	y = afMag[1] * ptCal->dScale;
+	z = afMag[2] * ptCal->dScale;
+
+	adTerm[T_XX] = x * x;
+	adTerm[T_YY] = y * y;
+	adTerm[T_ZZ] = z * z;
+	adTerm[T_XY] = x * y;
+	adTerm[T_XZ] = x * z;
+	adTerm[T_YZ] = y * z;
+	adTerm[T_X]  = x;
+	adTerm[T_Y]  = y;
+	adTerm[T_Z]  = z;
+	adTerm[T_1]  = 1;
+
+	for( i = 0; i < MAGCAL_TERMS; i++ )
+	{
+		for( j = i; j < MAGCAL_TERMS; j++ )
+		{
+			ptCal->adScatter[i][j] += adTerm[i] * adTerm[j];
+		}
+	}
+
+	ptCal->u32Count++;
+
+	// Once full, the last slot tracks the latest sample for the separation test
+	if( ptCal->nSamples < MAGCAL_MAX_SAMPLES )
+	{
+		ptCal->nSamples++;
+	}
+
+	memcpy( ptCal->afSamples[ptCal->nSamples - 1], afMag, sizeof(ptCal->afSamples[0]) );
+
+	return true;
+}
+
+//*****************************************************************************
+//
+//	MAGCAL_Fit
+//
+//	Solves for the calibration from the samples so far. Cheap enough to call
+//	after every few samples to watch it converge.
+//
+//	Parameters:
+//		ptCal - the calibration
+//		ptResult - filled in with the result. bValid is false if the samples
+//				   don't yet describe an ellipse; the quality figures are only
+//				   meaningful when it's true.
+//
+//	Returns:
+//		ptResult->bValid
+//
+//*****************************************************************************
+bool MAGCAL_Fit( const MAGCAL *ptCal, MAGCAL_RESULT *ptResult )
+{
+	int abBins[MAGCAL_COVERAGE_BINS];
+	double adCenter[3] = { 0, 0, 0 };
+	double adW[3][3];
+	double dSum, dSumSq, dMean;
+	int i, j, k, nBins;
+
+	MAGCAL_Identity( ptResult );
+	ptResult->u32Samples = ptCal->u32Count;
+
+	if( ptCal->u32Count < COUNT_OF(gadFullBasis) )
+	{
+		return false;
+	}
+
+	ptResult->bPlanar = ( SpreadRatio( ptCal ) < MAGCAL_MIN_TILT_RATIO );
+
+	if( ptResult->bPlanar )
+	{
+		if( !FitConic( ptCal, gadPlanarFixed, gadPlanarBasis, COUNT_OF(gadPlanarBasis), 2, adCenter, adW ) )
+		{
+			return false;
+		}
+
+		adW[2][2] = 1;
+	}
+	else if( !FitConic( ptCal, gadFullFixed, gadFullBasis, COUNT_OF(gadFullBasis), 3, adCenter, adW ) )
+	{
+		return false;
+	}
+
+	for( i = 0; i < 3; i++ )
+	{
+		ptResult->afOffset[i] = adCenter[i] / ptCal->dScale;
+
+		for( j = 0; j < 3; j++ )
+		{
+			ptResult->afSoftIron[i][j] = adW[i][j];
+		}
+	}
+
+	ptResult->bValid = true;
+
+	// Quality: how round the corrected samples are, and how much of the
+	// circle they cover
+	memset( abBins, 0, sizeof(abBins) );
+	dSum = dSumSq = 0;
+
+	for( k = 0; k < ptCal->nSamples; k++ )
+	{
+		float afOut[3];
+		double dR;
+		int bin;
+
+		MAGCAL_Apply( ptResult, ptCal->afSamples[k], afOut );
+
+		dR = sqrt( sq( (double)afOut[0] ) + sq( (double)afOut[1] ) + ( ptResult->bPlanar ? 0 : sq( (double)afOut[2] ) ) );
+		dSum += dR;
+		dSumSq += dR * dR;
+
+		bin = (int)( ( atan2( afOut[1], afOut[0] ) + M_PI ) / ( 2 * M_PI ) * MAGCAL_COVERAGE_BINS );
+		abBins[constrain( bin, 0, MAGCAL_COVERAGE_BINS - 1 )] = 1;
+	}
+
+	dMean = dSum / ptCal->nSamples;
+	ptResult->fResidual = ( dMean > 0 ) ? sqrt( max( dSumSq / ptCal->nSamples - dMean * dMean, 0.0 ) ) / dMean : 1;
+
+	for( i = 0, nBins = 0; i < MAGCAL_COVERAGE_BINS; i++ )
+	{
+		nBins += abBins[i];
+	}
+
+	ptResult->fCoverage = (float)nBins / MAGCAL_COVERAGE_BINS;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// No correction
+void MAGCAL_Identity( MAGCAL_RESULT *ptResult )
+{
+	memset( ptResult, 0, sizeof(*ptResult) );
+
+	for( int i = 0; i < 3; i++ )
+	{
+		ptResult->afSoftIron[i][i] = 1;
+	}
+}
+
+//*****************************************************************************
+//
+//	MAGCAL_Apply
+//
+//	Corrects a raw magnetometer sample
+//
+//	Parameters:
+//		ptResult - the calibration
+//		afMag - magnetometer X, Y, Z in the boat frame, raw counts
+//		afOut - the corrected sample. May be afMag.
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void MAGCAL_Apply( const MAGCAL_RESULT *ptResult, const float afMag[3], float afOut[3] )
+{
+	float afM[3];
+	int i;
+
+	for( i = 0; i < 3; i++ )
+	{
+		afM[i] = afMag[i] - ptResult->afOffset[i];
+	}
+
+	for( i = 0; i < 3; i++ )
+	{
+		afOut[i] = ptResult->afSoftIron[i][0] * afM[0] + ptResult->afSoftIron[i][1] * afM[1] + ptResult->afSoftIron[i][2] * afM[2];
+	}
+}
+
+//*****************************************************************************
+//
+//	MAGCAL_Save
+//
+//	Writes a calibration to a text file
+//
+//	Parameters:
+//		path - the file
+//		ptResult - the calibration
+//
+//	Returns:
+//		true on success
+//
+//*****************************************************************************
+bool MAGCAL_Save( const char *path, const MAGCAL_RESULT *ptResult )
+{
+	FILE *fp = fopen( path, "w" );
+	bool bStatus;
+
+	if( fp == NULL )
+	{
+		fprintf (stderr, "Mag cal: unable to write %s: %s\n", path, strerror (errno)) ;
+		return false;
+	}
+
+	fprintf( fp, MAGCAL_FILE_HEADER "\n" );
+	fprintf( fp, "offset %.9g %.9g %.9g\n", ptResult->afOffset[0], ptResult->afOffset[1], ptResult->afOffset[2] );
+
+	for( int i = 0; i < 3; i++ )
+	{
+		fprintf( fp, "softiron %.9g %.9g %.9g\n", ptResult->afSoftIron[i][0], ptResult->afSoftIron[i][1], ptResult->afSoftIron[i][2] );
+	}
+
+	fprintf( fp, "residual %.9g\n", ptResult->fResidual );
+	fprintf( fp, "coverage %.9g\n", ptResult->fCoverage );
+	fprintf( fp, "samples %lu\n", (unsigned long)ptResult->u32Samples );
+	fprintf( fp, "planar %d\n", ptResult->bPlanar ? 1 : 0 );
+
+	bStatus = !ferror( fp );
+
+	if( fclose( fp ) != 0 || !bStatus )
+	{
+		fprintf (stderr, "Mag cal: unable to write %s: %s\n", path, strerror (errno)) ;
+		return false;
+	}
+
+	return true;
+}
+
+//*****************************************************************************
+//
+//	MAGCAL_Load
+//
+//	Reads a calibration written by MAGCAL_Save()
+//
+//	Parameters:
+//		path - the file
+//		ptResult - filled in with the calibration, or no correction if the
+//				   file can't be read
+//
+//	Returns:
+//		true on success
+//
+//*****************************************************************************
+bool MAGCAL_Load( const char *path, MAGCAL_RESULT *ptResult )
+{
+	FILE *fp = fopen( path, "r" );
+	char szHeader[32];
+	unsigned long ulSamples;
+	int nPlanar;
+	bool bStatus;
+
+	MAGCAL_Identity( ptResult );
+
+	if( fp == NULL )
+	{
+		return false;
+	}
+
+	bStatus = fgets( szHeader, sizeof(szHeader), fp ) != NULL
+			  && strncmp( szHeader, MAGCAL_FILE_HEADER "\n", sizeof(szHeader) ) == 0
+			  && fscanf( fp, " offset %f %f %f", &ptResult->afOffset[0], &ptResult->afOffset[1], &ptResult->afOffset[2] ) == 3;
+
+	for( int i = 0; bStatus && i < 3; i++ )
+	{
+		bStatus = fscanf( fp, " softiron %f %f %f", &ptResult->afSoftIron[i][0], &ptResult->afSoftIron[i][1], &ptResult->afSoftIron[i][2] ) == 3;
+	}
+
+	bStatus = bStatus
+			  && fscanf( fp, " residual %f", &ptResult->fResidual ) == 1
+			  && fscanf( fp, " coverage %f", &ptResult->fCoverage ) == 1
+			  && fscanf( fp, " samples %lu", &ulSamples ) == 1
+			  && fscanf( fp, " planar %d", &nPlanar ) == 1;
+
+	fclose( fp );
+
+	if( !bStatus )
+	{
+		fprintf (stderr, "Mag cal: %s is not a calibration file\n", path) ;
+		MAGCAL_Identity( ptResult );
+		return false;
+	}
+
+	ptResult->u32Samples = ulSamples;
+	ptResult->bPlanar = ( nPlanar != 0 );
+	ptResult->bValid = true;
+
+	return true;
+}
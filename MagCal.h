@@ -0,0 +1,68 @@
+// MagCal.h
+// Hard and soft iron magnetometer calibration
+//
+// Samples taken while the boat turns a lap are fitted to an ellipsoid,
+// m'Am + 2b'm + d = 0 with trace(A) = 1, by least squares. Each sample only
+// adds its quadratic terms to a running sum, so a fit can be solved at any
+// point during the lap for the cost of one 9x9 solve. The ellipsoid's center
+// is the hard iron offset, and the matrix that maps it back onto a sphere
+// (scaled to keep the field's strength) is the soft iron correction.
+//
+// A lap in calm water has too little tilt to pin down the vertical axis.
+// Then only the horizontal ellipse is fitted, the vertical axis is left
+// alone, and the result is flagged planar.
+//
+// Samples are expected in the boat frame (X forward, Y starboard, Z down),
+// as for the Heading module.
+
+#ifndef MAG_CAL_H
+#define MAG_CAL_H
+
+#include "includes.h"	// for typedef's, etc.
+
+//-------------------------------------------
+// Global defines
+
+#define MAGCAL_TERMS				10		// x2 y2 z2 xy xz yz x y z 1
+#define MAGCAL_MAX_SAMPLES			2048	// kept for fit quality and coverage
+#define MAGCAL_COVERAGE_BINS		36		// 10 degree heading bins
+#define MAGCAL_MIN_SEPARATION		0.02	// of the field, between samples kept
+#define MAGCAL_MIN_TILT_RATIO		0.2		// least/most spread for a 3D fit
+
+//-------------------------------------------
+// Global typedefs
+
+typedef struct
+{
+	float afOffset[3];			// hard iron, subtracted first ...
+	float afSoftIron[3][3];		// ... then multiplied by this
+	float fResidual;			// RMS spread of the corrected field strength, fraction of it
+	float fCoverage;			// fraction of heading bins with a sample
+	U32 u32Samples;
+	bool bPlanar;				// horizontal only; Z is passed through
+	bool bValid;
+} MAGCAL_RESULT;
+
+typedef struct
+{
+	double adScatter[MAGCAL_TERMS][MAGCAL_TERMS];	// sum of the terms' products, upper triangle
+	double dScale;					// samples are scaled by this to keep the sums near 1
+	float afSamples[MAGCAL_MAX_SAMPLES][3];
+	int nSamples;					// kept in afSamples
+	U32 u32Count;					// in the sums
+} MAGCAL;
+
+//-------------------------------------------
+// Function prototypes
+
+void	MAGCAL_Init( MAGCAL *ptCal );
+bool	MAGCAL_AddSample( MAGCAL *ptCal, const float afMag[3] );
+bool	MAGCAL_Fit( const MAGCAL *ptCal, MAGCAL_RESULT *ptResult );
+
+void	MAGCAL_Identity( MAGCAL_RESULT *ptResult );
+void	MAGCAL_Apply( const MAGCAL_RESULT *ptResult, const float afMag[3], float afOut[3] );
+
+bool	MAGCAL_Save( const char *path, const MAGCAL_RESULT *ptResult );
+bool	MAGCAL_Load( const char *path, MAGCAL_RESULT *ptResult );
+
+#endif
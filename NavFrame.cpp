@@ -0,0 +1,139 @@
+// NavFrame.cpp
+// Local East-North-Up navigation frame for a single leg
+//
+// The frame is built once per leg, centered on the target waypoint. Each
+// position update is then two multiplies to get east/north meters, a sqrt
+// for distance, one atan2 for bearing and a dot product for cross-track
+// error. Legs (or positions) further out than NAV_FRAME_MAX_LEG_DISTANCE
+// use the great-circle functions instead, where the flat frame's error
+// would start to matter. USE_WGS84_GEODESY selects the ellipsoid for both
+// the long-leg solution and the frame's scale factors.
+
+#include <math.h>
+#include "NavFrame.h"
+#include "config.h"
+#include "TinyGPS++.h"
+
+//-------------------------------------------
+// Local functions
+
+static void GreatCircleUpdate( const NAV_FRAME *ptFrame, double lat, double lon, NAV_FRAME_FIX *ptFix );
+
+//-----------------------------------------------------------------------------
+// Distance (meters) and initial course (degrees) between two positions
+static double Inverse( double lat1, double lon1, double lat2, double lon2, double *pdCourse )
+{
+#if USE_WGS84_GEODESY
+	return TinyGPSPlus::distanceBetweenWGS84( lat1, lon1, lat2, lon2, pdCourse );
+#else
+	*pdCourse = TinyGPSPlus::courseTo( lat1, lon1, lat2, lon2 );
+	return TinyGPSPlus::distanceBetween( lat1, lon1, lat2, lon2 );
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Longitude difference folded into -180 .. +180
+static double WrapLonDelta( double delta )
+{
+	if( delta > 180.0 )
+	{
+		delta -= 360.0;
+	}
+	else if( delta < -180.0 )
+	{
+		delta += 360.0;
+	}
+
+	return delta;
+}
+
+//-----------------------------------------------------------------------------
+void NAVFRAME_Init( NAV_FRAME *ptFrame, double start_lat, double start_lon, double target_lat, double target_lon )
+{
+	double leg_length;
+
+	ptFrame->dTargetLat = target_lat;
+	ptFrame->dTargetLon = target_lon;
+	ptFrame->dStartLat = start_lat;
+	ptFrame->dStartLon = start_lon;
+	Inverse( start_lat, start_lon, target_lat, target_lon, &ptFrame->dLegCourse );
+
+#if USE_WGS84_GEODESY
+	// Meridional and prime vertical radii of curvature at the target
+	double w = 1.0 - _GPS_WGS84_E2 * sq( sin( radians( target_lat ) ) );
+	ptFrame->dMetersPerDegLat = radians( _GPS_WGS84_A * ( 1.0 - _GPS_WGS84_E2 ) / ( w * sqrt( w ) ) );
+	ptFrame->dMetersPerDegLon = radians( _GPS_WGS84_A / sqrt( w ) ) * cos( radians( target_lat ) );
+#else
+	ptFrame->dMetersPerDegLat = radians( _GPS_EARTH_RADIUS_M );
+	ptFrame->dMetersPerDegLon = radians( _GPS_EARTH_RADIUS_M ) * cos( radians( target_lat ) );
+#endif
+
+	ptFrame->dStartEast = WrapLonDelta( start_lon - target_lon ) * ptFrame->dMetersPerDegLon;
+	ptFrame->dStartNorth = ( start_lat - target_lat ) * ptFrame->dMetersPerDegLat;
+
+	leg_length = sqrt( sq( ptFrame->dStartEast ) + sq( ptFrame->dStartNorth ) );
+
+	if( leg_length > 0.0 )
+	{
+		ptFrame->dLegEast = -ptFrame->dStartEast / leg_length;
+		ptFrame->dLegNorth = -ptFrame->dStartNorth / leg_length;
+	}
+	else
+	{
+		ptFrame->dLegEast = 0.0;
+		ptFrame->dLegNorth = 1.0;
+	}
+
+	ptFrame->bLocal = ( leg_length <= NAV_FRAME_MAX_LEG_DISTANCE );
+}
+
+//-----------------------------------------------------------------------------
+void NAVFRAME_Update( const NAV_FRAME *ptFrame, double lat, double lon, NAV_FRAME_FIX *ptFix )
+{
+	double east, north, distance, bearing;
+
+	if( !ptFrame->bLocal )
+	{
+		GreatCircleUpdate( ptFrame, lat, lon, ptFix );
+		return;
+	}
+
+	east = WrapLonDelta( lon - ptFrame->dTargetLon ) * ptFrame->dMetersPerDegLon;
+	north = ( lat - ptFrame->dTargetLat ) * ptFrame->dMetersPerDegLat;
+	distance = sqrt( sq( east ) + sq( north ) );
+
+	// Wandered off the flat part of the frame
+	if( distance > NAV_FRAME_MAX_LEG_DISTANCE )
+	{
+		GreatCircleUpdate( ptFrame, lat, lon, ptFix );
+		return;
+	}
+
+	// Bearing of the vector from us to the target (the origin)
+	bearing = degrees( atan2( -east, -north ) );
+	if( bearing < 0.0 )
+	{
+		bearing += 360.0;
+	}
+
+	ptFix->fDistance = distance;
+	ptFix->fBearing = bearing;
+	ptFix->fCrossTrack = ( east - ptFrame->dStartEast ) * ptFrame->dLegNorth
+					   - ( north - ptFrame->dStartNorth ) * ptFrame->dLegEast;
+}
+
+//-----------------------------------------------------------------------------
+// Full spherical solution for long legs
+static void GreatCircleUpdate( const NAV_FRAME *ptFrame, double lat, double lon, NAV_FRAME_FIX *ptFix )
+{
+	double bearing, from_start, course_from_start;
+
+	ptFix->fDistance = Inverse( lat, lon, ptFrame->dTargetLat, ptFrame->dTargetLon, &bearing );
+	ptFix->fBearing = bearing;
+
+	// Cross-track distance from the great circle through start and target
+	from_start = Inverse( ptFrame->dStartLat, ptFrame->dStartLon, lat, lon, &course_from_start );
+
+	ptFix->fCrossTrack = asin( sin( from_start / _GPS_EARTH_RADIUS_M )
+							 * sin( radians( course_from_start - ptFrame->dLegCourse ) ) ) * _GPS_EARTH_RADIUS_M;
+}
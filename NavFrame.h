@@ -0,0 +1,41 @@
+// NavFrame.h
+// Local East-North-Up navigation frame for a single leg
+
+#ifndef NAV_FRAME_H
+#define NAV_FRAME_H
+
+#include "includes.h"	// for typedef's, etc.
+
+//-------------------------------------------
+// Global defines
+
+typedef struct
+{
+	bool	bLocal;				// leg is short enough for the flat frame
+	double	dTargetLat;			// frame origin
+	double	dTargetLon;
+	double	dStartLat;			// leg start, used by the great-circle path
+	double	dStartLon;
+	double	dLegCourse;			// great-circle course of the leg (degrees)
+	double	dMetersPerDegLat;	// local scale factors at the target
+	double	dMetersPerDegLon;
+	double	dStartEast;			// leg start relative to the target (meters)
+	double	dStartNorth;
+	double	dLegEast;			// unit vector from start to target
+	double	dLegNorth;
+} NAV_FRAME;
+
+typedef struct
+{
+	float	fDistance;			// meters to the target
+	float	fBearing;			// degrees, 0 = North
+	float	fCrossTrack;		// meters off the leg, positive = right of track
+} NAV_FRAME_FIX;
+
+//-------------------------------------------
+// Function prototypes
+
+void	NAVFRAME_Init( NAV_FRAME *ptFrame, double start_lat, double start_lon, double target_lat, double target_lon );
+void	NAVFRAME_Update( const NAV_FRAME *ptFrame, double lat, double lon, NAV_FRAME_FIX *ptFix );
+
+#endif
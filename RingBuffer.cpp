@@ -0,0 +1,101 @@
+// RingBuffer.cpp
+// Byte ring buffer filled by bulk read() and drained in contiguous spans
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "RingBuffer.h"
+
+//-----------------------------------------------------------------------------
+// u32Size is rounded up to a power of two
+bool RING_Init( RING_BUFFER *ptRing, U32 u32Size )
+{
+	U32 u32Pow2 = 1;
+
+	while( u32Pow2 < u32Size )
+	{
+		u32Pow2 <<= 1;
+	}
+
+	ptRing->pu8Data = (U8 *)malloc( u32Pow2 );
+	ptRing->u32Size = ( ptRing->pu8Data != NULL ) ? u32Pow2 : 0;
+	ptRing->u32Head = 0;
+	ptRing->u32Tail = 0;
+
+	return ( ptRing->pu8Data != NULL );
+}
+
+//-----------------------------------------------------------------------------
+void RING_Release( RING_BUFFER *ptRing )
+{
+	free( ptRing->pu8Data );
+	ptRing->pu8Data = NULL;
+	ptRing->u32Size = 0;
+}
+
+//-----------------------------------------------------------------------------
+U32 RING_Used( const RING_BUFFER *ptRing )
+{
+	return ptRing->u32Head - ptRing->u32Tail;
+}
+
+//-----------------------------------------------------------------------------
+U32 RING_Space( const RING_BUFFER *ptRing )
+{
+	return ptRing->u32Size - RING_Used( ptRing );
+}
+
+//-----------------------------------------------------------------------------
+// One read() into the contiguous free space after the head.
+// Returns bytes read, 0 if the ring is full or the fd has nothing right now
+// (EAGAIN), RING_END_OF_FILE once the other end has closed, or -1 on error.
+int RING_ReadFromFd( RING_BUFFER *ptRing, int fd )
+{
+	U32 u32Offset = ptRing->u32Head & ( ptRing->u32Size - 1 );
+	U32 u32Contiguous = ptRing->u32Size - u32Offset;
+	U32 u32Space = RING_Space( ptRing );
+	int len;
+
+	if( u32Space == 0 )
+	{
+		return 0;
+	}
+
+	len = read( fd, ptRing->pu8Data + u32Offset, min( u32Contiguous, u32Space ) );
+
+	if( len > 0 )
+	{
+		ptRing->u32Head += len;
+		return len;
+	}
+
+	if( len == 0 )
+	{
+		return RING_END_OF_FILE;
+	}
+
+	if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+	{
+		return 0;
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Points at the oldest unconsumed bytes and returns how many are contiguous
+U32 RING_Peek( const RING_BUFFER *ptRing, const U8 **ppu8Data )
+{
+	U32 u32Offset = ptRing->u32Tail & ( ptRing->u32Size - 1 );
+	U32 u32Contiguous = ptRing->u32Size - u32Offset;
+
+	*ppu8Data = ptRing->pu8Data + u32Offset;
+
+	return min( u32Contiguous, RING_Used( ptRing ) );
+}
+
+//-----------------------------------------------------------------------------
+void RING_Consume( RING_BUFFER *ptRing, U32 u32Bytes )
+{
+	ptRing->u32Tail += min( u32Bytes, RING_Used( ptRing ) );
+}
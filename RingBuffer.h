@@ -0,0 +1,37 @@
+// RingBuffer.h
+// Byte ring buffer filled by bulk read() and drained in contiguous spans
+//
+// Head and tail are free-running counters and the size is a power of two,
+// so used = head - tail with no wrap special cases. Not thread safe: the
+// producer and consumer are expected to be the same thread.
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include "includes.h"	// for typedef's, etc.
+
+//-------------------------------------------
+// Global defines
+
+#define RING_END_OF_FILE		-2		// RING_ReadFromFd(): read() returned 0
+
+typedef struct
+{
+	U8	*pu8Data;
+	U32	u32Size;		// power of two
+	U32	u32Head;		// total bytes written
+	U32	u32Tail;		// total bytes consumed
+} RING_BUFFER;
+
+//-------------------------------------------
+// Function prototypes
+
+bool	RING_Init( RING_BUFFER *ptRing, U32 u32Size );
+void	RING_Release( RING_BUFFER *ptRing );
+U32		RING_Used( const RING_BUFFER *ptRing );
+U32		RING_Space( const RING_BUFFER *ptRing );
+int		RING_ReadFromFd( RING_BUFFER *ptRing, int fd );
+U32		RING_Peek( const RING_BUFFER *ptRing, const U8 **ppu8Data );
+void	RING_Consume( RING_BUFFER *ptRing, U32 u32Bytes );
+
+#endif
@@ -0,0 +1,71 @@
+// SeqLock.h
+// Lock-free single-writer / multi-reader "latest value" slot
+//
+// The writer bumps the sequence to odd, copies the value in and bumps it
+// back to even. A reader copies the value out and retries if the sequence
+// was odd or changed underneath it, so the writer never waits on readers
+// and a reader never sees half of one update and half of another.
+//
+// Only one thread may Publish() to a given slot.
+
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <string.h>
+#include <sched.h>
+
+#include "includes.h"	// for typedef's, etc.
+
+//------------------------------------------------------------------------------
+template <typename T>
+class SeqLock
+{
+	public:
+		SeqLock() : u32Sequence(0) { memset( &tValue, 0, sizeof(tValue) ); }
+
+		//----------------------------------------------------------------------
+		void Publish( const T &value )
+		{
+			u32Sequence++;
+			__sync_synchronize();
+			memcpy( (void *)&tValue, &value, sizeof(T) );
+			__sync_synchronize();
+			u32Sequence++;
+		}
+
+		//----------------------------------------------------------------------
+		// Copies out the latest value. Returns how many values have been
+		// published so far, i.e. 0 if there's nothing there yet.
+		U32 Read( T &value ) const
+		{
+			U32 u32Before, u32After;
+
+			while( true )
+			{
+				u32Before = u32Sequence;
+				__sync_synchronize();
+
+				if( u32Before & 1 )
+				{
+					// Writer is mid-update
+					sched_yield();
+					continue;
+				}
+
+				memcpy( &value, (const void *)&tValue, sizeof(T) );
+				__sync_synchronize();
+				u32After = u32Sequence;
+
+				if( u32Before == u32After )
+				{
+					return u32Before / 2;
+				}
+			}
+		}
+
+	private:
+		volatile U32 u32Sequence;
+		T tValue;
+};
+
+#endif
@@ -29,8 +29,19 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "TinyGPS++.h"
 
-#define _GPRMCterm   "GPRMC"
-#define _GPGGAterm   "GPGGA"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define _GPS_SCAN_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define _GPS_SCAN_NEON
+#endif
+
+// Hash of an NMEA sentence formatter (the three letters after the talker)
+// on its last two characters.  It is perfect over the formatters listed in
+// sentenceTypeOf(); a collision there would be a duplicate case label and
+// fail to compile.
+#define _GPS_FORMATTER_HASH(b, c)   ((((uint8_t)(b) * 6) + (uint8_t)(c)) & 15)
 
 TinyGPSPlus::TinyGPSPlus()
   :  parity(0)
@@ -39,14 +50,18 @@ TinyGPSPlus::TinyGPSPlus()
   ,  curTermNumber(0)
   ,  curTermOffset(0)
   ,  sentenceHasFix(false)
-  ,  customElts(0)
+  ,  sentenceArrival(0)
+  ,  ubxState(UBX_IDLE)
   ,  customCandidates(0)
+  ,  customOverflow(0)
+  ,  overflowCandidates(0)
   ,  encodedCharCount(0)
   ,  sentencesWithFixCount(0)
   ,  failedChecksumCount(0)
   ,  passedChecksumCount(0)
 {
   term[0] = '\0';
+  memset(customSentences, 0, sizeof(customSentences));
 }
 
 //
@@ -57,6 +72,14 @@ bool TinyGPSPlus::encode(char c)
 {
   ++encodedCharCount;
 
+  if (ubxState != UBX_IDLE)
+  {
+    int frames = 0;
+    if (ubxEncode(&c, 1, &frames))
+      return frames != 0;
+    // otherwise c didn't belong to a frame after all
+  }
+
   switch(c)
   {
   case ',': // term terminators
@@ -64,26 +87,16 @@ bool TinyGPSPlus::encode(char c)
   case '\r':
   case '\n':
   case '*':
-    {
-      bool isValidSentence = false;
-      if (curTermOffset < sizeof(term))
-      {
-        term[curTermOffset] = 0;
-        isValidSentence = endOfTermHandler();
-      }
-      ++curTermNumber;
-      curTermOffset = 0;
-      isChecksumTerm = c == '*';
-      return isValidSentence;
-    }
-    break;
+    return endOfTerm(c);
 
   case '$': // sentence begin
-    curTermNumber = curTermOffset = 0;
-    parity = 0;
-    curSentenceType = GPS_SENTENCE_OTHER;
-    isChecksumTerm = false;
-    sentenceHasFix = false;
+    sentenceArrival = micros();
+    beginSentence();
+    return false;
+
+  case (char)_GPS_UBX_SYNC1: // possible UBX frame
+    ubxArrival = micros();
+    ubxState = UBX_SYNC2;
     return false;
 
   default: // ordinary characters
@@ -97,9 +110,468 @@ bool TinyGPSPlus::encode(char c)
   return false;
 }
 
+//
+// delimiter scanning
+//
+// encode(buf, len) walks the buffer in blocks, building one bitmask per
+// block with a bit set at each of the six delimiters.  Every term in the
+// block is then found with a count-trailing-zeros instead of a fresh scan,
+// so the vector compare is paid once per block rather than once per ~10
+// byte term.  The SSE2 and NEON versions are picked at compile time; both
+// are baseline on the targets that define them.
+//
+#if defined(_GPS_SCAN_X86)
+#define _GPS_SCAN_NAME "sse2"
+#define _GPS_SCAN_BLOCK 64
+#define _GPS_SCAN_BITS 1
+
+static inline uint64_t delimiterMask16(const char *p)
+{
+  const __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i m = _mm_or_si128(
+    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8('*'))),
+                 _mm_cmpeq_epi8(v, _mm_set1_epi8((char)_GPS_UBX_SYNC1))),
+    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                 _mm_cmpeq_epi8(v, _mm_set1_epi8('$'))));
+  return (uint16_t)_mm_movemask_epi8(m);
+}
+
+static inline uint64_t delimiterMaskBlock(const char *p)
+{
+  return delimiterMask16(p) | delimiterMask16(p + 16) << 16 |
+         delimiterMask16(p + 32) << 32 | delimiterMask16(p + 48) << 48;
+}
+#elif defined(_GPS_SCAN_NEON)
+#define _GPS_SCAN_NAME "neon"
+#define _GPS_SCAN_BLOCK 16
+#define _GPS_SCAN_BITS 4
+
+// NEON has no movemask; narrowing each 0x00/0xFF byte to a nibble gives
+// the same information with 4 bits per byte
+static inline uint64_t delimiterMaskBlock(const char *p)
+{
+  const uint8x16_t v = vld1q_u8((const uint8_t *)p);
+  uint8x16_t m = vorrq_u8(
+    vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(',')), vceqq_u8(v, vdupq_n_u8('*'))), vceqq_u8(v, vdupq_n_u8(_GPS_UBX_SYNC1))),
+    vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\n'))), vceqq_u8(v, vdupq_n_u8('$'))));
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+#else
+#define _GPS_SCAN_NAME "scalar"
+#define _GPS_SCAN_BLOCK 64
+#define _GPS_SCAN_BITS 1
+#endif
+
+// Mask for the n (at most _GPS_SCAN_BLOCK) bytes at p, one bit per byte
+// (four on NEON).  A short block at the end of the buffer is built a byte
+// at a time rather than reading past it.
+static inline uint64_t delimiterMask(const char *p, size_t n)
+{
+#if defined(_GPS_SCAN_X86) || defined(_GPS_SCAN_NEON)
+  if (n == _GPS_SCAN_BLOCK)
+    return delimiterMaskBlock(p);
+#endif
+  const uint64_t lane = _GPS_SCAN_BITS == 1 ? 1 : 0xF;
+  uint64_t mask = 0;
+  for (size_t i = 0; i < n; ++i)
+    if (TinyGPSPlus::isDelimiter(p[i]))
+      mask |= lane << (i * _GPS_SCAN_BITS);
+  return mask;
+}
+
+// XOR of the n bytes at p, eight at a time
+static inline uint8_t foldParity(const char *p, size_t n)
+{
+  uint64_t x = 0;
+  uint8_t tail = 0;
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, p + i, sizeof(w));
+    x ^= w;
+  }
+  for (; i < n; ++i)
+    tail ^= (uint8_t)p[i];
+
+  x ^= x >> 32;
+  x ^= x >> 16;
+  x ^= x >> 8;
+  return (uint8_t)x ^ tail;
+}
+
+const char *TinyGPSPlus::scanKernelName()
+{
+  return _GPS_SCAN_NAME;
+}
+
+// Process a whole buffer received from the GPS.  Runs of ordinary characters
+// between delimiters are located, copied and folded into the parity in one
+// pass instead of going through the per-character switch above.
+// Returns the number of sentences that passed their checksum.
+int TinyGPSPlus::encode(const char *buf, size_t len)
+{
+  return encode(buf, len, micros(), 0);
+}
+
+// As above, for a buffer whose last byte arrived at micros() 'arrival' over
+// a line taking microsPerChar per character.  Each sentence is stamped with
+// the time its '$' arrived, back-dated from the end of the buffer, rather
+// than with the time it happens to get parsed.
+int TinyGPSPlus::encode(const char *buf, size_t len, uint32_t arrival, uint32_t microsPerChar)
+{
+  const char *end = buf + len;
+  const char *block = end, *blockEnd = end;
+  uint64_t mask = 0;
+  int sentences = 0;
+
+  encodedCharCount += len;
+
+  while (buf < end)
+  {
+    if (ubxState != UBX_IDLE)
+    {
+      buf += ubxEncode(buf, end - buf, &sentences);
+      continue;
+    }
+
+    // Next delimiter from the block mask, starting a new block when this
+    // one has none left.  A UBX frame can move buf past the block.
+    const char *run = buf;
+    for (;;)
+    {
+      if (buf < block || buf >= blockEnd)
+      {
+        block = buf;
+        blockEnd = block + min((size_t)(end - block), (size_t)_GPS_SCAN_BLOCK);
+        mask = delimiterMask(block, blockEnd - block);
+      }
+      uint64_t left = mask >> ((buf - block) * _GPS_SCAN_BITS);
+      if (left != 0)
+      {
+        buf += __builtin_ctzll(left) / _GPS_SCAN_BITS;
+        break;
+      }
+      buf = blockEnd;
+      if (buf == end)
+        break;
+    }
+
+    if (buf > run)
+      appendTerm(run, buf - run, foldParity(run, buf - run));
+
+    if (buf == end)
+      break;
+
+    char c = *buf++;
+    if (c == '$')
+    {
+      sentenceArrival = arrival - (uint32_t)(end - buf) * microsPerChar;
+      beginSentence();
+    }
+    else if ((uint8_t)c == _GPS_UBX_SYNC1)
+    {
+      ubxArrival = arrival - (uint32_t)(end - buf) * microsPerChar;
+      ubxState = UBX_SYNC2;
+    }
+    else
+    {
+      if (c == ',')
+        parity ^= (uint8_t)c;
+      if (endOfTerm(c))
+        ++sentences;
+    }
+  }
+
+  return sentences;
+}
+
 //
 // internal utilities
 //
+void TinyGPSPlus::beginSentence()
+{
+  curTermNumber = curTermOffset = 0;
+  parity = 0;
+  curSentenceType = GPS_SENTENCE_OTHER;
+  isChecksumTerm = false;
+  sentenceHasFix = false;
+}
+
+// Identifies the sentence from its address field, e.g. GPRMC or GNGGA.
+// Any GNSS talker (GP, GN, GL, GA, GB) is accepted for the known formatters.
+// Of the proprietary sentences only the MTK command acknowledgement is parsed.
+uint8_t TinyGPSPlus::sentenceTypeOf(const char *term)
+{
+  if (term[0] == 'P')
+    return strcmp(term, "PMTK001") == 0 ? GPS_SENTENCE_PMTK_ACK : GPS_SENTENCE_OTHER;
+
+  if (term[0] != 'G')
+    return GPS_SENTENCE_OTHER;
+
+  switch (term[1])
+  {
+  case 'P': // GPS
+  case 'N': // combined GNSS
+  case 'L': // GLONASS
+  case 'A': // Galileo
+  case 'B': // BeiDou
+    break;
+  default:
+    return GPS_SENTENCE_OTHER;
+  }
+
+  const char *id;
+  uint8_t type;
+
+  switch (_GPS_FORMATTER_HASH(term[3], term[4]))
+  {
+  case _GPS_FORMATTER_HASH('M', 'C'): id = "RMC"; type = GPS_SENTENCE_RMC; break;
+  case _GPS_FORMATTER_HASH('G', 'A'): id = "GGA"; type = GPS_SENTENCE_GGA; break;
+  case _GPS_FORMATTER_HASH('T', 'G'): id = "VTG"; type = GPS_SENTENCE_VTG; break;
+  case _GPS_FORMATTER_HASH('S', 'A'): id = "GSA"; type = GPS_SENTENCE_GSA; break;
+  case _GPS_FORMATTER_HASH('S', 'V'): id = "GSV"; type = GPS_SENTENCE_GSV; break;
+  case _GPS_FORMATTER_HASH('L', 'L'): id = "GLL"; type = GPS_SENTENCE_GLL; break;
+  case _GPS_FORMATTER_HASH('D', 'A'): id = "ZDA"; type = GPS_SENTENCE_ZDA; break;
+  default:
+    return GPS_SENTENCE_OTHER;
+  }
+
+  if (term[2] != id[0] || term[3] != id[1] || term[4] != id[2] || term[5] != '\0')
+    return GPS_SENTENCE_OTHER;
+
+  return type;
+}
+
+// Terminates the current term on one of , * \r \n
+bool TinyGPSPlus::endOfTerm(char c)
+{
+  bool isValidSentence = false;
+  if (curTermOffset < sizeof(term))
+  {
+    term[curTermOffset] = 0;
+    isValidSentence = endOfTermHandler();
+  }
+  ++curTermNumber;
+  curTermOffset = 0;
+  isChecksumTerm = c == '*';
+  return isValidSentence;
+}
+
+// Appends a run of ordinary characters to the current term.  runParity is
+// the XOR of every character in the run; the term itself is truncated the
+// same way encode(char) truncates it.
+void TinyGPSPlus::appendTerm(const char *run, size_t len, uint8_t runParity)
+{
+  size_t room = sizeof(term) - 1 - curTermOffset;
+  if (len > room)
+    len = room;
+  memcpy(term + curTermOffset, run, len);
+  curTermOffset += len;
+  if (!isChecksumTerm)
+    parity ^= runParity;
+}
+
+//
+// UBX binary protocol
+//
+// u-blox receivers can interleave binary frames with NMEA on the same port:
+//   B5 62 class id length(2, LE) payload checksum(CK_A, CK_B)
+// The 8-bit Fletcher checksum runs over class..payload.  NAV-PVT and
+// NAV-STATUS are decoded into the same objects the NMEA sentences fill.
+//
+#define _GPS_UBX_CLASS_NAV 0x01
+#define _GPS_UBX_NAV_STATUS 0x03
+#define _GPS_UBX_NAV_STATUS_LENGTH 16
+#define _GPS_UBX_NAV_PVT 0x07
+#define _GPS_UBX_NAV_PVT_LENGTH 92
+
+static inline uint16_t ubxU16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline int32_t ubxI32(const uint8_t *p)
+{
+  return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+// 1e-7 degrees to a nanodegree magnitude and hemisphere
+static void ubxDegrees(int64_t &nanodegrees, bool &negative, int32_t e7)
+{
+  negative = e7 < 0;
+  nanodegrees = (e7 < 0 ? -(int64_t)e7 : (int64_t)e7) * 100;
+}
+
+// Feeds bytes to the frame in progress.  Returns how many were taken, which
+// is short of len once the frame ends, or 0 if the 0xB5 that started it
+// turns out not to be followed by 0x62.  *frames counts frames that passed
+// their checksum.
+size_t TinyGPSPlus::ubxEncode(const char *buf, size_t len, int *frames)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  size_t i = 0;
+
+  while (i < len && ubxState != UBX_IDLE)
+  {
+    uint8_t b = p[i];
+
+    switch (ubxState)
+    {
+    case UBX_SYNC2:
+      if (b != _GPS_UBX_SYNC2)
+      {
+        // A lone 0xB5 is just a (non-NMEA) character in the current term
+        static const char sync1 = (char)_GPS_UBX_SYNC1;
+        ubxState = UBX_IDLE;
+        appendTerm(&sync1, 1, _GPS_UBX_SYNC1);
+        return i;
+      }
+      ubxCkA = ubxCkB = 0;
+      ubxState = UBX_CLASS;
+      ++i;
+      continue;
+
+    case UBX_PAYLOAD:
+    {
+      // Take as much of the payload as this buffer holds in one go
+      size_t take = min(len - i, (size_t)(ubxLength - ubxOffset));
+      for (size_t j = 0; j < take; ++j)
+      {
+        ubxCkA += p[i + j];
+        ubxCkB += ubxCkA;
+      }
+      if (ubxOffset < sizeof(ubxPayload))
+        memcpy(ubxPayload + ubxOffset, p + i, min(take, sizeof(ubxPayload) - ubxOffset));
+      ubxOffset += take;
+      i += take;
+      if (ubxOffset == ubxLength)
+        ubxState = UBX_CK_A;
+      continue;
+    }
+
+    case UBX_CK_A:
+      ++i;
+      if (b == ubxCkA)
+      {
+        ubxState = UBX_CK_B;
+      }
+      else
+      {
+        ++failedChecksumCount;
+        ubxState = UBX_IDLE;
+      }
+      continue;
+
+    case UBX_CK_B:
+      ++i;
+      ubxState = UBX_IDLE;
+      if (b == ubxCkB)
+      {
+        ++passedChecksumCount;
+        ++*frames;
+        ubxEndOfFrame();
+      }
+      else
+      {
+        ++failedChecksumCount;
+      }
+      continue;
+    }
+
+    // Header bytes, all covered by the checksum
+    ubxCkA += b;
+    ubxCkB += ubxCkA;
+    ++i;
+
+    switch (ubxState)
+    {
+    case UBX_CLASS:
+      ubxClass = b;
+      ubxState = UBX_ID;
+      break;
+    case UBX_ID:
+      ubxId = b;
+      ubxState = UBX_LENGTH1;
+      break;
+    case UBX_LENGTH1:
+      ubxLength = b;
+      ubxState = UBX_LENGTH2;
+      break;
+    case UBX_LENGTH2:
+      ubxLength |= (uint16_t)b << 8;
+      ubxOffset = 0;
+      if (ubxLength > _GPS_UBX_MAX_LENGTH)
+      {
+        ++failedChecksumCount;
+        ubxState = UBX_IDLE;
+      }
+      else
+      {
+        ubxState = ubxLength ? UBX_PAYLOAD : UBX_CK_A;
+      }
+      break;
+    }
+  }
+
+  return i;
+}
+
+// Decodes a checksummed frame.  Position, speed and course are only taken
+// when the receiver flags the fix as good (gnssFixOK / gpsFixOk).
+void TinyGPSPlus::ubxEndOfFrame()
+{
+  const uint8_t *p = ubxPayload;
+
+  if (ubxClass != _GPS_UBX_CLASS_NAV)
+    return;
+
+  if (ubxId == _GPS_UBX_NAV_STATUS && ubxLength == _GPS_UBX_NAV_STATUS_LENGTH)
+  {
+    fixType.newval = (p[5] & 0x01) ? p[4] : 0;
+    fixType.commit();
+  }
+  else if (ubxId == _GPS_UBX_NAV_PVT && ubxLength == _GPS_UBX_NAV_PVT_LENGTH)
+  {
+    uint8_t valid = p[11];
+    uint8_t type = p[20];
+    bool fixOk = (p[21] & 0x01) && type >= 2 && type <= 4;
+
+    if (valid & 0x01) // validDate
+    {
+      date.newDate = p[7] * 10000UL + p[6] * 100UL + ubxU16(p + 4) % 100;
+      date.commit();
+    }
+
+    if (valid & 0x02) // validTime
+    {
+      int32_t nano = ubxI32(p + 16);
+      time.newTime = p[8] * 1000000UL + p[9] * 10000UL + p[10] * 100UL + (nano > 0 ? nano / 10000000L : 0);
+      time.commit();
+    }
+
+    fixType.newval = (p[21] & 0x01) ? type : 0;
+    fixType.commit();
+    satellites.newval = p[23];
+    satellites.commit();
+
+    if (fixOk)
+    {
+      ++sentencesWithFixCount;
+      ubxDegrees(location.newLngNano, location.newLngWest, ubxI32(p + 24));
+      ubxDegrees(location.newLatNano, location.newLatSouth, ubxI32(p + 28));
+      location.commit(ubxArrival);
+      altitude.newval = ubxI32(p + 36) / 10;                           // hMSL, mm to cm
+      altitude.commit();
+      speed.newval = (int32_t)(((int64_t)ubxI32(p + 60) * 360 + 926) / 1852); // mm/s to 1/100 knot
+      speed.commit();
+      course.newval = ubxI32(p + 64) / 1000;                           // 1e-5 to 1/100 degree
+      course.commit();
+    }
+  }
+}
+
 int TinyGPSPlus::fromHex(char a)
 {
   if (a >= 'A' && a <= 'F')
@@ -110,33 +582,134 @@ int TinyGPSPlus::fromHex(char a)
     return a - '0';
 }
 
+//
+// fixed-width field parsing
+//
+// _GPSDigits<N> converts exactly N ASCII digits as a straight line of
+// multiply-adds, and checks them with no branches.  Each field is measured
+// once and dispatched to the instantiation for its shape, so the widths a
+// receiver actually sends each get their own unrolled parser.  Anything
+// else takes the general path, which gives the same results.
+//
+template <unsigned N> struct _GPSDigits
+{
+  static inline uint32_t parse(const char *p) { return _GPSDigits<N - 1>::parse(p) * 10 + (uint8_t)(p[N - 1] - '0'); }
+  static inline bool valid(const char *p)     { return _GPSDigits<N - 1>::valid(p) & ((uint8_t)(p[N - 1] - '0') <= 9); }
+};
+
+template <> struct _GPSDigits<0>
+{
+  static inline uint32_t parse(const char *) { return 0; }
+  static inline bool valid(const char *)     { return true; }
+};
+
+template <unsigned N> struct _GPSPow10 { static const uint32_t value = 10 * _GPSPow10<N - 1>::value; };
+template <> struct _GPSPow10<0> { static const uint32_t value = 1; };
+
+static inline size_t digitRun(const char *p)
+{
+  size_t n = 0;
+  while ((uint8_t)(p[n] - '0') <= 9)
+    ++n;
+  return n;
+}
+
+// D degree digits, 2 minute digits, '.', F fraction digits
+template <unsigned D, unsigned F>
+static inline bool parseFixedDegrees(const char *term, int64_t &nanodegrees)
+{
+  const char *fraction = term + D + 3;
+  if (!(_GPSDigits<D + 2>::valid(term) & _GPSDigits<F>::valid(fraction)))
+    return false;
+
+  uint32_t tenMillionthsOfMinutes = _GPSDigits<2>::parse(term + D) * 10000000UL +
+                                    _GPSDigits<F>::parse(fraction) * _GPSPow10<7 - F>::value;
+  nanodegrees = _GPSDigits<D>::parse(term) * _GPS_NANODEGREES_PER_DEGREE + (5 * tenMillionthsOfMinutes + 1) / 3;
+  return true;
+}
+
+// -I.FF with I whole digits and F (0-2 used) fraction digits
+template <unsigned I>
+static inline int32_t parseFixedDecimal(const char *term, size_t fractionDigits)
+{
+  int32_t ret = 100 * (int32_t)_GPSDigits<I>::parse(term);
+  const char *fraction = term + I + 1;
+  if (fractionDigits >= 2)
+    ret += (int32_t)_GPSDigits<2>::parse(fraction);
+  else if (fractionDigits == 1)
+    ret += 10 * (int32_t)_GPSDigits<1>::parse(fraction);
+  return ret;
+}
+
 // static
 // Parse a (potentially negative) number with up to 2 decimal digits -xxxx.yy
 int32_t TinyGPSPlus::parseDecimal(const char *term)
 {
   bool negative = *term == '-';
   if (negative) ++term;
-  int32_t ret = 100 * (int32_t)atol(term);
-  while (isdigit(*term)) ++term;
-  if (*term == '.' && isdigit(term[1]))
+
+  size_t whole = digitRun(term);
+  size_t fraction = term[whole] == '.' ? digitRun(term + whole + 1) : 0;
+  int32_t ret;
+
+  switch (whole)
   {
-    ret += 10 * (term[1] - '0');
-    if (isdigit(term[2]))
-      ret += term[2] - '0';
+  case 1: ret = parseFixedDecimal<1>(term, fraction); break;
+  case 2: ret = parseFixedDecimal<2>(term, fraction); break;
+  case 3: ret = parseFixedDecimal<3>(term, fraction); break;
+  case 4: ret = parseFixedDecimal<4>(term, fraction); break;
+  case 5: ret = parseFixedDecimal<5>(term, fraction); break;
+  case 6: ret = parseFixedDecimal<6>(term, fraction); break;
+  case 7: ret = parseFixedDecimal<7>(term, fraction); break;
+  default:
+    ret = 100 * (int32_t)atol(term);
+    while (isdigit(*term)) ++term;
+    if (*term == '.' && isdigit(term[1]))
+    {
+      ret += 10 * (term[1] - '0');
+      if (isdigit(term[2]))
+        ret += term[2] - '0';
+    }
+    break;
   }
+
   return negative ? -ret : ret;
 }
 
 // static
-// Parse degrees in that funny NMEA format DDMM.MMMM
-void TinyGPSPlus::parseDegrees(const char *term, RawDegrees &deg)
+// Parse degrees in that funny NMEA format DDMM.MMMM to unsigned nanodegrees
+int64_t TinyGPSPlus::parseNanodegrees(const char *term)
 {
+  int64_t nanodegrees;
+  size_t whole = digitRun(term);
+  size_t fraction = term[whole] == '.' ? strlen(term + whole + 1) : 0;
+
+#define _GPS_DEGREES_SHAPE(whole, fraction) ((whole) * 8 + (fraction))
+  switch (_GPS_DEGREES_SHAPE(whole, fraction))
+  {
+  case _GPS_DEGREES_SHAPE(4, 1): if (parseFixedDegrees<2, 1>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(4, 2): if (parseFixedDegrees<2, 2>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(4, 3): if (parseFixedDegrees<2, 3>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(4, 4): if (parseFixedDegrees<2, 4>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(4, 5): if (parseFixedDegrees<2, 5>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(4, 6): if (parseFixedDegrees<2, 6>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(4, 7): if (parseFixedDegrees<2, 7>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 1): if (parseFixedDegrees<3, 1>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 2): if (parseFixedDegrees<3, 2>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 3): if (parseFixedDegrees<3, 3>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 4): if (parseFixedDegrees<3, 4>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 5): if (parseFixedDegrees<3, 5>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 6): if (parseFixedDegrees<3, 6>(term, nanodegrees)) return nanodegrees; break;
+  case _GPS_DEGREES_SHAPE(5, 7): if (parseFixedDegrees<3, 7>(term, nanodegrees)) return nanodegrees; break;
+  }
+#undef _GPS_DEGREES_SHAPE
+
+  // General case: any width, fraction digits past the seventh ignored
   uint32_t leftOfDecimal = (uint32_t)atol(term);
   uint16_t minutes = (uint16_t)(leftOfDecimal % 100);
   uint32_t multiplier = 10000000UL;
   uint32_t tenMillionthsOfMinutes = minutes * multiplier;
-
-  deg.deg = (int16_t)(leftOfDecimal / 100);
+  uint16_t deg = (uint16_t)(leftOfDecimal / 100);
 
   while (isdigit(*term))
     ++term;
@@ -148,8 +721,14 @@ void TinyGPSPlus::parseDegrees(const char *term, RawDegrees &deg)
       tenMillionthsOfMinutes += (*term - '0') * multiplier;
     }
 
-  deg.billionths = (5 * tenMillionthsOfMinutes + 1) / 3;
-  deg.negative = false;
+  return deg * _GPS_NANODEGREES_PER_DEGREE + (5 * tenMillionthsOfMinutes + 1) / 3;
+}
+
+// static
+// Parse degrees in that funny NMEA format DDMM.MMMM
+void TinyGPSPlus::parseDegrees(const char *term, RawDegrees &deg)
+{
+  TinyGPSLocation::toRawDegrees(parseNanodegrees(term), deg);
 }
 
 #define COMBINE(sentence_type, term_number) (((unsigned)(sentence_type) << 5) | term_number)
@@ -170,31 +749,37 @@ bool TinyGPSPlus::endOfTermHandler()
 
       switch(curSentenceType)
       {
-      case GPS_SENTENCE_GPRMC:
+      case GPS_SENTENCE_RMC:
         date.commit();
         time.commit();
         if (sentenceHasFix)
         {
-           location.commit();
+           location.commit(sentenceArrival);
            speed.commit();
            course.commit();
         }
         break;
-      case GPS_SENTENCE_GPGGA:
+      case GPS_SENTENCE_GGA:
         time.commit();
         if (sentenceHasFix)
         {
-          location.commit();
+          location.commit(sentenceArrival);
           altitude.commit();
         }
         satellites.commit();
         hdop.commit();
         break;
+      case GPS_SENTENCE_PMTK_ACK:
+        pmtkAck.commit();
+        break;
       }
 
       // Commit all custom listeners of this sentence type
-      for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0; p = p->next)
-         p->commit();
+      if (customCandidates != NULL)
+        for (TinyGPSCustom *p = customCandidates->elts; p != NULL; p = p->next)
+          p->commit();
+      for (TinyGPSCustom *p = overflowCandidates; p != NULL && strcmp(p->sentenceName, overflowCandidates->sentenceName) == 0; p = p->next)
+        p->commit();
       return true;
     }
 
@@ -209,17 +794,17 @@ bool TinyGPSPlus::endOfTermHandler()
   // the first term determines the sentence type
   if (curTermNumber == 0)
   {
-    if (!strcmp(term, _GPRMCterm))
-      curSentenceType = GPS_SENTENCE_GPRMC;
-    else if (!strcmp(term, _GPGGAterm))
-      curSentenceType = GPS_SENTENCE_GPGGA;
-    else
-      curSentenceType = GPS_SENTENCE_OTHER;
+    curSentenceType = sentenceTypeOf(term);
 
     // Any custom candidates of this sentence type?
-    for (customCandidates = customElts; customCandidates != NULL && strcmp(customCandidates->sentenceName, term) < 0; customCandidates = customCandidates->next);
-    if (customCandidates != NULL && strcmp(customCandidates->sentenceName, term) > 0)
-       customCandidates = NULL;
+    customCandidates = findCustomSentence(term, false);
+    overflowCandidates = NULL;
+    if (customCandidates == NULL && customOverflow != NULL)
+    {
+      for (overflowCandidates = customOverflow; overflowCandidates != NULL && strcmp(overflowCandidates->sentenceName, term) < 0; overflowCandidates = overflowCandidates->next);
+      if (overflowCandidates != NULL && strcmp(overflowCandidates->sentenceName, term) > 0)
+        overflowCandidates = NULL;
+    }
 
     return false;
   }
@@ -227,56 +812,77 @@ bool TinyGPSPlus::endOfTermHandler()
   if (curSentenceType != GPS_SENTENCE_OTHER && term[0])
     switch(COMBINE(curSentenceType, curTermNumber))
   {
-    case COMBINE(GPS_SENTENCE_GPRMC, 1): // Time in both sentences
-    case COMBINE(GPS_SENTENCE_GPGGA, 1):
+    case COMBINE(GPS_SENTENCE_RMC, 1): // Time in both sentences
+    case COMBINE(GPS_SENTENCE_GGA, 1):
       time.setTime(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 2): // GPRMC validity
+    case COMBINE(GPS_SENTENCE_RMC, 2): // RMC validity
       sentenceHasFix = term[0] == 'A';
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 3): // Latitude
-    case COMBINE(GPS_SENTENCE_GPGGA, 2):
+    case COMBINE(GPS_SENTENCE_RMC, 3): // Latitude
+    case COMBINE(GPS_SENTENCE_GGA, 2):
       location.setLatitude(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 4): // N/S
-    case COMBINE(GPS_SENTENCE_GPGGA, 3):
-      location.rawNewLatData.negative = term[0] == 'S';
+    case COMBINE(GPS_SENTENCE_RMC, 4): // N/S
+    case COMBINE(GPS_SENTENCE_GGA, 3):
+      location.newLatSouth = term[0] == 'S';
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 5): // Longitude
-    case COMBINE(GPS_SENTENCE_GPGGA, 4):
+    case COMBINE(GPS_SENTENCE_RMC, 5): // Longitude
+    case COMBINE(GPS_SENTENCE_GGA, 4):
       location.setLongitude(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 6): // E/W
-    case COMBINE(GPS_SENTENCE_GPGGA, 5):
-      location.rawNewLngData.negative = term[0] == 'W';
+    case COMBINE(GPS_SENTENCE_RMC, 6): // E/W
+    case COMBINE(GPS_SENTENCE_GGA, 5):
+      location.newLngWest = term[0] == 'W';
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 7): // Speed (GPRMC)
+    case COMBINE(GPS_SENTENCE_RMC, 7): // Speed (RMC)
       speed.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 8): // Course (GPRMC)
+    case COMBINE(GPS_SENTENCE_RMC, 8): // Course (RMC)
       course.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPRMC, 9): // Date (GPRMC)
+    case COMBINE(GPS_SENTENCE_RMC, 9): // Date (RMC)
       date.setDate(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPGGA, 6): // Fix data (GPGGA)
+    case COMBINE(GPS_SENTENCE_GGA, 6): // Fix data (GGA)
       sentenceHasFix = term[0] > '0';
       break;
-    case COMBINE(GPS_SENTENCE_GPGGA, 7): // Satellites used (GPGGA)
+    case COMBINE(GPS_SENTENCE_GGA, 7): // Satellites used (GGA)
       satellites.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPGGA, 8): // HDOP
+    case COMBINE(GPS_SENTENCE_GGA, 8): // HDOP
       hdop.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_GPGGA, 9): // Altitude (GPGGA)
+    case COMBINE(GPS_SENTENCE_GGA, 9): // Altitude (GGA)
       altitude.set(term);
       break;
+    case COMBINE(GPS_SENTENCE_PMTK_ACK, 1): // Command acknowledged (PMTK001)
+      pmtkAck.newCmd = (uint16_t)atol(term);
+      break;
+    case COMBINE(GPS_SENTENCE_PMTK_ACK, 2): // Result flag (PMTK001)
+      pmtkAck.newFlg = (uint8_t)atol(term);
+      break;
   }
 
   // Set custom values as needed
-  for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0 && p->termNumber <= curTermNumber; p = p->next)
+  if (customCandidates != NULL)
+  {
+    if (curTermNumber < _GPS_MAX_CUSTOM_TERMS)
+    {
+      for (TinyGPSCustom *p = customCandidates->terms[curTermNumber]; p != NULL; p = p->nextInTerm)
+        p->set(term);
+    }
+    else
+    {
+      for (TinyGPSCustom *p = customCandidates->highTerms; p != NULL; p = p->nextInTerm)
+        if (p->termNumber == curTermNumber)
+          p->set(term);
+    }
+  }
+
+  for (TinyGPSCustom *p = overflowCandidates; p != NULL && strcmp(p->sentenceName, overflowCandidates->sentenceName) == 0 && p->termNumber <= curTermNumber; p = p->next)
     if (p->termNumber == curTermNumber)
-         p->set(term);
+      p->set(term);
 
   return false;
 }
@@ -304,7 +910,7 @@ double TinyGPSPlus::distanceBetween(double lat1, double long1, double lat2, doub
   delta = sqrt(delta);
   double denom = (slat1 * slat2) + (clat1 * clat2 * cdlong);
   delta = atan2(delta, denom);
-  return delta * 6372795;
+  return delta * _GPS_EARTH_RADIUS_M;
 }
 
 double TinyGPSPlus::courseTo(double lat1, double long1, double lat2, double long2)
@@ -327,6 +933,154 @@ double TinyGPSPlus::courseTo(double lat1, double long1, double lat2, double long
   return degrees(a2);
 }
 
+/* static */
+double TinyGPSPlus::distanceBetweenWGS84(double lat1, double long1, double lat2, double long2, double *course)
+{
+  // returns distance in meters between two positions on the WGS84 ellipsoid
+  // using Vincenty's inverse formula, good to well under a millimeter.  If
+  // course is given it receives the initial course in degrees (North=0).
+  // The iteration is capped at _GPS_VINCENTY_MAX_ITERATIONS; the nearly
+  // antipodal points where it fails to converge get the spherical answer.
+  const double f = _GPS_WGS84_F;
+  double L = radians(long2 - long1);
+  double U1 = atan((1.0 - f) * tan(radians(lat1)));
+  double U2 = atan((1.0 - f) * tan(radians(lat2)));
+  double sinU1 = sin(U1), cosU1 = cos(U1);
+  double sinU2 = sin(U2), cosU2 = cos(U2);
+  double lambda = L, lambdaP;
+  double sinLambda, cosLambda, sinSigma, cosSigma, sigma, sinAlpha, cosSqAlpha, cos2SigmaM;
+  int iterations = _GPS_VINCENTY_MAX_ITERATIONS;
+
+  do
+  {
+    sinLambda = sin(lambda);
+    cosLambda = cos(lambda);
+    sinSigma = sqrt(sq(cosU2 * sinLambda) + sq(cosU1 * sinU2 - sinU1 * cosU2 * cosLambda));
+    if (sinSigma == 0.0)
+    {
+      // coincident points
+      if (course != NULL)
+        *course = 0.0;
+      return 0.0;
+    }
+    cosSigma = sinU1 * sinU2 + cosU1 * cosU2 * cosLambda;
+    sigma = atan2(sinSigma, cosSigma);
+    sinAlpha = cosU1 * cosU2 * sinLambda / sinSigma;
+    cosSqAlpha = 1.0 - sq(sinAlpha);
+    cos2SigmaM = cosSqAlpha != 0.0 ? cosSigma - 2.0 * sinU1 * sinU2 / cosSqAlpha : 0.0; // equatorial line
+    double C = f / 16.0 * cosSqAlpha * (4.0 + f * (4.0 - 3.0 * cosSqAlpha));
+    lambdaP = lambda;
+    lambda = L + (1.0 - C) * f * sinAlpha *
+      (sigma + C * sinSigma * (cos2SigmaM + C * cosSigma * (-1.0 + 2.0 * sq(cos2SigmaM))));
+  } while (fabs(lambda - lambdaP) > _GPS_VINCENTY_TOLERANCE && --iterations > 0);
+
+  if (iterations == 0)
+  {
+    if (course != NULL)
+      *course = courseTo(lat1, long1, lat2, long2);
+    return distanceBetween(lat1, long1, lat2, long2);
+  }
+
+  double uSq = cosSqAlpha * (sq(_GPS_WGS84_A) - sq(_GPS_WGS84_B)) / sq(_GPS_WGS84_B);
+  double A = 1.0 + uSq / 16384.0 * (4096.0 + uSq * (-768.0 + uSq * (320.0 - 175.0 * uSq)));
+  double B = uSq / 1024.0 * (256.0 + uSq * (-128.0 + uSq * (74.0 - 47.0 * uSq)));
+  double deltaSigma = B * sinSigma * (cos2SigmaM + B / 4.0 * (cosSigma * (-1.0 + 2.0 * sq(cos2SigmaM)) -
+    B / 6.0 * cos2SigmaM * (-3.0 + 4.0 * sq(sinSigma)) * (-3.0 + 4.0 * sq(cos2SigmaM))));
+
+  if (course != NULL)
+  {
+    double a = atan2(cosU2 * sinLambda, cosU1 * sinU2 - sinU1 * cosU2 * cosLambda);
+    if (a < 0.0)
+      a += TWO_PI;
+    *course = degrees(a);
+  }
+
+  return _GPS_WGS84_B * A * (sigma - deltaSigma);
+}
+
+// Distance (meters) and course (degrees) from one position to n points
+// given by the sine and cosine of their latitude and longitude, using the
+// same formulas as distanceBetween() and courseTo().  The origin's trig
+// terms are computed once, so each point costs a sqrt and an atan2 for its
+// distance and an atan2 for its course, with no sin/cos.  Either output
+// array may be NULL.
+static void distancesAndCourses(double lat, double lng, size_t n,
+  const double * __restrict slat2, const double * __restrict clat2,
+  const double * __restrict slng2, const double * __restrict clng2,
+  double * __restrict dist, double * __restrict crs)
+{
+  const double slat1 = sin(radians(lat));
+  const double clat1 = cos(radians(lat));
+  const double slng1 = sin(radians(lng));
+  const double clng1 = cos(radians(lng));
+
+  if (dist != NULL)
+    for (size_t i = 0; i < n; ++i)
+    {
+      // sin/cos of (lng - target lng) by angle difference identities
+      double sdlong = slng1 * clng2[i] - clng1 * slng2[i];
+      double cdlong = clng1 * clng2[i] + slng1 * slng2[i];
+      double a = clat1 * slat2[i] - slat1 * clat2[i] * cdlong;
+      double b = clat2[i] * sdlong;
+      double denom = slat1 * slat2[i] + clat1 * clat2[i] * cdlong;
+      dist[i] = atan2(sqrt(a * a + b * b), denom) * _GPS_EARTH_RADIUS_M;
+    }
+
+  if (crs != NULL)
+    for (size_t i = 0; i < n; ++i)
+    {
+      double sdlong = slng1 * clng2[i] - clng1 * slng2[i];
+      double cdlong = clng1 * clng2[i] + slng1 * slng2[i];
+      double a1 = -sdlong * clat2[i];
+      double a2 = clat1 * slat2[i] - slat1 * clat2[i] * cdlong;
+      double c = atan2(a1, a2);
+      crs[i] = degrees(c + (c < 0.0) * TWO_PI);
+    }
+}
+
+/* static */
+// Distance (meters) and course (degrees) from one position to every waypoint
+// in targets, from the waypoints' cached trig terms.  Either output array
+// may be NULL.
+void TinyGPSPlus::distancesAndCoursesTo(double lat, double lng, const TinyGPSWaypoints &targets, double *distances, double *courses)
+{
+  distancesAndCourses(lat, lng, targets.count,
+    targets.sinLat, targets.cosLat, targets.sinLng, targets.cosLng,
+    distances, courses);
+}
+
+/* static */
+// Index of the waypoint closest to the given position, or targets.size()
+// if the set is empty.  Distances are computed in blocks on the stack.
+size_t TinyGPSPlus::nearest(double lat, double lng, const TinyGPSWaypoints &targets, double *distance)
+{
+  enum { BLOCK = 64 };
+  double blockDist[BLOCK];
+  size_t best = targets.count;
+  double bestDist = 0;
+
+  for (size_t start = 0; start < targets.count; start += BLOCK)
+  {
+    size_t n = min((size_t)BLOCK, targets.count - start);
+
+    distancesAndCourses(lat, lng, n,
+      targets.sinLat + start, targets.cosLat + start,
+      targets.sinLng + start, targets.cosLng + start,
+      blockDist, NULL);
+
+    for (size_t i = 0; i < n; ++i)
+      if (best == targets.count || blockDist[i] < bestDist)
+      {
+        best = start + i;
+        bestDist = blockDist[i];
+      }
+  }
+
+  if (distance != NULL)
+    *distance = bestDist;
+  return best;
+}
+
 const char *TinyGPSPlus::cardinal(double course)
 {
   static const char* directions[] = {"N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE", "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW"};
@@ -334,36 +1088,47 @@ const char *TinyGPSPlus::cardinal(double course)
   return directions[direction % 16];
 }
 
-void TinyGPSLocation::commit()
+void TinyGPSLocation::commit(uint32_t arrival)
 {
-   rawLatData = rawNewLatData;
-   rawLngData = rawNewLngData;
+   latNano = newLatSouth ? -newLatNano : newLatNano;
+   lngNano = newLngWest ? -newLngNano : newLngNano;
    lastCommitTime = millis();
+   arrivalMicros = arrival;
    valid = updated = true;
 }
 
 void TinyGPSLocation::setLatitude(const char *term)
 {
-   TinyGPSPlus::parseDegrees(term, rawNewLatData);
+   newLatNano = TinyGPSPlus::parseNanodegrees(term);
+   newLatSouth = false;
 }
 
 void TinyGPSLocation::setLongitude(const char *term)
 {
-   TinyGPSPlus::parseDegrees(term, rawNewLngData);
+   newLngNano = TinyGPSPlus::parseNanodegrees(term);
+   newLngWest = false;
 }
 
+// Whole and fractional degrees are converted separately so the result is
+// the nearest double to the stored value, whatever its magnitude
 double TinyGPSLocation::lat()
 {
    updated = false;
-   double ret = rawLatData.deg + rawLatData.billionths / 1000000000.0;
-   return rawLatData.negative ? -ret : ret;
+   return latNano / _GPS_NANODEGREES_PER_DEGREE + (latNano % _GPS_NANODEGREES_PER_DEGREE) / 1000000000.0;
 }
 
 double TinyGPSLocation::lng()
 {
    updated = false;
-   double ret = rawLngData.deg + rawLngData.billionths / 1000000000.0;
-   return rawLngData.negative ? -ret : ret;
+   return lngNano / _GPS_NANODEGREES_PER_DEGREE + (lngNano % _GPS_NANODEGREES_PER_DEGREE) / 1000000000.0;
+}
+
+void TinyGPSLocation::toRawDegrees(int64_t nanodegrees, RawDegrees &deg)
+{
+   uint64_t magnitude = nanodegrees < 0 ? 0 - (uint64_t)nanodegrees : (uint64_t)nanodegrees;
+   deg.deg = (uint16_t)(magnitude / _GPS_NANODEGREES_PER_DEGREE);
+   deg.billionths = (uint32_t)(magnitude % _GPS_NANODEGREES_PER_DEGREE);
+   deg.negative = nanodegrees < 0;
 }
 
 void TinyGPSDate::commit()
@@ -445,6 +1210,14 @@ void TinyGPSDecimal::set(const char *term)
    newval = TinyGPSPlus::parseDecimal(term);
 }
 
+void TinyGPSAck::commit()
+{
+   cmd = newCmd;
+   flg = newFlg;
+   lastCommitTime = millis();
+   valid = updated = true;
+}
+
 void TinyGPSInteger::commit()
 {
    val = newval;
@@ -457,6 +1230,61 @@ void TinyGPSInteger::set(const char *term)
    newval = atol(term);
 }
 
+TinyGPSWaypoints::TinyGPSWaypoints()
+  :  count(0)
+  ,  capacity(0)
+  ,  latDeg(0)
+  ,  lngDeg(0)
+  ,  sinLat(0)
+  ,  cosLat(0)
+  ,  sinLng(0)
+  ,  cosLng(0)
+{
+}
+
+TinyGPSWaypoints::~TinyGPSWaypoints()
+{
+  free(latDeg);
+}
+
+bool TinyGPSWaypoints::add(double lat, double lng)
+{
+  if (count == capacity && !reserve(capacity ? 2 * capacity : 16))
+    return false;
+
+  latDeg[count] = lat;
+  lngDeg[count] = lng;
+  sinLat[count] = sin(radians(lat));
+  cosLat[count] = cos(radians(lat));
+  sinLng[count] = sin(radians(lng));
+  cosLng[count] = cos(radians(lng));
+  ++count;
+  return true;
+}
+
+// All six arrays live in one allocation, each n doubles long
+bool TinyGPSWaypoints::reserve(size_t n)
+{
+  double *block = (double *)malloc(6 * n * sizeof(double));
+  if (block == NULL)
+    return false;
+
+  double *arrays[6] = { latDeg, lngDeg, sinLat, cosLat, sinLng, cosLng };
+  for (int i = 0; i < 6; ++i)
+    if (count)
+      memcpy(block + i * n, arrays[i], count * sizeof(double));
+
+  free(latDeg);
+  latDeg = block;
+  lngDeg = block + n;
+  sinLat = block + 2 * n;
+  cosLat = block + 3 * n;
+  sinLng = block + 4 * n;
+  cosLng = block + 5 * n;
+  capacity = n;
+  return true;
+}
+
 TinyGPSCustom::TinyGPSCustom(TinyGPSPlus &gps, const char *_sentenceName, int _termNumber)
 {
    begin(gps, _sentenceName, _termNumber);
@@ -487,17 +1315,67 @@ void TinyGPSCustom::set(const char *term)
    strncpy(this->stagingBuffer, term, sizeof(this->stagingBuffer));
 }
 
+// Once _GPS_MAX_CUSTOM_SENTENCES distinct sentence names are in the table,
+// elements for further names go on customOverflow, a list sorted by
+// sentence name and term number that is searched linearly.
 void TinyGPSPlus::insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int termNumber)
 {
-   TinyGPSCustom **ppelt;
+   TinyGPSCustomSentence *sentence = findCustomSentence(sentenceName, true);
 
-   for (ppelt = &this->customElts; *ppelt != NULL; ppelt = &(*ppelt)->next)
+   pElt->next = pElt->nextInTerm = NULL;
+   if (sentence == NULL)
    {
-      int cmp = strcmp(sentenceName, (*ppelt)->sentenceName);
-      if (cmp < 0 || (cmp == 0 && termNumber < (*ppelt)->termNumber))
-         break;
+      TinyGPSCustom **ppelt;
+
+      for (ppelt = &this->customOverflow; *ppelt != NULL; ppelt = &(*ppelt)->next)
+      {
+         int cmp = strcmp(sentenceName, (*ppelt)->sentenceName);
+         if (cmp < 0 || (cmp == 0 && termNumber < (*ppelt)->termNumber))
+            break;
+      }
+
+      pElt->next = *ppelt;
+      *ppelt = pElt;
+      return;
+   }
+
+   pElt->next = sentence->elts;
+   sentence->elts = pElt;
+
+   if (termNumber >= 0 && termNumber < _GPS_MAX_CUSTOM_TERMS)
+   {
+      pElt->nextInTerm = sentence->terms[termNumber];
+      sentence->terms[termNumber] = pElt;
+   }
+   else
+   {
+      pElt->nextInTerm = sentence->highTerms;
+      sentence->highTerms = pElt;
+   }
+}
+
+// Open-addressed lookup of the custom elements for a sentence name.  Only
+// the matching slot is compared, so the cost doesn't depend on how many
+// custom elements are registered.
+TinyGPSCustomSentence *TinyGPSPlus::findCustomSentence(const char *sentenceName, bool create)
+{
+   uint32_t hash = 2166136261UL; // FNV-1a
+   for (const char *p = sentenceName; *p; ++p)
+      hash = (hash ^ (uint8_t)*p) * 16777619UL;
+
+   for (int i = 0; i < _GPS_MAX_CUSTOM_SENTENCES; ++i)
+   {
+      TinyGPSCustomSentence *sentence = &customSentences[(hash + i) & (_GPS_MAX_CUSTOM_SENTENCES - 1)];
+      if (sentence->name == NULL)
+      {
+         if (!create)
+            return NULL;
+         sentence->name = sentenceName;
+         return sentence;
+      }
+      if (strcmp(sentence->name, sentenceName) == 0)
+         return sentence;
    }
 
-   pElt->next = *ppelt;
-   *ppelt = pElt;
+   return NULL;
 }
@@ -28,6 +28,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <math.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stddef.h>
 
 #include "includes.h"
 
@@ -39,6 +40,24 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define _GPS_KM_PER_METER 0.001
 #define _GPS_FEET_PER_METER 3.2808399
 #define _GPS_MAX_FIELD_SIZE 15
+#define _GPS_EARTH_RADIUS_M 6372795.0
+#define _GPS_WGS84_A 6378137.0                          // semi-major axis (m)
+#define _GPS_WGS84_F (1.0 / 298.257223563)              // flattening
+#define _GPS_WGS84_B (_GPS_WGS84_A * (1.0 - _GPS_WGS84_F)) // semi-minor axis (m)
+#define _GPS_WGS84_E2 (_GPS_WGS84_F * (2.0 - _GPS_WGS84_F)) // first eccentricity squared
+#define _GPS_VINCENTY_MAX_ITERATIONS 20
+#define _GPS_VINCENTY_TOLERANCE 1e-12                   // radians of longitude on the auxiliary sphere
+#define _GPS_MAX_CUSTOM_SENTENCES 16 // sentence names indexed by hash (power of 2), more are listed
+#define _GPS_MAX_CUSTOM_TERMS 32     // term numbers indexed directly, higher ones are listed
+#define _GPS_PMTK_ACK_INVALID 0       // PMTK001 flags
+#define _GPS_PMTK_ACK_UNSUPPORTED 1
+#define _GPS_PMTK_ACK_FAILED 2
+#define _GPS_PMTK_ACK_SUCCEEDED 3
+#define _GPS_UBX_SYNC1 0xB5           // u-blox binary frame header
+#define _GPS_UBX_SYNC2 0x62
+#define _GPS_UBX_MAX_PAYLOAD 92       // NAV-PVT, the longest message decoded
+#define _GPS_UBX_MAX_LENGTH 1024      // longer lengths are taken as noise, not a frame
+#define _GPS_NANODEGREES_PER_DEGREE 1000000000LL
 
 struct RawDegrees
 {
@@ -57,21 +76,30 @@ public:
    bool isValid() const    { return valid; }
    bool isUpdated() const  { return updated; }
    uint32_t age() const    { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
-   const RawDegrees &rawLat()     { updated = false; return rawLatData; }
-   const RawDegrees &rawLng()     { updated = false; return rawLngData; }
+   uint32_t arrivalTime() const { return arrivalMicros; } // micros() when the fix's '$' arrived
+   int64_t latNanodegrees()       { updated = false; return latNano; }
+   int64_t lngNanodegrees()       { updated = false; return lngNano; }
+   const RawDegrees &rawLat()     { updated = false; toRawDegrees(latNano, rawLatData); return rawLatData; }
+   const RawDegrees &rawLng()     { updated = false; toRawDegrees(lngNano, rawLngData); return rawLngData; }
    double lat();
    double lng();
 
-   TinyGPSLocation() : valid(false), updated(false)
+   TinyGPSLocation() : valid(false), updated(false), latNano(0), lngNano(0), newLatNano(0), newLngNano(0),
+      newLatSouth(false), newLngWest(false), arrivalMicros(0)
    {}
 
 private:
    bool valid, updated;
-   RawDegrees rawLatData, rawLngData, rawNewLatData, rawNewLngData;
+   int64_t latNano, lngNano;          // signed nanodegrees, converted only by the accessors
+   int64_t newLatNano, newLngNano;    // magnitudes until the hemisphere term arrives
+   bool newLatSouth, newLngWest;
+   RawDegrees rawLatData, rawLngData; // filled in by rawLat()/rawLng()
    uint32_t lastCommitTime;
-   void commit();
+   uint32_t arrivalMicros;
+   void commit(uint32_t arrival);
    void setLatitude(const char *term);
    void setLongitude(const char *term);
+   static void toRawDegrees(int64_t nanodegrees, RawDegrees &deg);
 };
 
 struct TinyGPSDate
@@ -163,6 +191,31 @@ private:
    void set(const char *term);
 };
 
+// Last $PMTK001 acknowledgement from an MTK receiver
+struct TinyGPSAck
+{
+   friend class TinyGPSPlus;
+public:
+   bool isValid() const    { return valid; }
+   bool isUpdated() const  { return updated; }
+   uint32_t age() const    { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+   uint16_t command()      { updated = false; return cmd; }
+   uint8_t flag() const    { return flg; }
+   bool succeeded() const  { return flg == _GPS_PMTK_ACK_SUCCEEDED; }
+
+   TinyGPSAck() : valid(false), updated(false), cmd(0), flg(0), newCmd(0), newFlg(0)
+   {}
+
+private:
+   bool valid, updated;
+   uint32_t lastCommitTime;
+   uint16_t cmd;
+   uint8_t flg;
+   uint16_t newCmd;
+   uint8_t newFlg;
+   void commit();
+};
+
 struct TinyGPSSpeed : TinyGPSDecimal
 {
    double knots()    { return value() / 100.0; }
@@ -208,7 +261,43 @@ private:
    const char *sentenceName;
    int termNumber;
    friend class TinyGPSPlus;
-   TinyGPSCustom *next;
+   TinyGPSCustom *next;       // next element of the same sentence
+   TinyGPSCustom *nextInTerm; // next element of the same sentence and term
+};
+
+// Custom elements registered for one sentence name, indexed by term number
+struct TinyGPSCustomSentence
+{
+   const char *name;
+   TinyGPSCustom *elts;
+   TinyGPSCustom *terms[_GPS_MAX_CUSTOM_TERMS];
+   TinyGPSCustom *highTerms;
+};
+
+// Structure-of-arrays set of waypoints.  The sine and cosine of each
+// waypoint's latitude and longitude are computed once in add(), so the
+// batch distance/course functions need no per-target sin/cos.
+class TinyGPSWaypoints
+{
+public:
+  TinyGPSWaypoints();
+  ~TinyGPSWaypoints();
+
+  bool add(double lat, double lng);
+  void clear()                  { count = 0; }
+  size_t size() const           { return count; }
+  double lat(size_t i) const    { return latDeg[i]; }
+  double lng(size_t i) const    { return lngDeg[i]; }
+
+private:
+  TinyGPSWaypoints(const TinyGPSWaypoints &);
+  TinyGPSWaypoints &operator=(const TinyGPSWaypoints &);
+  bool reserve(size_t n);
+
+  size_t count, capacity;
+  double *latDeg, *lngDeg;
+  double *sinLat, *cosLat, *sinLng, *cosLng;
+  friend class TinyGPSPlus;
 };
 
 class TinyGPSPlus
@@ -216,6 +305,8 @@ class TinyGPSPlus
 public:
   TinyGPSPlus();
   bool encode(char c); // process one character received from GPS
+  int encode(const char *buf, size_t len); // process a buffer, returns sentences committed
+  int encode(const char *buf, size_t len, uint32_t arrival, uint32_t microsPerChar); // ... received by micros() 'arrival'
   TinyGPSPlus &operator << (char c) {encode(c); return *this;}
 
   TinyGPSLocation location;
@@ -226,15 +317,23 @@ public:
   TinyGPSAltitude altitude;
   TinyGPSInteger satellites;
   TinyGPSDecimal hdop;
+  TinyGPSAck pmtkAck;
+  TinyGPSInteger fixType; // UBX: 0 none, 1 DR, 2 2D, 3 3D, 4 GNSS+DR, 5 time only
 
   static const char *libraryVersion() { return _GPS_VERSION; }
+  static const char *scanKernelName(); // delimiter scanner in this build
 
   static double distanceBetween(double lat1, double long1, double lat2, double long2);
   static double courseTo(double lat1, double long1, double lat2, double long2);
+  static double distanceBetweenWGS84(double lat1, double long1, double lat2, double long2, double *course = NULL);
+  static void distancesAndCoursesTo(double lat, double lng, const TinyGPSWaypoints &targets, double *distances, double *courses);
+  static size_t nearest(double lat, double lng, const TinyGPSWaypoints &targets, double *distance = NULL);
   static const char *cardinal(double course);
 
+  static bool isDelimiter(char c) { return c == ',' || c == '*' || c == '\r' || c == '\n' || c == '$' || (uint8_t)c == _GPS_UBX_SYNC1; }
   static int32_t parseDecimal(const char *term);
   static void parseDegrees(const char *term, RawDegrees &deg);
+  static int64_t parseNanodegrees(const char *term); // DDMM.MMMM / DDDMM.MMMM, unsigned
 
   uint32_t charsProcessed()   const { return encodedCharCount; }
   uint32_t sentencesWithFix() const { return sentencesWithFixCount; }
@@ -242,7 +341,9 @@ public:
   uint32_t passedChecksum()   const { return passedChecksumCount; }
 
 private:
-  enum {GPS_SENTENCE_GPGGA, GPS_SENTENCE_GPRMC, GPS_SENTENCE_OTHER};
+  enum {GPS_SENTENCE_GGA, GPS_SENTENCE_RMC, GPS_SENTENCE_VTG, GPS_SENTENCE_GSA,
+        GPS_SENTENCE_GSV, GPS_SENTENCE_GLL, GPS_SENTENCE_ZDA, GPS_SENTENCE_PMTK_ACK,
+        GPS_SENTENCE_OTHER};
 
   // parsing state variables
   uint8_t parity;
@@ -252,12 +353,25 @@ private:
   uint8_t curTermNumber;
   uint8_t curTermOffset;
   bool sentenceHasFix;
+  uint32_t sentenceArrival;
+
+  // UBX frame state
+  enum {UBX_IDLE, UBX_SYNC2, UBX_CLASS, UBX_ID, UBX_LENGTH1, UBX_LENGTH2, UBX_PAYLOAD, UBX_CK_A, UBX_CK_B};
+  uint8_t ubxState;
+  uint8_t ubxClass, ubxId;
+  uint16_t ubxLength, ubxOffset;
+  uint8_t ubxCkA, ubxCkB;
+  uint32_t ubxArrival;
+  uint8_t ubxPayload[_GPS_UBX_MAX_PAYLOAD];
 
   // custom element support
   friend class TinyGPSCustom;
-  TinyGPSCustom *customElts;
-  TinyGPSCustom *customCandidates;
+  TinyGPSCustomSentence customSentences[_GPS_MAX_CUSTOM_SENTENCES];
+  TinyGPSCustomSentence *customCandidates;
+  TinyGPSCustom *customOverflow;     // sorted by name and term, once customSentences is full
+  TinyGPSCustom *overflowCandidates;
   void insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int index);
+  TinyGPSCustomSentence *findCustomSentence(const char *sentenceName, bool create);
 
   // statistics
   uint32_t encodedCharCount;
@@ -267,7 +381,13 @@ private:
 
   // internal utilities
   int fromHex(char a);
+  void beginSentence();
+  static uint8_t sentenceTypeOf(const char *term);
+  bool endOfTerm(char c);
+  void appendTerm(const char *run, size_t len, uint8_t runParity);
   bool endOfTermHandler();
+  size_t ubxEncode(const char *buf, size_t len, int *frames);
+  void ubxEndOfFrame();
 };
 
 #endif // def(__TinyGPSPlus_h)
@@ -0,0 +1,524 @@
+// Transport.cpp
+// Byte stream transports for the GPS and compass links
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Transport.h"
+
+//*** local defines and typedefs **********************************************
+
+#define WRITE_TIMEOUT_MS		1000	// longest wait for room in the output queue
+#define REPLAY_CHUNK_SIZE		64		// bytes per write into the replay pipe
+#define REPLAY_POLL_MS			100		// how often a stalled replay checks for shutdown
+
+//------------------------------------------------------------------------------
+// Serial port (or the slave side of someone else's pty)
+class TtyTransport : public Transport
+{
+	public:
+		TtyTransport( int fd, const char *name ) : Transport( fd, name ) {}
+		virtual void	Flush( void );
+		virtual void	Drain( void );
+		virtual bool	SetBaud( int baud );
+};
+
+//------------------------------------------------------------------------------
+// Master side of a new pty. The slave is held open so reads don't fail with
+// EIO before whoever is playing the device has opened it.
+class PtyTransport : public TtyTransport
+{
+	public:
+		PtyTransport( int master, int slave, const char *name ) : TtyTransport( master, name ), slave_fd( slave ) {}
+		virtual ~PtyTransport()		{ close( slave_fd ); }
+		virtual bool	SetBaud( int baud )	{ return true; }
+	private:
+		int slave_fd;
+};
+
+//------------------------------------------------------------------------------
+// TCP client connection; a plain non-blocking socket needs nothing extra
+class SocketTransport : public Transport
+{
+	public:
+		SocketTransport( int fd, const char *name ) : Transport( fd, name ) {}
+};
+
+//------------------------------------------------------------------------------
+// Capture file replayed into a pipe by a thread, paced like a serial line
+class FileTransport : public Transport
+{
+	public:
+		FileTransport( int read_fd, int write_fd, int file_fd, int baud, const char *name );
+		virtual ~FileTransport();
+		virtual int		Write( const U8 *pu8Buffer, int size )	{ return size; }	// nowhere to send
+		virtual bool	SetBaud( int baud )						{ bytes_per_sec = baud / 10; return true; }
+		bool			Start( void );
+	private:
+		static void		*ReplayThread( void *ptTransport );
+		int write_fd;
+		int file_fd;
+		volatile int bytes_per_sec;
+		volatile bool bStop;
+		bool bStarted;
+		pthread_t thread;
+};
+
+//*** local function declarations *********************************************
+static bool SetNonBlocking( int fd );
+static speed_t BaudToSpeed( int baud );
+static Transport *OpenTty( const char *path, int baud );
+static Transport *OpenPty( void );
+static Transport *OpenFile( const char *path, int baud );
+static Transport *OpenTcp( const char *host_port );
+
+//*** Transport ***************************************************************
+
+Transport::Transport( int fd, const char *name ) : fd( fd )
+{
+	snprintf( szName, sizeof(szName), "%s", name );
+}
+
+//------------------------------------------------------------------------------
+Transport::~Transport()
+{
+	close( fd );
+}
+
+//------------------------------------------------------------------------------
+// Reads whatever is waiting, up to size bytes. Never blocks.
+// Returns bytes read, 0 if nothing is waiting, -1 on error or end of stream.
+int Transport::Read( U8 *pu8Buffer, int size )
+{
+	int len = read( fd, pu8Buffer, size );
+
+	if( len > 0 )
+	{
+		return len;
+	}
+
+	if( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+	{
+		return 0;
+	}
+
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+// Writes the whole buffer, waiting for room in the output queue if needed.
+// Returns bytes written or -1 on error.
+int Transport::Write( const U8 *pu8Buffer, int size )
+{
+	int written = 0;
+
+	while( written < size )
+	{
+		int len = write( fd, pu8Buffer + written, size - written );
+
+		if( len > 0 )
+		{
+			written += len;
+		}
+		else if( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+		{
+			struct pollfd tPoll = { fd, POLLOUT, 0 };
+
+			if( poll( &tPoll, 1, WRITE_TIMEOUT_MS ) <= 0 )
+			{
+				return -1;
+			}
+		}
+		else if( len < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+
+	return written;
+}
+
+//------------------------------------------------------------------------------
+int Transport::Available( void )
+{
+	int bytes = 0;
+
+	if( ioctl( fd, FIONREAD, &bytes ) < 0 )
+	{
+		return -1;
+	}
+
+	return bytes;
+}
+
+//------------------------------------------------------------------------------
+// Discards any pending input
+void Transport::Flush( void )
+{
+	U8 au8Discard[256];
+
+	while( Read( au8Discard, sizeof(au8Discard) ) > 0 )
+	{
+	}
+}
+
+//------------------------------------------------------------------------------
+// Waits until everything written has left the port
+void Transport::Drain( void )
+{
+}
+
+//------------------------------------------------------------------------------
+bool Transport::SetBaud( int baud )
+{
+	return true;
+}
+
+//*** TtyTransport ************************************************************
+
+void TtyTransport::Flush( void )
+{
+	tcflush( fd, TCIOFLUSH );
+}
+
+//------------------------------------------------------------------------------
+void TtyTransport::Drain( void )
+{
+	tcdrain( fd );
+}
+
+//------------------------------------------------------------------------------
+bool TtyTransport::SetBaud( int baud )
+{
+	struct termios tOptions;
+	speed_t speed = BaudToSpeed( baud );
+
+	if( speed == B0 || tcgetattr( fd, &tOptions ) < 0 )
+	{
+		return false;
+	}
+
+	cfsetispeed( &tOptions, speed );
+	cfsetospeed( &tOptions, speed );
+
+	return ( tcsetattr( fd, TCSADRAIN, &tOptions ) == 0 );
+}
+
+//*** FileTransport ***********************************************************
+
+FileTransport::FileTransport( int read_fd, int write_fd, int file_fd, int baud, const char *name )
+	: Transport( read_fd, name ), write_fd( write_fd ), file_fd( file_fd ),
+	  bytes_per_sec( baud / 10 ), bStop( false ), bStarted( false )
+{
+}
+
+//------------------------------------------------------------------------------
+FileTransport::~FileTransport()
+{
+	bStop = true;
+	if( bStarted )
+	{
+		pthread_join( thread, NULL );
+	}
+	if( write_fd >= 0 )
+	{
+		close( write_fd );
+	}
+	close( file_fd );
+}
+
+//------------------------------------------------------------------------------
+bool FileTransport::Start( void )
+{
+	bStarted = ( pthread_create( &thread, NULL, ReplayThread, this ) == 0 );
+	return bStarted;
+}
+
+//------------------------------------------------------------------------------
+// Copies the file into the pipe at bytes_per_sec (8N1 framing), or as fast
+// as the reader takes it if the baud is 0. Both pipe ends are non-blocking
+// so a stalled reader can't keep the destructor waiting. The write end is
+// closed at end of file so the reader sees end of stream.
+void *FileTransport::ReplayThread( void *ptTransport )
+{
+	FileTransport *ptFile = (FileTransport *)ptTransport;
+	U8 au8Chunk[REPLAY_CHUNK_SIZE];
+	int len;
+
+	while( !ptFile->bStop && ( len = read( ptFile->file_fd, au8Chunk, sizeof(au8Chunk) ) ) > 0 )
+	{
+		int written = 0;
+
+		while( written < len && !ptFile->bStop )
+		{
+			int n = write( ptFile->write_fd, au8Chunk + written, len - written );
+
+			if( n > 0 )
+			{
+				written += n;
+			}
+			else if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+			{
+				// Reader has fallen behind, wait without missing a shutdown
+				struct pollfd tPoll = { ptFile->write_fd, POLLOUT, 0 };
+				poll( &tPoll, 1, REPLAY_POLL_MS );
+			}
+			else if( n < 0 && errno != EINTR )
+			{
+				return NULL;
+			}
+		}
+
+		if( ptFile->bytes_per_sec > 0 )
+		{
+			usleep( (useconds_t)( 1000000.0 * len / ptFile->bytes_per_sec ) );
+		}
+	}
+
+	if( !ptFile->bStop )
+	{
+		close( ptFile->write_fd );
+		ptFile->write_fd = -1;
+	}
+
+	return NULL;
+}
+
+//*** local function definitions **********************************************
+
+static bool SetNonBlocking( int fd )
+{
+	int flags = fcntl( fd, F_GETFL );
+
+	return ( flags >= 0 && fcntl( fd, F_SETFL, flags | O_NONBLOCK ) == 0 );
+}
+
+//------------------------------------------------------------------------------
+static speed_t BaudToSpeed( int baud )
+{
+	switch( baud )
+	{
+		case 4800:		return B4800;
+		case 9600:		return B9600;
+		case 19200:		return B19200;
+		case 38400:		return B38400;
+		case 57600:		return B57600;
+		case 115200:	return B115200;
+		case 230400:	return B230400;
+		default:		return B0;
+	}
+}
+
+//------------------------------------------------------------------------------
+static Transport *OpenTty( const char *path, int baud )
+{
+	struct termios tOptions;
+	speed_t speed = BaudToSpeed( baud );
+	int fd;
+
+	if( speed == B0 )
+	{
+		fprintf (stderr, "Unsupported baud rate: %i\n", baud) ;
+		return NULL;
+	}
+
+	if( ( fd = open( path, O_RDWR | O_NOCTTY | O_NONBLOCK ) ) < 0 )
+	{
+		return NULL;
+	}
+
+	// Raw 8N1, no flow control
+	tcgetattr( fd, &tOptions );
+	cfmakeraw( &tOptions );
+	cfsetispeed( &tOptions, speed );
+	cfsetospeed( &tOptions, speed );
+	tOptions.c_cflag |= ( CLOCAL | CREAD );
+	tOptions.c_cflag &= ~( PARENB | CSTOPB | CSIZE | CRTSCTS );
+	tOptions.c_cflag |= CS8;
+
+	// With VMIN and VTIME both 0 an empty non-blocking tty reads as 0 bytes
+	// rather than EAGAIN, which looks like end of stream
+	tOptions.c_cc[VMIN] = 1;
+	tOptions.c_cc[VTIME] = 0;
+
+	if( tcsetattr( fd, TCSANOW, &tOptions ) < 0 )
+	{
+		close( fd );
+		return NULL;
+	}
+
+	return new TtyTransport( fd, path );
+}
+
+//------------------------------------------------------------------------------
+static Transport *OpenPty( void )
+{
+	struct termios tOptions;
+	char szSlave[TRANSPORT_MAX_NAME_LENGTH];
+	int master, slave;
+
+	if( openpty( &master, &slave, szSlave, NULL, NULL ) < 0 )
+	{
+		return NULL;
+	}
+
+	tcgetattr( slave, &tOptions );
+	cfmakeraw( &tOptions );
+	tcsetattr( slave, TCSANOW, &tOptions );
+
+	if( !SetNonBlocking( master ) )
+	{
+		close( master );
+		close( slave );
+		return NULL;
+	}
+
+	printf("Pseudo-terminal opened: %s\n", szSlave);
+
+	return new PtyTransport( master, slave, szSlave );
+}
+
+//------------------------------------------------------------------------------
+static Transport *OpenFile( const char *path, int baud )
+{
+	FileTransport *ptFile;
+	int file_fd, pipe_fd[2];
+
+	if( ( file_fd = open( path, O_RDONLY ) ) < 0 )
+	{
+		return NULL;
+	}
+
+	if( pipe( pipe_fd ) < 0 || !SetNonBlocking( pipe_fd[0] ) || !SetNonBlocking( pipe_fd[1] ) )
+	{
+		close( file_fd );
+		return NULL;
+	}
+
+	ptFile = new FileTransport( pipe_fd[0], pipe_fd[1], file_fd, baud, path );
+
+	if( !ptFile->Start() )
+	{
+		delete ptFile;
+		return NULL;
+	}
+
+	return ptFile;
+}
+
+//------------------------------------------------------------------------------
+static Transport *OpenTcp( const char *host_port )
+{
+	struct addrinfo tHints, *ptResult, *ptAddr;
+	char szHost[TRANSPORT_MAX_NAME_LENGTH];
+	const char *port = strrchr( host_port, ':' );
+	int fd = -1;
+	int one = 1;
+
+	if( port == NULL || (size_t)( port - host_port ) >= sizeof(szHost) )
+	{
+		fprintf (stderr, "TCP transport needs host:port, got %s\n", host_port) ;
+		return NULL;
+	}
+
+	memcpy( szHost, host_port, port - host_port );
+	szHost[port - host_port] = '\0';
+
+	memset( &tHints, 0, sizeof(tHints) );
+	tHints.ai_family = AF_UNSPEC;
+	tHints.ai_socktype = SOCK_STREAM;
+
+	if( getaddrinfo( szHost, port + 1, &tHints, &ptResult ) != 0 )
+	{
+		return NULL;
+	}
+
+	for( ptAddr = ptResult; ptAddr != NULL; ptAddr = ptAddr->ai_next )
+	{
+		fd = socket( ptAddr->ai_family, ptAddr->ai_socktype, ptAddr->ai_protocol );
+
+		if( fd >= 0 && connect( fd, ptAddr->ai_addr, ptAddr->ai_addrlen ) == 0 )
+		{
+			break;
+		}
+
+		if( fd >= 0 )
+		{
+			close( fd );
+			fd = -1;
+		}
+	}
+
+	freeaddrinfo( ptResult );
+
+	if( fd < 0 || !SetNonBlocking( fd ) )
+	{
+		if( fd >= 0 )
+		{
+			close( fd );
+		}
+		return NULL;
+	}
+
+	// Writes are whole frames or sentences; don't let Nagle hold the next
+	// one back waiting for an ACK, as a serial line wouldn't
+	setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+
+	return new SocketTransport( fd, host_port );
+}
+
+//*** global function definitions *********************************************
+
+//******************************************************************************
+//
+//	TRANSPORT_Open
+//
+//	Opens the transport described by spec (see Transport.h)
+//
+//	Parameters:
+//		spec - device path or "kind:argument"
+//		baud - line rate for ttys, replay rate for files
+//
+//	Returns:
+//		Transport *: the open transport, NULL on failure (errno is set)
+//
+//******************************************************************************
+Transport *TRANSPORT_Open( const char *spec, int baud )
+{
+	if( strncmp( spec, "tty:", 4 ) == 0 )
+	{
+		return OpenTty( spec + 4, baud );
+	}
+	if( strcmp( spec, "pty" ) == 0 )
+	{
+		return OpenPty();
+	}
+	if( strncmp( spec, "file:", 5 ) == 0 )
+	{
+		return OpenFile( spec + 5, baud );
+	}
+	if( strncmp( spec, "tcp:", 4 ) == 0 )
+	{
+		return OpenTcp( spec + 4 );
+	}
+
+	return OpenTty( spec, baud );
+}
@@ -0,0 +1,46 @@
+// Transport.h
+// Byte stream transports for the GPS and compass links
+//
+// The transport is picked at runtime from a spec string:
+//	/dev/ttyAMA0, tty:/dev/ttyAMA0	- serial port, raw 8N1 at the given baud
+//	pty								- new pseudo-terminal, the slave path is printed
+//	file:capture.nmea				- replays a capture, paced at the given baud
+//	tcp:host:port					- TCP client connection
+//
+// Every transport is a non-blocking file descriptor, so callers can poll()
+// GetFd() and then move data with bulk Read()/Write() calls.
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "includes.h"	// for typedef's, etc.
+
+#define TRANSPORT_MAX_NAME_LENGTH		128
+
+//------------------------------------------------------------------------------
+class Transport
+{
+	public:
+		virtual ~Transport();
+
+		virtual int		Read( U8 *pu8Buffer, int size );
+		virtual int		Write( const U8 *pu8Buffer, int size );
+		virtual int		Available( void );
+		virtual void	Flush( void );
+		virtual void	Drain( void );
+		virtual bool	SetBaud( int baud );
+
+		int				GetFd( void ) const		{ return fd; }
+		const char		*GetName( void ) const	{ return szName; }
+
+	protected:
+		Transport( int fd, const char *name );
+
+		int fd;
+		char szName[TRANSPORT_MAX_NAME_LENGTH];
+};
+
+//------------------------------------------------------------------------------
+Transport *TRANSPORT_Open( const char *spec, int baud );
+
+#endif
@@ -0,0 +1,335 @@
+// Wmm.cpp
+// Magnetic declination from the World Magnetic Model
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include "Wmm.h"
+
+//-------------------------------------------
+// Local defines
+
+#define WMM_REFERENCE_RADIUS_KM		6371.2			// of the spherical harmonics
+#define WGS84_A_KM					6378.137
+#define WGS84_E2					0.00669437999014	// first eccentricity squared
+#define WMM_POLE_LIMIT_DEG			89.999			// declination is undefined at the poles
+
+//-----------------------------------------------------------------------------
+// An angle folded into -180 to 180 degrees
+static inline float Wrap180( float d )
+{
+	return d - 360.0f * rintf( d * ( 1.0f / 360 ) );
+}
+
+//-----------------------------------------------------------------------------
+// Schmidt semi-normalized associated Legendre functions of cos(theta) and
+// their derivatives with respect to theta, by [n][m]
+static void Legendre( int nMax, double cosTheta, double sinTheta,
+					  double adP[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1],
+					  double adDP[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1] )
+{
+	double dSchmidt = 1, dSchmidtM;
+	int n, m;
+
+	adP[0][0] = 1;
+	adDP[0][0] = 0;
+
+	// Gauss normalized first, by the usual recursions
+	for( n = 1; n <= nMax; n++ )
+	{
+		for( m = 0; m <= n; m++ )
+		{
+			if( m == n )
+			{
+				adP[n][n] = sinTheta * adP[n - 1][n - 1];
+				adDP[n][n] = sinTheta * adDP[n - 1][n - 1] + cosTheta * adP[n - 1][n - 1];
+			}
+			else if( n == 1 )
+			{
+				adP[1][0] = cosTheta;
+				adDP[1][0] = -sinTheta;
+			}
+			else
+			{
+				double k = (double)( ( n - 1 ) * ( n - 1 ) - m * m ) / ( ( 2 * n - 1 ) * ( 2 * n - 3 ) );
+				double p2 = ( m <= n - 2 ) ? adP[n - 2][m] : 0;
+				double dp2 = ( m <= n - 2 ) ? adDP[n - 2][m] : 0;
+
+				adP[n][m] = cosTheta * adP[n - 1][m] - k * p2;
+				adDP[n][m] = cosTheta * adDP[n - 1][m] - sinTheta * adP[n - 1][m] - k * dp2;
+			}
+		}
+	}
+
+	// Then to Schmidt semi-normalized
+	for( n = 1; n <= nMax; n++ )
+	{
+		dSchmidt *= ( 2.0 * n - 1 ) / n;
+		dSchmidtM = dSchmidt;
+
+		for( m = 0; m <= n; m++ )
+		{
+			if( m > 0 )
+			{
+				dSchmidtM *= sqrt( ( n - m + 1.0 ) * ( ( m == 1 ) ? 2 : 1 ) / ( n + m ) );
+			}
+
+			adP[n][m] *= dSchmidtM;
+			adDP[n][m] *= dSchmidtM;
+		}
+	}
+}
+
+//*****************************************************************************
+//
+//	WMM_Load
+//
+//	Reads a model from its coefficient file: a header line with the epoch
+//	and model name, then "n m g h g-dot h-dot" lines, ended by a line of 9s
+//
+//	Parameters:
+//		path - the file, e.g. WMM.COF
+//		ptModel - filled in with the model
+//
+//	Returns:
+//		true on success
+//
+//*****************************************************************************
+bool WMM_Load( const char *path, WMM_MODEL *ptModel )
+{
+	FILE *fp = fopen( path, "r" );
+	char szLine[128];
+	int nTerms = 0;
+	bool bEnd = false;
+
+	memset( ptModel, 0, sizeof(*ptModel) );
+
+	if( fp == NULL )
+	{
+		return false;
+	}
+
+	if( fgets( szLine, sizeof(szLine), fp ) == NULL
+		|| sscanf( szLine, "%lf %31s", &ptModel->dEpoch, ptModel->szName ) != 2 )
+	{
+		fprintf (stderr, "WMM: %s is not a coefficient file\n", path) ;
+		fclose( fp );
+		return false;
+	}
+
+	while( !bEnd && fgets( szLine, sizeof(szLine), fp ) != NULL )
+	{
+		int n, m;
+		double g, h, gDot, hDot;
+
+		if( strncmp( szLine, "9999", 4 ) == 0 )
+		{
+			bEnd = true;
+		}
+		else if( sscanf( szLine, "%d %d %lf %lf %lf %lf", &n, &m, &g, &h, &gDot, &hDot ) == 6
+				 && n >= 1 && m >= 0 && m <= n )
+		{
+			if( n <= WMM_MAX_DEGREE )
+			{
+				ptModel->adG[n][m] = g;
+				ptModel->adH[n][m] = h;
+				ptModel->adGDot[n][m] = gDot;
+				ptModel->adHDot[n][m] = hDot;
+				ptModel->nMaxDegree = max( ptModel->nMaxDegree, n );
+				nTerms++;
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	fclose( fp );
+
+	if( !bEnd || nTerms == 0 )
+	{
+		fprintf (stderr, "WMM: %s is not a coefficient file\n", path) ;
+		return false;
+	}
+
+	return true;
+}
+
+//*****************************************************************************
+//
+//	WMM_Field
+//
+//	Evaluates the model: the main field at a place and time
+//
+//	Parameters:
+//		ptModel - the model
+//		lat, lon - WGS84 degrees, + north and east
+//		altKm - height above the ellipsoid, km
+//		year - decimal year
+//		adField - filled in with north, east and down, nT
+//
+//	Returns:
+//		nothing
+//
+//*****************************************************************************
+void WMM_Field( const WMM_MODEL *ptModel, double lat, double lon, double altKm, double year, double adField[3] )
+{
+	double adP[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1];
+	double adDP[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1];
+	double adCosM[WMM_MAX_DEGREE + 1], adSinM[WMM_MAX_DEGREE + 1];
+	double dt = year - ptModel->dEpoch;
+	double phi = radians( lat ), lambda = radians( lon );
+	double rc, p, z, r, phiC, ratio, ratioN;
+	double x = 0, y = 0, zc = 0, psi;
+	int n, m;
+
+	// Geodetic to geocentric spherical
+	rc = WGS84_A_KM / sqrt( 1 - WGS84_E2 * sin( phi ) * sin( phi ) );
+	p = ( rc + altKm ) * cos( phi );
+	z = ( rc * ( 1 - WGS84_E2 ) + altKm ) * sin( phi );
+	r = sqrt( p * p + z * z );
+	phiC = asin( z / r );
+
+	// Legendre functions of the colatitude
+	Legendre( ptModel->nMaxDegree, sin( phiC ), cos( phiC ), adP, adDP );
+
+	for( m = 0; m <= ptModel->nMaxDegree; m++ )
+	{
+		adCosM[m] = cos( m * lambda );
+		adSinM[m] = sin( m * lambda );
+	}
+
+	ratio = WMM_REFERENCE_RADIUS_KM / r;
+	ratioN = ratio * ratio;
+
+	for( n = 1; n <= ptModel->nMaxDegree; n++ )
+	{
+		double xn = 0, yn = 0, zn = 0;
+
+		ratioN *= ratio;	// (a/r)^(n+2)
+
+		for( m = 0; m <= n; m++ )
+		{
+			double g = ptModel->adG[n][m] + dt * ptModel->adGDot[n][m];
+			double h = ptModel->adH[n][m] + dt * ptModel->adHDot[n][m];
+			double gc = g * adCosM[m] + h * adSinM[m];
+
+			xn += gc * adDP[n][m];
+			yn += m * ( g * adSinM[m] - h * adCosM[m] ) * adP[n][m];
+			zn -= ( n + 1 ) * gc * adP[n][m];
+		}
+
+		x += ratioN * xn;
+		y += ratioN * yn;
+		zc += ratioN * zn;
+	}
+
+	y /= cos( phiC );
+
+	// Rotate from geocentric to geodetic north and down
+	psi = phiC - phi;
+	adField[0] = x * cos( psi ) - zc * sin( psi );
+	adField[1] = y;
+	adField[2] = x * sin( psi ) + zc * cos( psi );
+}
+
+//-----------------------------------------------------------------------------
+// Declination at sea level, degrees + east
+float WMM_Declination( const WMM_MODEL *ptModel, double lat, double lon, double year )
+{
+	double adField[3];
+
+	WMM_Field( ptModel, constrain( lat, -WMM_POLE_LIMIT_DEG, WMM_POLE_LIMIT_DEG ), lon, 0, year, adField );
+
+	return degrees( atan2( adField[1], adField[0] ) );
+}
+
+//*****************************************************************************
+//
+//	WMM_BuildGrid
+//
+//	Evaluates the model's declination at sea level every WMM_GRID_STEP_DEG
+//	for WMM_GridDeclination()
+//
+//	Parameters:
+//		ptModel - the model
+//		year - decimal year. Held to the model's life, as it isn't valid
+//			   outside it.
+//		ptGrid - filled in with the grid
+//
+//	Returns:
+//		the year the grid is for
+//
+//*****************************************************************************
+double WMM_BuildGrid( const WMM_MODEL *ptModel, double year, WMM_GRID *ptGrid )
+{
+	int i, j;
+
+	year = constrain( year, ptModel->dEpoch, ptModel->dEpoch + WMM_LIFE_YEARS );
+
+	for( i = 0; i < WMM_GRID_LATS; i++ )
+	{
+		for( j = 0; j < WMM_GRID_LONS; j++ )
+		{
+			ptGrid->afDeclination[i][j] = WMM_Declination( ptModel,
+				-90.0 + i * WMM_GRID_STEP_DEG, -180.0 + j * WMM_GRID_STEP_DEG, year );
+		}
+	}
+
+	ptGrid->fYear = year;
+	ptGrid->bValid = true;
+
+	return year;
+}
+
+//*****************************************************************************
+//
+//	WMM_GridDeclination
+//
+//	Looks up the declination in a grid made by WMM_BuildGrid(), by bilinear
+//	interpolation between the four grid points around the position. Near the
+//	magnetic poles, where the declination turns right round between grid
+//	points, it's meaningless.
+//
+//	Parameters:
+//		ptGrid - the grid
+//		lat, lon - degrees, + north and east
+//
+//	Returns:
+//		the declination, degrees + east
+//
+//*****************************************************************************
+float WMM_GridDeclination( const WMM_GRID *ptGrid, double lat, double lon )
+{
+	float y = ( constrain( lat, -90.0, 90.0 ) + 90 ) * ( 1.0f / WMM_GRID_STEP_DEG );
+	float x = ( lon - 360 * floor( ( lon + 180 ) / 360 ) + 180 ) * ( 1.0f / WMM_GRID_STEP_DEG );
+	int i = min( (int)y, WMM_GRID_LATS - 2 );
+	int j = min( (int)x, WMM_GRID_LONS - 2 );
+	const float *pfRow = ptGrid->afDeclination[i];
+	float fy = y - i, fx = x - j;
+	float d00 = pfRow[j];
+
+	// Relative to d00, in case they straddle +/-180
+	float d01 = Wrap180( pfRow[j + 1] - d00 );
+	float d10 = Wrap180( pfRow[j + WMM_GRID_LONS] - d00 );
+	float d11 = Wrap180( pfRow[j + WMM_GRID_LONS + 1] - d00 );
+
+	return Wrap180( d00 + fx * d01 + fy * ( d10 + fx * ( d11 - d10 - d01 ) ) );
+}
+
+//-----------------------------------------------------------------------------
+// Decimal year of a time, e.g. 2024.5 for the start of 2 July 2024
+double WMM_DecimalYear( time_t t )
+{
+	struct tm tTime;
+	int year, days;
+
+	gmtime_r( &t, &tTime );
+
+	year = tTime.tm_year + 1900;
+	days = ( ( year % 4 == 0 && year % 100 != 0 ) || year % 400 == 0 ) ? 366 : 365;
+
+	return year + ( tTime.tm_yday + ( tTime.tm_hour * 3600 + tTime.tm_min * 60 + tTime.tm_sec ) / 86400.0 ) / days;
+}
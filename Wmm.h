@@ -0,0 +1,61 @@
+// Wmm.h
+// Magnetic declination from the World Magnetic Model
+//
+// The model's spherical harmonic coefficients are read from its coefficient
+// file as NOAA publishes it (WMM.COF); none are built in, so a new model
+// every five years is a file swap. Evaluating the model takes a few
+// thousand multiply-adds, so it's done once, at start-up, for every
+// WMM_GRID_STEP_DEG of latitude and longitude. After that a declination is
+// a bilinear lookup in the grid, good to a few tenths of a degree away
+// from the magnetic poles.
+
+#ifndef WMM_H
+#define WMM_H
+
+#include <time.h>
+#include "includes.h"	// for typedef's, etc.
+
+//-------------------------------------------
+// Global defines
+
+#define WMM_MAX_DEGREE			12		// higher terms (e.g. WMMHR) are ignored
+#define WMM_LIFE_YEARS			5		// each model is valid from its epoch for this long
+#define WMM_GRID_STEP_DEG		5
+#define WMM_GRID_LATS			( 180 / WMM_GRID_STEP_DEG + 1 )		// -90 to 90
+#define WMM_GRID_LONS			( 360 / WMM_GRID_STEP_DEG + 1 )		// -180 to 180
+
+//-------------------------------------------
+// Global typedefs
+
+typedef struct
+{
+	char szName[32];			// e.g. WMM-2020
+	double dEpoch;				// decimal year
+	int nMaxDegree;
+	// Gauss coefficients, nT, and their secular variation, nT/year, by [n][m]
+	double adG[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1];
+	double adH[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1];
+	double adGDot[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1];
+	double adHDot[WMM_MAX_DEGREE + 1][WMM_MAX_DEGREE + 1];
+} WMM_MODEL;
+
+typedef struct
+{
+	float afDeclination[WMM_GRID_LATS][WMM_GRID_LONS];	// degrees, + east, at sea level
+	float fYear;				// decimal year the grid is for
+	bool bValid;
+} WMM_GRID;
+
+//-------------------------------------------
+// Function prototypes
+
+bool	WMM_Load( const char *path, WMM_MODEL *ptModel );
+void	WMM_Field( const WMM_MODEL *ptModel, double lat, double lon, double altKm, double year, double adField[3] );
+float	WMM_Declination( const WMM_MODEL *ptModel, double lat, double lon, double year );
+
+double	WMM_BuildGrid( const WMM_MODEL *ptModel, double year, WMM_GRID *ptGrid );
+float	WMM_GridDeclination( const WMM_GRID *ptGrid, double lat, double lon );
+
+double	WMM_DecimalYear( time_t t );
+
+#endif
@@ -0,0 +1,187 @@
+// bench_compass.cpp
+// HMC6343 driver timing against the compass emulator
+//
+// Starts emulators/compass_emulator, passing on any options (e.g. -d 10 -c 5
+// for dropped and corrupted reads), or uses the port it's given, such as
+// /dev/ttyUSB0 with the real compass. HMC6343_Setup() is timed, then heading
+// reads and pipelined attitude reads. The compass's own heading is compared
+// with the software one from the same attitude read, which shows its IIR
+// filter lag while the emulated boat turns.
+//
+// Usage: bench_compass [port | emulator options]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "includes.h"
+#include "config.h"
+#include "HMC6343.h"
+#include "Heading.h"
+
+#define EMULATOR_PATH		"emulators/compass_emulator"
+#define READS				50
+
+//-----------------------------------------------------------------------------
+static double NowMs( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+// Starts the emulator and reads the slave path from its first line
+static pid_t StartEmulator( char **argv, char szPort[64] )
+{
+	char *apArgs[32] = { (char *)EMULATOR_PATH, (char *)"-q" };
+	char szLine[128];
+	int aPipe[2], i;
+	pid_t pid;
+	FILE *fp;
+
+	for( i = 0; argv[i] != NULL && i < 29; i++ )
+	{
+		apArgs[i + 2] = argv[i];
+	}
+
+	if( pipe( aPipe ) < 0 || ( pid = fork() ) < 0 )
+	{
+		fprintf (stderr, "Unable to start %s: %s\n", EMULATOR_PATH, strerror (errno)) ;
+		return -1;
+	}
+
+	if( pid == 0 )
+	{
+		dup2( aPipe[1], STDOUT_FILENO );
+		close( aPipe[0] );
+		execv( EMULATOR_PATH, apArgs );
+		fprintf (stderr, "Unable to run %s: %s\n", EMULATOR_PATH, strerror (errno)) ;
+		_exit( 1 );
+	}
+
+	close( aPipe[1] );
+	fp = fdopen( aPipe[0], "r" );
+
+	if( fgets( szLine, sizeof(szLine), fp ) == NULL || sscanf( szLine, "Compass emulator on %63[^,]", szPort ) != 1 )
+	{
+		fprintf (stderr, "%s didn't start\n", EMULATOR_PATH) ;
+		kill( pid, SIGTERM );
+		waitpid( pid, NULL, 0 );
+		return -1;
+	}
+
+	fclose( fp );
+	printf("%s", szLine);
+
+	return pid;
+}
+
+//-----------------------------------------------------------------------------
+static void CompassToBoatFrame( const S16 as16Compass[3], float afBoat[3] )
+{
+	static const int aAxis[3] = { COMPASS_AXIS_FORWARD, COMPASS_AXIS_STARBOARD, COMPASS_AXIS_DOWN };
+
+	for( int i = 0; i < 3; i++ )
+	{
+		afBoat[i] = ( aAxis[i] > 0 ) ? as16Compass[aAxis[i] - 1] : -as16Compass[-aAxis[i] - 1];
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void Report( const char *name, int good, double total, double worst )
+{
+	printf("%s: %i of %i, mean %.1f ms, max %.1f ms\n", name, good, READS, good ? total / good : 0.0, worst);
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	char szPort[64];
+	pid_t pid = -1;
+	HMC6343_ATTITUDE tAttitude;
+	HMC6343_LATENCY tLatency;
+	HEADING_ATTITUDE tHeading;
+	double t0, t1, total, worst, lag = 0;
+	int good = 0, attitudes = 0, i;
+	bool bStatus;
+
+	if( argc > 1 && argv[1][0] != '-' )
+	{
+		snprintf( szPort, sizeof(szPort), "%s", argv[1] );
+	}
+	else if( ( pid = StartEmulator( argv + 1, szPort ) ) < 0 )
+	{
+		return 1;
+	}
+
+	t0 = NowMs();
+	bStatus = HMC6343_Setup( szPort );
+	printf("HMC6343_Setup: %.0f ms\n", NowMs() - t0);
+
+	for( total = worst = 0, i = 0; bStatus && i < READS; i++ )
+	{
+		S16 s16Heading, s16Pitch, s16Roll;
+
+		t0 = NowMs();
+		if( HMC6343_GetHeadingData( &s16Heading, &s16Pitch, &s16Roll ) )
+		{
+			t1 = NowMs() - t0;
+			total += t1;
+			worst = fmax( worst, t1 );
+			good++;
+		}
+	}
+	Report( "Heading reads", good, total, worst );
+
+	for( total = worst = 0, i = 0; bStatus && i < READS; i++ )
+	{
+		t0 = NowMs();
+		if( HMC6343_GetAttitude( &tAttitude ) )
+		{
+			float afAccel[3], afMag[3];
+
+			t1 = NowMs() - t0;
+			total += t1;
+			worst = fmax( worst, t1 );
+			attitudes++;
+
+			CompassToBoatFrame( tAttitude.as16Accel, afAccel );
+			CompassToBoatFrame( tAttitude.as16Mag, afMag );
+			HEADING_Compute( afAccel, afMag, &tHeading );
+			lag += fmod( tHeading.fHeading - tAttitude.s16Heading / 10.0 + 540, 360 ) - 180;
+		}
+	}
+	Report( "Attitude reads", attitudes, total, worst );
+
+	if( attitudes > 0 )
+	{
+		printf("Compass heading behind the software one by %.1f deg on average\n", lag / attitudes);
+	}
+
+	HMC6343_GetLatency( &tLatency );
+	printf("Response latency (max %.1f ms, %u timeouts):", tLatency.u32MaxUs / 1000.0, (unsigned)tLatency.u32Timeouts);
+	for( i = 0; i < HMC6343__LATENCY_BUCKETS; i++ )
+	{
+		if( tLatency.au32Count[i] )
+		{
+			printf(" %i ms: %u", i, (unsigned)tLatency.au32Count[i]);
+		}
+	}
+	printf("\n");
+
+	if( pid > 0 )
+	{
+		kill( pid, SIGTERM );
+		waitpid( pid, NULL, 0 );
+	}
+
+	// Some reads have to get through, even with faults
+	return ( good + attitudes > READS ) ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+// bench_deviation.cpp
+// Accuracy and cost of the compass deviation table
+//
+// A boat with a known deviation curve (the classic A + B sin + C cos +
+// D sin 2x + E cos 2x) sails legs on random headings, with noise on the
+// GPS course. The table built from them is compared with the curve, then
+// the lookup is timed against no correction at all.
+//
+// Usage: bench_deviation [samples]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "Deviation.h"
+
+#define DEFAULT_SAMPLES		2000
+#define COURSE_NOISE_DEG	1.0
+#define LOOKUPS				10000000
+
+static volatile float gSink;
+
+//-----------------------------------------------------------------------------
+static double NowNs( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+static double Uniform( double lo, double hi )
+{
+	return lo + ( hi - lo ) * rand() / (double)RAND_MAX;
+}
+
+//-----------------------------------------------------------------------------
+// Degrees to add to the compass at the given compass heading
+static double TrueDeviation( double heading )
+{
+	double h = heading * DEG_TO_RAD;
+
+	return 1.0 + 6.0 * sin( h ) - 4.0 * cos( h ) + 2.0 * sin( 2 * h ) + 1.5 * cos( 2 * h );
+}
+
+//-----------------------------------------------------------------------------
+// Builds a table from legs between lo and hi degrees of compass heading and
+// reports its worst error over the whole circle and over the legs' range
+static void Run( const char *name, int samples, double lo, double hi )
+{
+	DEVIATION_BUILDER tBuilder;
+	DEVIATION_TABLE tTable;
+	double maxAll = 0, maxSailed = 0, maxRaw = 0;
+	int i, measured;
+
+	DEVIATION_BuilderInit( &tBuilder );
+
+	for( i = 0; i < samples; i++ )
+	{
+		double compass = Uniform( lo, hi );
+		double course = compass + TrueDeviation( compass ) + Uniform( -COURSE_NOISE_DEG, COURSE_NOISE_DEG );
+
+		DEVIATION_AddSample( &tBuilder, fmod( compass + 360, 360 ), fmod( course + 360, 360 ) );
+	}
+
+	measured = DEVIATION_Build( &tBuilder, &tTable );
+
+	for( i = 0; i < 3600; i++ )
+	{
+		double compass = i / 10.0;
+		double error = fabs( DEVIATION_Correct( &tTable, compass ) - ( compass + TrueDeviation( compass ) ) );
+
+		maxAll = fmax( maxAll, error );
+		maxRaw = fmax( maxRaw, fabs( TrueDeviation( compass ) ) );
+
+		if( fmod( compass - lo + 720, 360 ) <= hi - lo )
+		{
+			maxSailed = fmax( maxSailed, error );
+		}
+	}
+
+	printf("%s: %i samples, %i of %i headings measured\n", name, samples, measured, DEVIATION_ENTRIES);
+	printf("  max error (deg): uncorrected %.2f  corrected %.2f  on headings sailed %.2f\n", maxRaw, maxAll, maxSailed);
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	int samples = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_SAMPLES;
+	std::vector<float> headings( 4096 );
+	DEVIATION_BUILDER tBuilder;
+	DEVIATION_TABLE tTable;
+	double t0, t1, t2;
+	float sum;
+	int i;
+
+	srand( 1 );
+
+	printf("Deviation: %i deg table, +/-%.1f deg GPS course noise\n", DEVIATION_STEP_DEG, COURSE_NOISE_DEG);
+	Run( "All headings", samples, 0, 360 );
+	Run( "Half the circle", samples / 2, -90, 90 );
+
+	// A real table to look up in
+	DEVIATION_BuilderInit( &tBuilder );
+	for( i = 0; i < samples; i++ )
+	{
+		double compass = Uniform( 0, 360 );
+		DEVIATION_AddSample( &tBuilder, compass, fmod( compass + TrueDeviation( compass ) + 360, 360 ) );
+	}
+	DEVIATION_Build( &tBuilder, &tTable );
+
+	for( i = 0; i < (int)headings.size(); i++ )
+	{
+		headings[i] = Uniform( 0, 360 );
+	}
+
+	t0 = NowNs();
+	for( sum = 0, i = 0; i < LOOKUPS; i++ )
+	{
+		sum += headings[i & 4095];
+	}
+	gSink = sum;
+	t1 = NowNs();
+	for( sum = 0, i = 0; i < LOOKUPS; i++ )
+	{
+		sum += DEVIATION_Correct( &tTable, headings[i & 4095] );
+	}
+	gSink = sum;
+	t2 = NowNs();
+
+	printf("ns/heading: uncorrected %.2f  corrected %.2f\n", ( t1 - t0 ) / LOOKUPS, ( t2 - t1 ) / LOOKUPS);
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+// bench_geodesy.cpp
+// Latency and accuracy of the spherical and WGS84 distance solutions, and
+// of the batch distance/course functions over a cached waypoint set
+//
+// Usage: bench_geodesy [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "TinyGPS++.h"
+
+#define DEFAULT_ITERATIONS	200000
+#define DMS(d, m, s)		( (d) + (m) / 60.0 + (s) / 3600.0 )
+#define WAYPOINTS			1000
+#define WAYPOINT_SPREAD_DEG	2.0
+
+typedef struct
+{
+	const char *name;
+	double lat1, lon1, lat2, lon2;
+} LEG;
+
+static const LEG atLegs[] =
+{
+	{ "20 m",		33.714740, -117.802270, 33.714900, -117.802150 },
+	{ "2 km",		33.714740, -117.802270, 33.730000, -117.790000 },
+	{ "47 km",		33.714740, -117.802270, 34.100000, -117.600000 },
+	{ "940 km",		33.714740, -117.802270, 42.000000, -120.000000 },
+};
+
+// Vincenty's reference line, Flinders Peak to Buninyong, with its published
+// distance and initial azimuth. They're given on GRS80, whose flattening
+// differs from WGS84's by far less than these tolerances.
+static const LEG tFlinders = { "Flinders Peak - Buninyong",
+	-DMS( 37, 57, 3.72030 ), DMS( 144, 25, 29.52440 ), -DMS( 37, 39, 10.15610 ), DMS( 143, 55, 35.38390 ) };
+#define FLINDERS_DISTANCE_M		54972.271
+#define FLINDERS_AZIMUTH_DEG	DMS( 306, 52, 5.37 )
+#define FLINDERS_TOLERANCE_M	0.001
+#define FLINDERS_TOLERANCE_DEG	( 0.01 / 3600 )
+
+static volatile double gSink;
+
+//-----------------------------------------------------------------------------
+static double NowNs( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+static double AngleError( double a, double b )
+{
+	return fabs( fmod( a - b + 540.0, 360.0 ) - 180.0 );
+}
+
+//-----------------------------------------------------------------------------
+// distanceBetweenWGS84() against the reference line. Returns false if it's
+// off by more than the published precision.
+static bool CheckReference( void )
+{
+	const LEG *l = &tFlinders;
+	double course, distance = TinyGPSPlus::distanceBetweenWGS84( l->lat1, l->lon1, l->lat2, l->lon2, &course );
+	double distanceError = fabs( distance - FLINDERS_DISTANCE_M );
+	double courseError = AngleError( course, FLINDERS_AZIMUTH_DEG );
+	bool bOk = distanceError <= FLINDERS_TOLERANCE_M && courseError <= FLINDERS_TOLERANCE_DEG;
+
+	printf("\n%s: %.3f m (ref %.3f), course %.6f deg (ref %.6f): %s\n", l->name,
+		distance, FLINDERS_DISTANCE_M, course, FLINDERS_AZIMUTH_DEG, bOk ? "ok" : "FAILED");
+
+	return bOk;
+}
+
+//-----------------------------------------------------------------------------
+// distancesAndCoursesTo() and nearest() against distanceBetween() and
+// courseTo() one waypoint at a time, from the first leg's start
+static void BenchWaypoints( int iterations )
+{
+	static double adDist[WAYPOINTS], adCourse[WAYPOINTS];
+	const LEG *l = &atLegs[0];
+	TinyGPSWaypoints tWaypoints;
+	double maxDist = 0, maxCourse = 0, bestDist = HUGE_VAL, t0, t1, t2, t3, t4;
+	int passes = iterations / WAYPOINTS + 1;
+	size_t best = 0, batchBest;
+	int i, pass;
+
+	srand( 1 );
+
+	for( i = 0; i < WAYPOINTS; i++ )
+	{
+		tWaypoints.add( l->lat1 + WAYPOINT_SPREAD_DEG * ( 2.0 * rand() / RAND_MAX - 1 ),
+						l->lon1 + WAYPOINT_SPREAD_DEG * ( 2.0 * rand() / RAND_MAX - 1 ) );
+	}
+
+	TinyGPSPlus::distancesAndCoursesTo( l->lat1, l->lon1, tWaypoints, adDist, adCourse );
+
+	for( i = 0; i < WAYPOINTS; i++ )
+	{
+		double d = TinyGPSPlus::distanceBetween( l->lat1, l->lon1, tWaypoints.lat( i ), tWaypoints.lng( i ) );
+		double c = TinyGPSPlus::courseTo( l->lat1, l->lon1, tWaypoints.lat( i ), tWaypoints.lng( i ) );
+
+		maxDist = fmax( maxDist, fabs( adDist[i] - d ) );
+		maxCourse = fmax( maxCourse, AngleError( adCourse[i], c ) );
+		if( d < bestDist )
+		{
+			best = i;
+			bestDist = d;
+		}
+	}
+
+	batchBest = TinyGPSPlus::nearest( l->lat1, l->lon1, tWaypoints );
+
+	t0 = NowNs();
+	for( pass = 0; pass < passes; pass++ )
+	{
+		for( i = 0; i < WAYPOINTS; i++ )
+		{
+			adDist[i] = TinyGPSPlus::distanceBetween( l->lat1 + pass * 1e-12, l->lon1, tWaypoints.lat( i ), tWaypoints.lng( i ) );
+			adCourse[i] = TinyGPSPlus::courseTo( l->lat1 + pass * 1e-12, l->lon1, tWaypoints.lat( i ), tWaypoints.lng( i ) );
+		}
+		gSink = adDist[pass % WAYPOINTS] + adCourse[pass % WAYPOINTS];
+	}
+	t1 = NowNs();
+	for( pass = 0; pass < passes; pass++ )
+	{
+		TinyGPSPlus::distancesAndCoursesTo( l->lat1 + pass * 1e-12, l->lon1, tWaypoints, adDist, adCourse );
+		gSink = adDist[pass % WAYPOINTS] + adCourse[pass % WAYPOINTS];
+	}
+	t2 = NowNs();
+	for( pass = 0; pass < passes; pass++ )
+	{
+		size_t nearest = 0;
+
+		for( i = 0; i < WAYPOINTS; i++ )
+		{
+			adDist[i] = TinyGPSPlus::distanceBetween( l->lat1 + pass * 1e-12, l->lon1, tWaypoints.lat( i ), tWaypoints.lng( i ) );
+			nearest = ( adDist[i] < adDist[nearest] ) ? i : nearest;
+		}
+		gSink = nearest;
+	}
+	t3 = NowNs();
+	for( pass = 0; pass < passes; pass++ )
+	{
+		gSink = TinyGPSPlus::nearest( l->lat1 + pass * 1e-12, l->lon1, tWaypoints );
+	}
+	t4 = NowNs();
+
+	printf("\nWaypoints: %i within %.0f deg, %i passes\n", WAYPOINTS, WAYPOINT_SPREAD_DEG, passes);
+	printf("batch vs single: max distance error %.2e m, max course error %.2e deg, nearest %s\n",
+		maxDist, maxCourse, ( batchBest == best ) ? "matches" : "DIFFERS");
+	printf("ns/waypoint: distance+course single %.1f  batch %.1f   nearest single %.1f  batch %.1f\n",
+		( t1 - t0 ) / passes / WAYPOINTS, ( t2 - t1 ) / passes / WAYPOINTS,
+		( t3 - t2 ) / passes / WAYPOINTS, ( t4 - t3 ) / passes / WAYPOINTS);
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	int iterations = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_ITERATIONS;
+	unsigned i, leg;
+
+	printf("Geodesy: %i iterations per leg\n", iterations);
+	printf("%-8s %14s %14s %12s %12s %12s\n", "leg", "sphere (m)", "wgs84 (m)", "error", "sphere ns", "wgs84 ns");
+
+	for( leg = 0; leg < sizeof(atLegs) / sizeof(atLegs[0]); leg++ )
+	{
+		const LEG *l = &atLegs[leg];
+		double sphere = TinyGPSPlus::distanceBetween( l->lat1, l->lon1, l->lat2, l->lon2 );
+		double wgs84 = TinyGPSPlus::distanceBetweenWGS84( l->lat1, l->lon1, l->lat2, l->lon2 );
+		double t0, t1, t2, course;
+
+		t0 = NowNs();
+		for( i = 0; i < (unsigned)iterations; i++ )
+		{
+			gSink = TinyGPSPlus::distanceBetween( l->lat1, l->lon1, l->lat2, l->lon2 + i * 1e-12 )
+				  + TinyGPSPlus::courseTo( l->lat1, l->lon1, l->lat2, l->lon2 + i * 1e-12 );
+		}
+		t1 = NowNs();
+		for( i = 0; i < (unsigned)iterations; i++ )
+		{
+			gSink = TinyGPSPlus::distanceBetweenWGS84( l->lat1, l->lon1, l->lat2, l->lon2 + i * 1e-12, &course ) + course;
+		}
+		t2 = NowNs();
+
+		printf("%-8s %14.3f %14.3f %11.3f%% %12.1f %12.1f\n", l->name, sphere, wgs84,
+			100.0 * ( sphere - wgs84 ) / wgs84,
+			( t1 - t0 ) / iterations, ( t2 - t1 ) / iterations );
+	}
+
+	BenchWaypoints( iterations );
+
+	return CheckReference() ? 0 : 1;
+}
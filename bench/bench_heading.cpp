@@ -0,0 +1,183 @@
+// bench_heading.cpp
+// Accuracy and throughput of the tilt compensated heading solver
+//
+// Samples are generated for random headings, with pitch and roll up to
+// +/-40 degrees and a 60 degree magnetic dip, then solved one at a time,
+// in batches, and with a libm (AN4248 style) solution for comparison.
+// HEADING_FilterUpdate() is then run on a boat rolling in a swell on a
+// steady heading, which should come out steady.
+//
+// Usage: bench_heading [samples]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "config.h"
+#include "Heading.h"
+
+#define DEFAULT_SAMPLES		100000
+#define MAX_TILT_DEG		40.0
+#define DIP_DEG				60.0
+#define ROLL_DEG			15.0
+#define ROLL_PERIOD_S		4.0
+#define ROLL_TIME_S			120
+#define ROLL_SETTLE_S		10
+
+static volatile float gSink;
+
+//-----------------------------------------------------------------------------
+static double NowNs( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+static double Uniform( double lo, double hi )
+{
+	return lo + ( hi - lo ) * rand() / (double)RAND_MAX;
+}
+
+//-----------------------------------------------------------------------------
+// World (north, east, down) vector into the body frame for the given yaw,
+// pitch and roll in radians
+static void ToBody( double yaw, double pitch, double roll, const double w[3], float b[3] )
+{
+	double cy = cos( yaw ), sy = sin( yaw ), cp = cos( pitch ), sp = sin( pitch ), cr = cos( roll ), sr = sin( roll );
+
+	b[0] = cp * cy * w[0] + cp * sy * w[1] - sp * w[2];
+	b[1] = ( sr * sp * cy - cr * sy ) * w[0] + ( sr * sp * sy + cr * cy ) * w[1] + sr * cp * w[2];
+	b[2] = ( cr * sp * cy + sr * sy ) * w[0] + ( cr * sp * sy - sr * cy ) * w[1] + cr * cp * w[2];
+}
+
+//-----------------------------------------------------------------------------
+// The usual Euler angle solution, for timing against
+static float LibmHeading( float ax, float ay, float az, float mx, float my, float mz )
+{
+	float roll = atan2f( -ay, -az );
+	float pitch = atanf( ax / ( -ay * sinf( roll ) - az * cosf( roll ) ) );
+	float h = atan2f( mz * sinf( roll ) - my * cosf( roll ),
+					  mx * cosf( pitch ) + my * sinf( pitch ) * sinf( roll ) + mz * sinf( pitch ) * cosf( roll ) );
+
+	return h * 57.2957795f;
+}
+
+//-----------------------------------------------------------------------------
+static double AngleError( double a, double b )
+{
+	double d = fmod( a - b + 540.0, 360.0 ) - 180.0;
+	return fabs( d );
+}
+
+//-----------------------------------------------------------------------------
+// Worst heading error from the filter once settled, for a boat holding yaw
+// while rolling +/-ROLL_DEG every ROLL_PERIOD_S, sampled as the compass
+// thread does
+static double RollingError( double yaw, float fGravityTau, float fHeadingTau )
+{
+	const double afUp[3] = { 0, 0, -1 };
+	const double afField[3] = { cos( DIP_DEG * DEG_TO_RAD ), 0, sin( DIP_DEG * DEG_TO_RAD ) };
+	HEADING_FILTER tFilter;
+	HEADING_ATTITUDE tAttitude;
+	double worst = 0;
+
+	HEADING_FilterInit( &tFilter, fGravityTau, fHeadingTau );
+
+	for( int i = 0; i < ROLL_TIME_S * COMPASS_SAMPLE_RATE_HZ; i++ )
+	{
+		double t = (double)i / COMPASS_SAMPLE_RATE_HZ;
+		double roll = ROLL_DEG * DEG_TO_RAD * sin( 2 * M_PI * t / ROLL_PERIOD_S );
+		float a[3], m[3];
+
+		ToBody( yaw * DEG_TO_RAD, 0, roll, afUp, a );
+		ToBody( yaw * DEG_TO_RAD, 0, roll, afField, m );
+		HEADING_FilterUpdate( &tFilter, a, m, (U32)( t * 1e6 ), &tAttitude );
+
+		if( t >= ROLL_SETTLE_S )
+		{
+			worst = fmax( worst, AngleError( tAttitude.fHeading, yaw ) );
+		}
+	}
+
+	return worst;
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	int samples = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_SAMPLES;
+	std::vector<float> ax( samples ), ay( samples ), az( samples ), mx( samples ), my( samples ), mz( samples );
+	std::vector<float> heading( samples ), pitch( samples ), roll( samples ), batch( samples );
+	std::vector<double> truth( samples * 3 );
+	const double afUp[3] = { 0, 0, -1 };
+	const double afField[3] = { cos( DIP_DEG * DEG_TO_RAD ), 0, sin( DIP_DEG * DEG_TO_RAD ) };
+	double maxHeading = 0, maxPitch = 0, maxRoll = 0, maxBatch = 0;
+	double t0, t1, t2, t3;
+	HEADING_SAMPLES tSamples = { &ax[0], &ay[0], &az[0], &mx[0], &my[0], &mz[0] };
+	int i;
+
+	srand( 1 );
+
+	for( i = 0; i < samples; i++ )
+	{
+		double yaw = Uniform( 0, 360 ), p = Uniform( -MAX_TILT_DEG, MAX_TILT_DEG ), r = Uniform( -MAX_TILT_DEG, MAX_TILT_DEG );
+		float a[3], m[3];
+
+		ToBody( yaw * DEG_TO_RAD, p * DEG_TO_RAD, r * DEG_TO_RAD, afUp, a );
+		ToBody( yaw * DEG_TO_RAD, p * DEG_TO_RAD, r * DEG_TO_RAD, afField, m );
+
+		// Accelerometer counts and an arbitrary field scale
+		ax[i] = 1024 * a[0]; ay[i] = 1024 * a[1]; az[i] = 1024 * a[2];
+		mx[i] = 500 * m[0]; my[i] = 500 * m[1]; mz[i] = 500 * m[2];
+
+		truth[3 * i] = yaw; truth[3 * i + 1] = p; truth[3 * i + 2] = r;
+	}
+
+	t0 = NowNs();
+	for( i = 0; i < samples; i++ )
+	{
+		float a[3] = { ax[i], ay[i], az[i] }, m[3] = { mx[i], my[i], mz[i] };
+		HEADING_ATTITUDE tAttitude;
+
+		HEADING_Compute( a, m, &tAttitude );
+		heading[i] = tAttitude.fHeading;
+		pitch[i] = tAttitude.fPitch;
+		roll[i] = tAttitude.fRoll;
+	}
+	t1 = NowNs();
+	HEADING_ComputeBatch( &tSamples, samples, &batch[0], NULL, NULL );
+	t2 = NowNs();
+	for( i = 0; i < samples; i++ )
+	{
+		gSink = LibmHeading( ax[i], ay[i], az[i], mx[i], my[i], mz[i] );
+	}
+	t3 = NowNs();
+
+	for( i = 0; i < samples; i++ )
+	{
+		maxHeading = fmax( maxHeading, AngleError( heading[i], truth[3 * i] ) );
+		maxPitch = fmax( maxPitch, fabs( pitch[i] - truth[3 * i + 1] ) );
+		maxRoll = fmax( maxRoll, fabs( roll[i] - truth[3 * i + 2] ) );
+		maxBatch = fmax( maxBatch, fabs( batch[i] - heading[i] ) );
+	}
+
+	printf("Heading: %i samples, tilt to +/-%.0f deg, %.0f deg dip\n", samples, MAX_TILT_DEG, DIP_DEG);
+	printf("max error (deg): heading %.5f  pitch %.5f  roll %.5f  batch vs single %.5f\n",
+		maxHeading, maxPitch, maxRoll, maxBatch);
+	printf("ns/sample: single %.1f  batch %.1f  libm euler %.1f\n",
+		( t1 - t0 ) / samples, ( t2 - t1 ) / samples, ( t3 - t2 ) / samples);
+
+	printf("Filter: rolling +/-%.0f deg every %.0f s at %i Hz, gravity tau %.1f s, heading tau %.1f s\n",
+		ROLL_DEG, ROLL_PERIOD_S, COMPASS_SAMPLE_RATE_HZ, HEADING_GRAVITY_TAU_S, HEADING_TAU_S);
+	for( i = 0; i < 360; i += 45 )
+	{
+		printf("  heading %3i: max error (deg) unfiltered %.2f  filtered %.2f\n",
+			i, RollingError( i, 0, 0 ), RollingError( i, HEADING_GRAVITY_TAU_S, HEADING_TAU_S ));
+	}
+
+	return 0;
+}
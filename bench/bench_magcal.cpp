@@ -0,0 +1,148 @@
+// bench_magcal.cpp
+// Accuracy and cost of the magnetometer calibration fit
+//
+// A lap is generated with known hard and soft iron, sensor noise and either
+// rolling and pitching (a full 3D fit) or near-level (a planar fit). The
+// lap is fed to MAGCAL_AddSample(), then the headings of a second lap are
+// solved raw and corrected and compared with the truth.
+//
+// Usage: bench_magcal [samples per lap]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "MagCal.h"
+#include "Heading.h"
+
+#define DEFAULT_SAMPLES		600
+#define DIP_DEG				60.0
+#define FIELD_COUNTS		500.0
+#define NOISE_COUNTS		2.0
+#define FIT_RUNS			1000
+
+static const double gadHardIron[3] = { 80, -120, 60 };
+static const double gadSoftIron[3][3] = { { 1.15, 0.08, 0.02 }, { 0.08, 0.90, -0.05 }, { 0.02, -0.05, 1.00 } };
+
+static MAGCAL gtCal;
+
+//-----------------------------------------------------------------------------
+static double NowNs( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+static double Uniform( double lo, double hi )
+{
+	return lo + ( hi - lo ) * rand() / (double)RAND_MAX;
+}
+
+//-----------------------------------------------------------------------------
+// World (north, east, down) vector into the body frame for the given yaw,
+// pitch and roll in radians
+static void ToBody( double yaw, double pitch, double roll, const double w[3], double b[3] )
+{
+	double cy = cos( yaw ), sy = sin( yaw ), cp = cos( pitch ), sp = sin( pitch ), cr = cos( roll ), sr = sin( roll );
+
+	b[0] = cp * cy * w[0] + cp * sy * w[1] - sp * w[2];
+	b[1] = ( sr * sp * cy - cr * sy ) * w[0] + ( sr * sp * sy + cr * cy ) * w[1] + sr * cp * w[2];
+	b[2] = ( cr * sp * cy + sr * sy ) * w[0] + ( cr * sp * sy - sr * cy ) * w[1] + cr * cp * w[2];
+}
+
+//-----------------------------------------------------------------------------
+// What the sensors read at the given attitude, in degrees
+static void Sample( double yaw, double pitch, double roll, float afAccel[3], float afMag[3] )
+{
+	const double adUp[3] = { 0, 0, -1 };
+	const double adField[3] = { FIELD_COUNTS * cos( DIP_DEG * DEG_TO_RAD ), 0, FIELD_COUNTS * sin( DIP_DEG * DEG_TO_RAD ) };
+	double adA[3], adB[3];
+	int i, j;
+
+	ToBody( yaw * DEG_TO_RAD, pitch * DEG_TO_RAD, roll * DEG_TO_RAD, adUp, adA );
+	ToBody( yaw * DEG_TO_RAD, pitch * DEG_TO_RAD, roll * DEG_TO_RAD, adField, adB );
+
+	for( i = 0; i < 3; i++ )
+	{
+		afAccel[i] = 1024 * adA[i];
+		afMag[i] = gadHardIron[i] + Uniform( -NOISE_COUNTS, NOISE_COUNTS );
+
+		for( j = 0; j < 3; j++ )
+		{
+			afMag[i] += gadSoftIron[i][j] * adB[j];
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+static double AngleError( double a, double b )
+{
+	double d = fmod( a - b + 540.0, 360.0 ) - 180.0;
+	return fabs( d );
+}
+
+//-----------------------------------------------------------------------------
+static void Lap( const char *name, int samples, double tilt )
+{
+	MAGCAL_RESULT tResult;
+	double maxRaw = 0, maxCal = 0;
+	double t0, t1, t2;
+	int i;
+
+	MAGCAL_Init( &gtCal );
+
+	t0 = NowNs();
+	for( i = 0; i < samples; i++ )
+	{
+		float a[3], m[3];
+
+		Sample( 360.0 * i / samples, tilt * sin( i * 0.37 ), tilt * cos( i * 0.23 ), a, m );
+		MAGCAL_AddSample( &gtCal, m );
+	}
+	t1 = NowNs();
+	for( i = 0; i < FIT_RUNS; i++ )
+	{
+		MAGCAL_Fit( &gtCal, &tResult );
+	}
+	t2 = NowNs();
+
+	for( i = 0; i < 360; i++ )
+	{
+		float a[3], m[3];
+		HEADING_ATTITUDE tAttitude;
+
+		Sample( i, tilt / 2, -tilt / 2, a, m );
+
+		HEADING_Compute( a, m, &tAttitude );
+		maxRaw = fmax( maxRaw, AngleError( tAttitude.fHeading, i ) );
+
+		MAGCAL_Apply( &tResult, m, m );
+		HEADING_Compute( a, m, &tAttitude );
+		maxCal = fmax( maxCal, AngleError( tAttitude.fHeading, i ) );
+	}
+
+	printf("%s lap, tilt to +/-%.0f deg: %s%s fit from %lu of %i samples\n", name, tilt,
+		tResult.bValid ? "valid" : "no", tResult.bPlanar ? " planar" : "", (unsigned long)tResult.u32Samples, samples);
+	printf("  offset %.1f %.1f %.1f (true %.0f %.0f %.0f)  residual %.2f%%  coverage %.0f%%\n",
+		tResult.afOffset[0], tResult.afOffset[1], tResult.afOffset[2],
+		gadHardIron[0], gadHardIron[1], gadHardIron[2], tResult.fResidual * 100, tResult.fCoverage * 100);
+	printf("  max heading error (deg): raw %.2f  calibrated %.2f\n", maxRaw, maxCal);
+	printf("  ns/sample added %.1f  us/fit %.1f\n", ( t1 - t0 ) / samples, ( t2 - t1 ) / FIT_RUNS / 1000);
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	int samples = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_SAMPLES;
+
+	srand( 1 );
+
+	printf("Mag cal: %.0f deg dip, +/-%.0f counts noise on a %.0f count field\n", DIP_DEG, NOISE_COUNTS, FIELD_COUNTS);
+	Lap( "Rolling", samples, 30 );
+	Lap( "Level", samples, 2 );
+
+	return 0;
+}
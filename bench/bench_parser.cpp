@@ -0,0 +1,199 @@
+// bench_parser.cpp
+// Throughput of TinyGPSPlus over recorded NMEA and UBX corpora
+//
+// Each corpus is loaded into memory and replayed through the parser
+// "repeat" times with each of the encode() entry points:
+//	byte	- encode(char) per byte, as THREAD_UpdateGps used to
+//	read	- encode(buf, len) in GPS_READ_BUFFER_SIZE blocks, as THREAD_UpdateGps does now
+//	whole	- encode(buf, len) over the whole corpus in one call
+//
+// Usage: bench_parser [repeat] [corpus.nmea ...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+
+#include "TinyGPS++.h"
+
+#define DEFAULT_REPEAT			20
+#define BENCH_READ_SIZE			256
+
+static const char *aszDefaultCorpora[] =
+{
+	"bench/corpus/rmc_gga.nmea",		// 10 Hz GPRMC + GPGGA
+	"bench/corpus/multi_gnss.nmea",		// GN/GL/GA with GSA, GSV and VTG
+	"bench/corpus/corrupted.nmea",		// bad checksums, truncated sentences, line noise
+	"bench/corpus/proprietary.nmea",	// long PUBX and PMTK sentences
+	"bench/corpus/ubx_pvt.ubx",			// 10 Hz u-blox NAV-PVT, NAV-STATUS and RMC at 1 Hz
+};
+
+//-----------------------------------------------------------------------------
+// Allocation counting. The parser should never allocate; anything counted
+// here while a run is timed is a regression.
+
+extern "C" void *__libc_malloc( size_t size );
+extern "C" void *__libc_calloc( size_t n, size_t size );
+extern "C" void *__libc_realloc( void *ptr, size_t size );
+
+static unsigned long gAllocCount;
+
+extern "C" void *malloc( size_t size )				{ gAllocCount++; return __libc_malloc( size ); }
+extern "C" void *calloc( size_t n, size_t size )	{ gAllocCount++; return __libc_calloc( n, size ); }
+extern "C" void *realloc( void *ptr, size_t size )	{ gAllocCount++; return __libc_realloc( ptr, size ); }
+
+void *operator new( size_t size )					{ void *p = malloc( size ); if( !p ) throw std::bad_alloc(); return p; }
+void *operator new[]( size_t size )					{ void *p = malloc( size ); if( !p ) throw std::bad_alloc(); return p; }
+void operator delete( void *p ) throw()				{ free( p ); }
+void operator delete[]( void *p ) throw()			{ free( p ); }
+void operator delete( void *p, size_t ) throw()		{ free( p ); }
+void operator delete[]( void *p, size_t ) throw()	{ free( p ); }
+
+//-----------------------------------------------------------------------------
+typedef enum
+{
+	E_MODE_BYTE,
+	E_MODE_READ,
+	E_MODE_WHOLE,
+
+	E_MODE_MAX
+} E_MODE;
+
+static const char *aszModeName[E_MODE_MAX] = { "byte", "read", "whole" };
+
+//-----------------------------------------------------------------------------
+static double NowNs( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+static char *LoadCorpus( const char *path, size_t *pSize )
+{
+	FILE *fp = fopen( path, "rb" );
+	char *data;
+	long size;
+
+	if( fp == NULL )
+	{
+		return NULL;
+	}
+
+	fseek( fp, 0, SEEK_END );
+	size = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	data = (char *)malloc( size );
+	if( data != NULL && fread( data, 1, size, fp ) != (size_t)size )
+	{
+		free( data );
+		data = NULL;
+	}
+	fclose( fp );
+
+	*pSize = size;
+	return data;
+}
+
+//-----------------------------------------------------------------------------
+static void RunCorpus( const char *path, const char *data, size_t size, int repeat, E_MODE eMode )
+{
+	TinyGPSPlus gps;
+	TinyGPSCustom pubxTime( gps, "PUBX", 2 );
+	TinyGPSCustom pubxSats( gps, "PUBX", 18 );
+	TinyGPSCustom pmtkCmd( gps, "PMTK001", 1 );
+	TinyGPSCustom pmtkFlag( gps, "PMTK001", 2 );
+	unsigned long allocs;
+	double t0, t1, seconds, bytes, sentences;
+	size_t i;
+	int r;
+
+	allocs = gAllocCount;
+	t0 = NowNs();
+
+	for( r = 0; r < repeat; r++ )
+	{
+		switch( eMode )
+		{
+		case E_MODE_BYTE:
+			for( i = 0; i < size; i++ )
+			{
+				gps.encode( data[i] );
+			}
+			break;
+		case E_MODE_READ:
+			for( i = 0; i < size; i += BENCH_READ_SIZE )
+			{
+				gps.encode( data + i, min( (size_t)BENCH_READ_SIZE, size - i ) );
+			}
+			break;
+		case E_MODE_WHOLE:
+			gps.encode( data, size );
+			break;
+		default:
+			break;
+		}
+	}
+
+	t1 = NowNs();
+	allocs = gAllocCount - allocs;
+
+	seconds = ( t1 - t0 ) / 1e9;
+	bytes = (double)size * repeat;
+	sentences = (double)gps.passedChecksum() + gps.failedChecksum();
+
+	printf("%-32s %-6s %8.1f MB/s %10.0f sent/s %8.1f ns/sent %6.1f%% ok %4lu allocs\n",
+		path, aszModeName[eMode],
+		bytes / seconds / 1e6,
+		sentences / seconds,
+		( sentences > 0 ) ? ( t1 - t0 ) / sentences : 0.0,
+		( sentences > 0 ) ? 100.0 * gps.passedChecksum() / sentences : 0.0,
+		allocs );
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	int repeat = ( argc > 1 ) ? atoi( argv[1] ) : DEFAULT_REPEAT;
+	const char **aszCorpora = aszDefaultCorpora;
+	int num_corpora = sizeof(aszDefaultCorpora) / sizeof(aszDefaultCorpora[0]);
+	int c, m;
+
+	if( argc > 2 )
+	{
+		aszCorpora = (const char **)&argv[2];
+		num_corpora = argc - 2;
+	}
+
+	if( repeat <= 0 )
+	{
+		repeat = DEFAULT_REPEAT;
+	}
+
+	printf("Parser: TinyGPS++ %s, %s scan kernel, %i passes per corpus\n",
+		TinyGPSPlus::libraryVersion(), TinyGPSPlus::scanKernelName(), repeat);
+
+	for( c = 0; c < num_corpora; c++ )
+	{
+		size_t size;
+		char *data = LoadCorpus( aszCorpora[c], &size );
+
+		if( data == NULL )
+		{
+			fprintf(stderr, "Unable to load %s\n", aszCorpora[c]);
+			return 1;
+		}
+
+		for( m = 0; m < E_MODE_MAX; m++ )
+		{
+			RunCorpus( aszCorpora[c], data, size, repeat, (E_MODE)m );
+		}
+
+		free( data );
+	}
+
+	return 0;
+}
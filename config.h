@@ -9,6 +9,13 @@
 //#define MAG_VAR              7    // Florida
 #define MAG_VAR                -13    // California
 
+// Work out the declination at the current fix from the World Magnetic Model
+// instead of using MAG_VAR. Needs the model's coefficient file (WMM.COF, as
+// published by NOAA NCEI); MAG_VAR is used until there's a fix, or if the
+// file can't be read.
+#define USE_WMM_DECLINATION		1
+#define WMM_FILE				"WMM.COF"
+
 // ********************
 // *** GPS Settings ***
 // ********************
@@ -67,13 +74,68 @@
 // Set this to the maximum distance to a waypoint before we switch to the next waypoint
 #define SWITCH_WAYPOINT_DISTANCE        2.0
 
+// Legs up to this long (meters) are navigated in a flat East-North-Up frame
+// centered on the target. Longer legs use the great-circle calculations.
+#define NAV_FRAME_MAX_LEG_DISTANCE      2000.0
+
+// Set this to 1 to solve long legs on the WGS84 ellipsoid (Vincenty, sub-mm)
+// instead of the sphere (~0.5% error). See "make bench" for the cost of each.
+#define USE_WGS84_GEODESY               0
+
 #define PRINT_MSGS            			0
 
 // "Pi Plate" LCD -------------------
 #define USE_PI_PLATE					1	// LCD and Button board
 
 // COMPASS --------------------------
-
+// Sample the compass on its own thread at its measurement rate (OP_MODE_2)
+// so loop() only picks up the latest reading and never waits on the bus
+#define USE_COMPASS_THREAD		1
+#define COMPASS_SAMPLE_RATE_HZ	10
+
+// Work out the heading from the raw accel and mag readings instead of using
+// the compass's own (heavily filtered) one. Needs USE_COMPASS_THREAD.
+// Gravity and the magnetic field are both smoothed over HEADING_GRAVITY_TAU_S
+// to average out wave motion; the heading itself gets HEADING_TAU_S on top
+// (0 for none).
+#define USE_SOFTWARE_HEADING	1
+#define HEADING_GRAVITY_TAU_S	1.0
+#define HEADING_TAU_S			0.2
+
+// Compass axes (1 = X, 2 = Y, 3 = Z, negative if reversed) pointing forward,
+// to starboard and down. Mounted upright flat front: Z forward, -X up.
+#define COMPASS_AXIS_FORWARD	3
+#define COMPASS_AXIS_STARBOARD	-2
+#define COMPASS_AXIS_DOWN		1
+
+// Magnetometer calibration: run with -C and turn a slow full circle. It's
+// done once the fit covers MAGCAL_MIN_COVERAGE of the headings and the
+// corrected field strength is steady to MAGCAL_MAX_RESIDUAL (RMS, as a
+// fraction), then saved to MAGCAL_FILE and loaded at every start. Needs
+// USE_COMPASS_THREAD; the software heading uses the full hard and soft iron
+// correction.
+#define MAGCAL_FILE				"magcal.txt"
+#define MAGCAL_MIN_SAMPLES		100
+#define MAGCAL_MIN_COVERAGE		0.9
+#define MAGCAL_MAX_RESIDUAL		0.05
+
+// Also write the hard iron offsets to the compass's EEPROM, for its own
+// heading (USE_SOFTWARE_HEADING 0). It takes offsets only, no soft iron,
+// and applies them to the magnetometer readings the software heading uses.
+// The fit is added to the offsets already there.
+#define MAGCAL_WRITE_EEPROM		0
+
+// Correct the compass for the boat's own deviation (motor, battery) from a
+// table in DEVIATION_FILE. Run with -D to build one: drive straight legs on
+// as many headings as possible in calm water. Samples are taken above
+// DEVIATION_MIN_MPH while the GPS course changes less than
+// DEVIATION_MAX_TURN_DEG between fixes, and the table is saved every
+// DEVIATION_SAVE_SAMPLES.
+#define USE_DEVIATION_TABLE		1
+#define DEVIATION_FILE			"deviation.txt"
+#define DEVIATION_MIN_MPH		3.0
+#define DEVIATION_MAX_TURN_DEG	2.0
+#define DEVIATION_SAVE_SAMPLES	50
 
 // GPS ------------------------------
 #define USE_GPS_TIME_INFO     0
@@ -86,12 +148,24 @@
 #if USE_ULTIMATE_GPS
 #define GPS_BAUD			9600
 #define GPS_FIX_PIN			1
+// MTK3339: negotiate baud, fix rate and sentences with PMTK commands at startup
+#define USE_GPS_NEGOTIATION	1
+#define GPS_TARGET_BAUD		115200
+#define GPS_FIX_RATE_HZ		10
 #else
 #define GPS_BAUD			4800
+#define USE_GPS_NEGOTIATION	0
 #endif
 
 #define GPS_SERIAL_PORT		"/dev/ttyAMA0"
 
+// Project each fix forward from when it arrived to when it's used, along
+// the course over ground. Capped so a stale fix isn't carried too far, and
+// skipped when slow since the GPS course is noise at low speed
+#define USE_GPS_EXTRAPOLATION		1
+#define GPS_MAX_EXTRAPOLATION_S		2.0
+#define GPS_MIN_EXTRAPOLATION_MPH	1.0
+
 // Arduino ---------------------------
 #define USE_ARDUINO		0
 #define ARDUINO_I2C_ADDR	(0x04)
@@ -0,0 +1,930 @@
+// compass_emulator.cpp
+// Pseudo-terminal stand-in for the SC18IM700 bridge and HMC6343 compass
+//
+// Usage: compass_emulator [-t deg/s] [-i x,y,z] [-l ms] [-d percent] [-c percent] [-s seed] [-q | -v]
+//	-t	turn rate (default 6, a circle a minute)
+//	-i	hard iron in chip axes, magnetometer counts (default none)
+//	-l	extra milliseconds every command keeps the compass busy
+//	-d	percent of reads the compass doesn't acknowledge
+//	-c	percent of reads with a corrupted byte
+//	-s	seed for the faults (default 1)
+//	-q	print nothing after the slave path line
+//	-v	print every frame
+//
+// Prints the slave path to run gpsboat against (-c /dev/pts/N). The boat
+// turns steadily while pitching and rolling a little, in a 60 degree dip
+// field, with the compass mounted upright flat front (as config.h's
+// COMPASS_AXIS_* have it).
+//
+// The bridge takes 'S' <address> <count> [data] 'P' I2C frames, with 'S'
+// again for a repeated start, and 'R'/'W' for its own registers. Its baud
+// rate follows BRG0/BRG1, 9600 at power on. Bytes take their character
+// time each way, and the I2C bus runs at 100 kHz. The count byte is taken
+// at its word, so the 'P' behind one of the driver's write frames, whose
+// count is one more than its data, goes to the compass as an extra data
+// byte. The compass ignores bytes past its command's arguments and the
+// next 'S' is a repeated start, which is how the real pair get on.
+//
+// The compass has the EEPROM map from HMC6343.h with the factory defaults,
+// loaded at reset, and the data sheet's command times: 1 ms for data, 10
+// ms for EEPROM, 500 ms for a reset. While it's busy or asleep it doesn't
+// acknowledge its address, so a read sent too soon gets nothing back and
+// I2CStat says why. It measures at the OP_MODE_2 rate; reads in between
+// get the last measurement. Hard iron offsets, deviation and variation
+// are applied, the orientation commands change the axes the heading is
+// worked out in, and calibration mode centres the offsets on the field
+// seen while it's on. The heading IIR filter is modelled as a first order
+// filter taking 1 / (Filter + 1) of each measurement.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+
+#include "includes.h"
+#include "Heading.h"
+
+//*** local defines and typedefs **********************************************
+
+#define DEFAULT_TURN_RATE		6.0			// degrees per second
+#define START_HEADING_DEG		0.0
+#define PITCH_DEG				5.0
+#define PITCH_PERIOD_S			5.0
+#define ROLL_DEG				10.0
+#define ROLL_PERIOD_S			8.0
+#define DIP_DEG					60.0
+#define FIELD_COUNTS			500.0
+#define GRAVITY_COUNTS			1024.0
+#define TEMPERATURE_TENTHS		250
+
+// SC18IM700
+#define BRIDGE_CLOCK_HZ			7372800
+#define BRIDGE_REGISTERS		11
+#define BRG0_REG				0x00
+#define BRG1_REG				0x01
+#define I2CSTAT_REG				0x0A
+#define I2C_OK					0xF0
+#define I2C_NACK_ON_ADDRESS		0xF1
+#define I2C_BYTE_US				90			// 9 bits at 100 kHz
+#define MAX_FRAME_DATA			256
+#define MAX_OUTPUT				1024
+
+// HMC6343
+#define COMPASS_ADDRESS			0x32
+#define EEPROM_SIZE				0x16
+#define EEPROM_SLAVE_ADDRESS	0x00
+#define EEPROM_OP_MODE_1		0x04
+#define EEPROM_OP_MODE_2		0x05
+#define EEPROM_DEVIATION		0x0A
+#define EEPROM_VARIATION		0x0C
+#define EEPROM_OFFSETS			0x0E
+#define EEPROM_FILTER			0x14
+#define OP_MODE_1_CAL			0x40
+#define OP_MODE_1_FILTER		0x20
+#define OP_MODE_1_RUN			0x10
+#define OP_MODE_1_STDBY			0x08
+#define OP_MODE_1_ORIENT		0x07
+#define OP_MODE_1_WRITABLE		0x3F
+#define ORIENT_LEVEL			0x01
+#define ORIENT_EDGE				0x02
+#define ORIENT_FRONT			0x04
+#define MAX_RESPONSE			6
+#define MAX_CATCH_UP			100			// measurements worked through after a quiet spell
+
+typedef struct
+{
+	U8		u8Cmd;
+	int		args;
+	int		responseBytes;
+	int		latencyMs;
+	const char *szName;
+} COMMAND;
+
+static const COMMAND gatCommands[] =
+{
+	{ 0x40, 0, 6, 1,	"post accel" },
+	{ 0x45, 0, 6, 1,	"post mag" },
+	{ 0x50, 0, 6, 1,	"post heading" },
+	{ 0x55, 0, 6, 1,	"post tilt" },
+	{ 0x65, 0, 1, 1,	"post OP mode 1" },
+	{ 0x71, 0, 0, 1,	"enter calibration" },
+	{ 0x72, 0, 0, 1,	"level orientation" },
+	{ 0x73, 0, 0, 1,	"upright sideways orientation" },
+	{ 0x74, 0, 0, 1,	"upright flat front orientation" },
+	{ 0x75, 0, 0, 1,	"run" },
+	{ 0x76, 0, 0, 1,	"standby" },
+	{ 0x7E, 0, 0, 50,	"exit calibration" },
+	{ 0x82, 0, 0, 500,	"reset" },
+	{ 0x83, 0, 0, 1,	"sleep" },
+	{ 0x84, 0, 0, 20,	"wake" },
+	{ 0xE1, 1, 1, 10,	"read EEPROM" },
+	{ 0xF1, 2, 0, 10,	"write EEPROM" }
+};
+
+// Where the boat's forward, starboard and down axes are in the chip's, by
+// orientation, as config.h's COMPASS_AXIS_* (1 = X, -2 = -Y, ...)
+static const int gaaOrientAxes[3][3] =
+{
+	{ 1, -2, -3 },		// level, X forward, Z up
+	{ 1, 3, -2 },		// upright sideways, X forward, Y up
+	{ 3, -2, 1 }		// upright flat front, Z forward, -X up
+};
+#define MOUNTING				2			// upright flat front
+
+typedef struct
+{
+	U8		au8Eeprom[EEPROM_SIZE];
+	U8		u8Address;
+	U8		u8OpMode1;
+	int		rateHz;
+	S16		as16Offsets[3];
+	float	fHeadingOffset;			// deviation plus variation, degrees
+	long long busyUntil;
+	long long nextMeasure;
+	bool	bAsleep;
+
+	// Latest measurement
+	S16		as16Accel[3];
+	S16		as16Mag[3];
+	S16		s16Heading, s16Pitch, s16Roll;
+	float	fNorth, fEast;			// filtered heading, as a unit vector
+	bool	bPrimed;
+
+	// Calibration mode, raw field extremes
+	double	adCalMin[3], adCalMax[3];
+
+	U8		au8Response[MAX_RESPONSE];
+	int		responseLen;
+} COMPASS;
+
+enum { BRIDGE_IDLE, BRIDGE_ADDRESS, BRIDGE_COUNT, BRIDGE_DATA, BRIDGE_REG_READ, BRIDGE_REG_WRITE };
+
+typedef struct
+{
+	int		state;
+	U8		u8Address;
+	int		count;
+	int		received;
+	U8		au8Data[MAX_FRAME_DATA];
+} FRAME;
+
+typedef struct
+{
+	U8		u8Data;
+	long long due;
+} OUTPUT_BYTE;
+
+//*** local data **************************************************************
+
+static int gMaster;
+static bool gbQuiet = false;
+static bool gbVerbose = false;
+static double gTurnRate = DEFAULT_TURN_RATE;
+static double gadHardIron[3];
+static int gExtraLatencyMs = 0;
+static int gDropPercent = 0;
+static int gCorruptPercent = 0;
+static long long gStartUs;
+
+static U8 gau8Registers[BRIDGE_REGISTERS] = { 0xF0, 0x02, 0x55, 0x55, 0xFF, 0x00, 0x26, 0x13, 0x00, 0x66, I2C_OK };
+static FRAME gtFrame;
+static long long gRxFreeUs, gTxFreeUs;		// when the last byte finished each way
+
+static OUTPUT_BYTE gatOutput[MAX_OUTPUT];
+static int gOutputLen;
+
+static COMPASS gtCompass;
+
+//*** local function definitions **********************************************
+
+static long long NowMicros( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//------------------------------------------------------------------------------
+static void Log( long long t, const char *format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+static void Log( long long t, const char *format, ... )
+{
+	va_list args;
+
+	if( gbQuiet )
+	{
+		return;
+	}
+
+	printf("%9.3f ", ( t - gStartUs ) / 1000.0);
+	va_start( args, format );
+	vprintf( format, args );
+	va_end( args );
+	printf("\n");
+	fflush( stdout );
+}
+
+//------------------------------------------------------------------------------
+static bool Chance( int percent )
+{
+	return percent > 0 && rand() % 100 < percent;
+}
+
+//------------------------------------------------------------------------------
+static int BridgeBaud( void )
+{
+	return BRIDGE_CLOCK_HZ / ( 16 + ( gau8Registers[BRG1_REG] << 8 | gau8Registers[BRG0_REG] ) );
+}
+
+static long long CharMicros( void )
+{
+	return 10000000LL / BridgeBaud();
+}
+
+//------------------------------------------------------------------------------
+static const struct { speed_t speed; int baud; } gatBauds[] =
+{
+	{ B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+	{ B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 }
+};
+
+static int SpeedToBaud( speed_t speed )
+{
+	for( size_t i = 0; i < sizeof(gatBauds) / sizeof(gatBauds[0]); i++ )
+	{
+		if( gatBauds[i].speed == speed )
+		{
+			return gatBauds[i].baud;
+		}
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// True while the host has the port within 2% of the bridge's baud rate
+static bool LineInSync( void )
+{
+	struct termios tOptions;
+	int baud = BridgeBaud();
+
+	return ( tcgetattr( gMaster, &tOptions ) == 0 && abs( SpeedToBaud( cfgetospeed( &tOptions ) ) - baud ) * 50 <= baud );
+}
+
+//------------------------------------------------------------------------------
+// Queues a byte to go out once the line is free and it's ready
+static void Output( U8 u8Data, long long ready )
+{
+	gTxFreeUs = max( gTxFreeUs, ready ) + CharMicros();
+
+	if( gOutputLen < MAX_OUTPUT )
+	{
+		gatOutput[gOutputLen].u8Data = u8Data;
+		gatOutput[gOutputLen].due = gTxFreeUs;
+		gOutputLen++;
+	}
+}
+
+//------------------------------------------------------------------------------
+// Writes the queued bytes that are due. Bytes the host has no room for are
+// lost, as they would be on a real line.
+static void SendDue( long long now )
+{
+	U8 au8Buffer[MAX_OUTPUT];
+	int n = 0, i;
+
+	while( n < gOutputLen && gatOutput[n].due <= now )
+	{
+		au8Buffer[n] = gatOutput[n].u8Data;
+		n++;
+	}
+
+	if( n == 0 )
+	{
+		return;
+	}
+
+	if( !LineInSync() )
+	{
+		for( i = 0; i < n; i++ )
+		{
+			au8Buffer[i] ^= (U8)( 0x55 | rand() );
+		}
+	}
+
+	if( write( gMaster, au8Buffer, n ) < 0 && errno != EAGAIN )
+	{
+		perror( "write" );
+	}
+
+	gOutputLen -= n;
+	memmove( gatOutput, gatOutput + n, gOutputLen * sizeof(gatOutput[0]) );
+}
+
+//*** compass *****************************************************************
+
+//------------------------------------------------------------------------------
+// World (north, east, down) vector into the boat frame for the given yaw,
+// pitch and roll in radians
+static void ToBody( double yaw, double pitch, double roll, const double w[3], double b[3] )
+{
+	double cy = cos( yaw ), sy = sin( yaw ), cp = cos( pitch ), sp = sin( pitch ), cr = cos( roll ), sr = sin( roll );
+
+	b[0] = cp * cy * w[0] + cp * sy * w[1] - sp * w[2];
+	b[1] = ( sr * sp * cy - cr * sy ) * w[0] + ( sr * sp * sy + cr * cy ) * w[1] + sr * cp * w[2];
+	b[2] = ( cr * sp * cy + sr * sy ) * w[0] + ( cr * sp * sy - sr * cy ) * w[1] + cr * cp * w[2];
+}
+
+//------------------------------------------------------------------------------
+static int OrientIndex( U8 u8OpMode1 )
+{
+	switch( u8OpMode1 & OP_MODE_1_ORIENT )
+	{
+		case ORIENT_EDGE:	return 1;
+		case ORIENT_FRONT:	return 2;
+		default:			return 0;
+	}
+}
+
+//------------------------------------------------------------------------------
+static S16 EepromS16( int address )
+{
+	return (short)( gtCompass.au8Eeprom[address + 1] << 8 | gtCompass.au8Eeprom[address] );
+}
+
+//------------------------------------------------------------------------------
+static void FactoryDefaults( void )
+{
+	static const U8 au8Defaults[EEPROM_SIZE] =
+	{
+		COMPASS_ADDRESS, 0x00, 0x01, 0x00, 0x11, 0x01, 0x34, 0x12, 13, 20
+	};
+
+	memcpy( gtCompass.au8Eeprom, au8Defaults, sizeof(au8Defaults) );
+}
+
+//------------------------------------------------------------------------------
+// What a reset loads from EEPROM. Measurements start when it's over.
+static void LoadFromEeprom( long long ready )
+{
+	static const int aRates[4] = { 1, 5, 10, 10 };
+
+	gtCompass.u8Address = gtCompass.au8Eeprom[EEPROM_SLAVE_ADDRESS] & 0xFE;
+	gtCompass.u8OpMode1 = gtCompass.au8Eeprom[EEPROM_OP_MODE_1] & OP_MODE_1_WRITABLE;
+	gtCompass.rateHz = aRates[gtCompass.au8Eeprom[EEPROM_OP_MODE_2] & 0x03];
+
+	for( int i = 0; i < 3; i++ )
+	{
+		gtCompass.as16Offsets[i] = EepromS16( EEPROM_OFFSETS + 2 * i );
+	}
+
+	gtCompass.fHeadingOffset = ( EepromS16( EEPROM_DEVIATION ) + EepromS16( EEPROM_VARIATION ) ) / 10.0f;
+	gtCompass.bAsleep = false;
+	gtCompass.bPrimed = false;
+	gtCompass.responseLen = 0;
+	gtCompass.nextMeasure = ready;
+}
+
+//------------------------------------------------------------------------------
+// Takes a measurement of the boat at time t
+static void Measure( long long t )
+{
+	const double adUp[3] = { 0, 0, -1 };
+	const double adField[3] = { FIELD_COUNTS * cos( DIP_DEG * DEG_TO_RAD ), 0, FIELD_COUNTS * sin( DIP_DEG * DEG_TO_RAD ) };
+	const int *paMounting = gaaOrientAxes[MOUNTING];
+	const int *paAssumed = gaaOrientAxes[OrientIndex( gtCompass.u8OpMode1 )];
+	double s = ( t - gStartUs ) / 1000000.0;
+	double yaw = radians( START_HEADING_DEG + gTurnRate * s );
+	double pitch = radians( PITCH_DEG * sin( TWO_PI * s / PITCH_PERIOD_S ) );
+	double roll = radians( ROLL_DEG * sin( TWO_PI * s / ROLL_PERIOD_S ) );
+	double adAccel[3], adMag[3], adChipAccel[3], adChipMag[3];
+	float afAccel[3], afMag[3];
+	HEADING_ATTITUDE tAttitude;
+	float fGain, fHeading;
+	int i;
+
+	ToBody( yaw, pitch, roll, adUp, adAccel );
+	ToBody( yaw, pitch, roll, adField, adMag );
+
+	// Into the chip's axes as it's mounted, with the boat's iron
+	for( i = 0; i < 3; i++ )
+	{
+		int axis = abs( paMounting[i] ) - 1;
+		double sign = ( paMounting[i] > 0 ) ? 1 : -1;
+
+		adChipAccel[axis] = sign * GRAVITY_COUNTS * adAccel[i];
+		adChipMag[axis] = sign * adMag[i];
+	}
+
+	for( i = 0; i < 3; i++ )
+	{
+		adChipMag[i] += gadHardIron[i];
+
+		if( gtCompass.u8OpMode1 & OP_MODE_1_CAL )
+		{
+			gtCompass.adCalMin[i] = fmin( gtCompass.adCalMin[i], adChipMag[i] );
+			gtCompass.adCalMax[i] = fmax( gtCompass.adCalMax[i], adChipMag[i] );
+		}
+
+		gtCompass.as16Accel[i] = (S16)lround( adChipAccel[i] );
+		gtCompass.as16Mag[i] = (S16)lround( adChipMag[i] - gtCompass.as16Offsets[i] );
+	}
+
+	// Heading, pitch and roll with the axes the orientation says, right or not
+	for( i = 0; i < 3; i++ )
+	{
+		int axis = abs( paAssumed[i] ) - 1;
+		float sign = ( paAssumed[i] > 0 ) ? 1 : -1;
+
+		afAccel[i] = sign * gtCompass.as16Accel[axis];
+		afMag[i] = sign * gtCompass.as16Mag[axis];
+	}
+
+	HEADING_Compute( afAccel, afMag, &tAttitude );
+
+	fHeading = radians( tAttitude.fHeading + gtCompass.fHeadingOffset );
+	fGain = ( gtCompass.u8OpMode1 & OP_MODE_1_FILTER ) ? 1.0f / ( gtCompass.au8Eeprom[EEPROM_FILTER] + 1 ) : 1.0f;
+
+	if( !gtCompass.bPrimed )
+	{
+		fGain = 1.0f;
+		gtCompass.bPrimed = true;
+	}
+
+	gtCompass.fNorth += fGain * ( cosf( fHeading ) - gtCompass.fNorth );
+	gtCompass.fEast += fGain * ( sinf( fHeading ) - gtCompass.fEast );
+
+	fHeading = degrees( atan2f( gtCompass.fEast, gtCompass.fNorth ) );
+	gtCompass.s16Heading = (S16)lroundf( 10 * ( fHeading < 0 ? fHeading + 360 : fHeading ) ) % 3600;
+	gtCompass.s16Pitch = (S16)lroundf( 10 * tAttitude.fPitch );
+	gtCompass.s16Roll = (S16)lroundf( 10 * tAttitude.fRoll );
+}
+
+//------------------------------------------------------------------------------
+// Takes the measurements due by time t, if it's measuring
+static void Update( long long t )
+{
+	long long period = 1000000LL / gtCompass.rateHz;
+
+	if( gtCompass.bAsleep || !( gtCompass.u8OpMode1 & OP_MODE_1_RUN ) )
+	{
+		return;
+	}
+
+	if( t - gtCompass.nextMeasure > MAX_CATCH_UP * period )
+	{
+		gtCompass.nextMeasure += ( ( t - gtCompass.nextMeasure ) / period - MAX_CATCH_UP ) * period;
+	}
+
+	while( gtCompass.nextMeasure <= t )
+	{
+		Measure( gtCompass.nextMeasure );
+		gtCompass.nextMeasure += period;
+	}
+}
+
+//------------------------------------------------------------------------------
+static void PutS16( U8 *pu8Data, S16 s16Value )
+{
+	pu8Data[0] = ( s16Value >> 8 ) & 0xFF;
+	pu8Data[1] = s16Value & 0xFF;
+}
+
+//------------------------------------------------------------------------------
+static void Respond( S16 a, S16 b, S16 c )
+{
+	PutS16( &gtCompass.au8Response[0], a );
+	PutS16( &gtCompass.au8Response[2], b );
+	PutS16( &gtCompass.au8Response[4], c );
+	gtCompass.responseLen = 6;
+}
+
+//------------------------------------------------------------------------------
+static void WriteEeprom( long long t, U8 u8Address, U8 u8Data )
+{
+	bool bWritable = u8Address == EEPROM_SLAVE_ADDRESS || u8Address == EEPROM_OP_MODE_1
+					 || u8Address == EEPROM_OP_MODE_2 || ( u8Address >= EEPROM_DEVIATION && u8Address < EEPROM_SIZE );
+
+	if( !bWritable )
+	{
+		Log( t, "EEPROM 0x%02X is read only", u8Address );
+		return;
+	}
+
+	gtCompass.au8Eeprom[u8Address] = u8Data;
+	Log( t, "EEPROM 0x%02X = 0x%02X", u8Address, u8Data );
+}
+
+//------------------------------------------------------------------------------
+// Carries out a command written to the compass at time t. Bytes past its
+// arguments are ignored.
+static void Command( long long t, const U8 *pu8Data, int len )
+{
+	const COMMAND *ptCommand = NULL;
+	int i;
+
+	for( i = 0; i < (int)( sizeof(gatCommands) / sizeof(gatCommands[0]) ); i++ )
+	{
+		if( gatCommands[i].u8Cmd == pu8Data[0] )
+		{
+			ptCommand = &gatCommands[i];
+		}
+	}
+
+	if( ptCommand == NULL || len < 1 + ptCommand->args )
+	{
+		Log( t, "unknown or short command 0x%02X, %i bytes", pu8Data[0], len );
+		return;
+	}
+
+	// Asleep, it only listens for the wake command
+	if( gtCompass.bAsleep && ptCommand->u8Cmd != 0x84 )
+	{
+		Log( t, "%s ignored, asleep", ptCommand->szName );
+		return;
+	}
+
+	Update( t );
+
+	if( ptCommand->responseBytes == 0 )
+	{
+		Log( t, "%s", ptCommand->szName );
+	}
+
+	gtCompass.busyUntil = t + ( ptCommand->latencyMs + gExtraLatencyMs ) * 1000LL;
+
+	switch( ptCommand->u8Cmd )
+	{
+		case 0x40:
+			Respond( gtCompass.as16Accel[0], gtCompass.as16Accel[1], gtCompass.as16Accel[2] );
+			break;
+		case 0x45:
+			Respond( gtCompass.as16Mag[0], gtCompass.as16Mag[1], gtCompass.as16Mag[2] );
+			break;
+		case 0x50:
+			Respond( gtCompass.s16Heading, gtCompass.s16Pitch, gtCompass.s16Roll );
+			break;
+		case 0x55:
+			Respond( gtCompass.s16Pitch, gtCompass.s16Roll, TEMPERATURE_TENTHS );
+			break;
+		case 0x65:
+			gtCompass.au8Response[0] = gtCompass.u8OpMode1;
+			gtCompass.responseLen = 1;
+			break;
+
+		case 0x71:
+			for( i = 0; i < 3; i++ )
+			{
+				gtCompass.adCalMin[i] = HUGE_VAL;
+				gtCompass.adCalMax[i] = -HUGE_VAL;
+			}
+			gtCompass.u8OpMode1 |= OP_MODE_1_CAL;
+			break;
+		case 0x7E:
+			if( gtCompass.adCalMax[0] >= gtCompass.adCalMin[0] )
+			{
+				for( i = 0; i < 3; i++ )
+				{
+					S16 s16Offset = (S16)lround( ( gtCompass.adCalMin[i] + gtCompass.adCalMax[i] ) / 2 );
+
+					gtCompass.as16Offsets[i] = s16Offset;
+					gtCompass.au8Eeprom[EEPROM_OFFSETS + 2 * i] = s16Offset & 0xFF;
+					gtCompass.au8Eeprom[EEPROM_OFFSETS + 2 * i + 1] = ( s16Offset >> 8 ) & 0xFF;
+				}
+				Log( t, "offsets %i %i %i", gtCompass.as16Offsets[0], gtCompass.as16Offsets[1], gtCompass.as16Offsets[2] );
+			}
+			gtCompass.u8OpMode1 &= ~OP_MODE_1_CAL;
+			break;
+
+		case 0x72:
+		case 0x73:
+		case 0x74:
+		{
+			static const U8 au8Orient[] = { ORIENT_LEVEL, ORIENT_EDGE, ORIENT_FRONT };
+
+			gtCompass.u8OpMode1 = ( gtCompass.u8OpMode1 & ~OP_MODE_1_ORIENT ) | au8Orient[ptCommand->u8Cmd - 0x72];
+			gtCompass.bPrimed = false;
+			break;
+		}
+
+		case 0x75:
+			gtCompass.u8OpMode1 = ( gtCompass.u8OpMode1 & ~OP_MODE_1_STDBY ) | OP_MODE_1_RUN;
+			gtCompass.nextMeasure = gtCompass.busyUntil;
+			break;
+		case 0x76:
+			gtCompass.u8OpMode1 = ( gtCompass.u8OpMode1 & ~OP_MODE_1_RUN ) | OP_MODE_1_STDBY;
+			break;
+
+		case 0x82:
+			LoadFromEeprom( gtCompass.busyUntil );
+			break;
+
+		case 0x83:
+			gtCompass.bAsleep = true;
+			break;
+		case 0x84:
+			gtCompass.bAsleep = false;
+			gtCompass.u8OpMode1 = ( gtCompass.u8OpMode1 & ~OP_MODE_1_RUN ) | OP_MODE_1_STDBY;
+			break;
+
+		case 0xE1:
+			gtCompass.au8Response[0] = ( pu8Data[1] < EEPROM_SIZE ) ? gtCompass.au8Eeprom[pu8Data[1]] : 0;
+			gtCompass.responseLen = 1;
+			break;
+		case 0xF1:
+			if( pu8Data[1] < EEPROM_SIZE )
+			{
+				WriteEeprom( t, pu8Data[1], pu8Data[2] );
+			}
+			break;
+	}
+}
+
+//*** bridge ******************************************************************
+
+//------------------------------------------------------------------------------
+// I2C write of a whole frame, once its last byte is in at time t
+static void I2cWrite( long long t, U8 u8Address, const U8 *pu8Data, int len )
+{
+	long long done = t + ( 1 + len ) * I2C_BYTE_US;
+
+	if( gbVerbose )
+	{
+		char szData[3 * MAX_FRAME_DATA + 1];
+
+		for( int i = 0; i < len; i++ )
+		{
+			sprintf( szData + 3 * i, " %02X", pu8Data[i] );
+		}
+		Log( t, "W %02X:%s", u8Address, len ? szData : "" );
+	}
+
+	if( ( u8Address & 0xFE ) != gtCompass.u8Address || t < gtCompass.busyUntil )
+	{
+		gau8Registers[I2CSTAT_REG] = I2C_NACK_ON_ADDRESS;
+		Log( t, "write to %02X not acknowledged%s", u8Address, ( t < gtCompass.busyUntil ) ? ", busy" : "" );
+		return;
+	}
+
+	gau8Registers[I2CSTAT_REG] = I2C_OK;
+
+	if( len > 0 )
+	{
+		Command( done, pu8Data, len );
+	}
+}
+
+//------------------------------------------------------------------------------
+// I2C read of count bytes, starting once the count is in at time t
+static void I2cRead( long long t, U8 u8Address, int count )
+{
+	U8 au8Data[MAX_FRAME_DATA];
+	int i;
+
+	if( gbVerbose )
+	{
+		Log( t, "R %02X: %i", u8Address, count );
+	}
+
+	if( ( u8Address & 0xFE ) != gtCompass.u8Address || t < gtCompass.busyUntil || gtCompass.bAsleep || Chance( gDropPercent ) )
+	{
+		gau8Registers[I2CSTAT_REG] = I2C_NACK_ON_ADDRESS;
+		Log( t, "read from %02X not acknowledged%s", u8Address,
+			 ( t < gtCompass.busyUntil ) ? ", busy" : gtCompass.bAsleep ? ", asleep" : "" );
+		return;
+	}
+
+	gau8Registers[I2CSTAT_REG] = I2C_OK;
+
+	for( i = 0; i < count; i++ )
+	{
+		au8Data[i] = ( i < gtCompass.responseLen ) ? gtCompass.au8Response[i] : 0;
+	}
+
+	if( count > 0 && Chance( gCorruptPercent ) )
+	{
+		au8Data[rand() % count] ^= (U8)( 1 << ( rand() % 8 ) );
+		Log( t, "read from %02X corrupted", u8Address );
+	}
+
+	for( i = 0; i < count; i++ )
+	{
+		Output( au8Data[i], t + ( 2 + i ) * I2C_BYTE_US );
+	}
+}
+
+//------------------------------------------------------------------------------
+// Takes one byte from the host, received at time t
+static void HandleByte( U8 u8Byte, long long t )
+{
+	FRAME *ptFrame = &gtFrame;
+
+	switch( ptFrame->state )
+	{
+		case BRIDGE_IDLE:
+			if( u8Byte == 'S' )
+			{
+				ptFrame->state = BRIDGE_ADDRESS;
+			}
+			else if( u8Byte == 'R' || u8Byte == 'W' )
+			{
+				ptFrame->state = ( u8Byte == 'R' ) ? BRIDGE_REG_READ : BRIDGE_REG_WRITE;
+				ptFrame->received = 0;
+			}
+			else if( u8Byte != 'P' )
+			{
+				Log( t, "stray byte %02X", u8Byte );
+			}
+			break;
+
+		case BRIDGE_ADDRESS:
+			ptFrame->u8Address = u8Byte;
+			ptFrame->state = BRIDGE_COUNT;
+			break;
+
+		case BRIDGE_COUNT:
+			ptFrame->count = u8Byte;
+			ptFrame->received = 0;
+
+			if( ptFrame->u8Address & 0x01 )
+			{
+				I2cRead( t, ptFrame->u8Address, ptFrame->count );
+				ptFrame->state = BRIDGE_IDLE;
+			}
+			else if( ptFrame->count == 0 )
+			{
+				I2cWrite( t, ptFrame->u8Address, ptFrame->au8Data, 0 );
+				ptFrame->state = BRIDGE_IDLE;
+			}
+			else
+			{
+				ptFrame->state = BRIDGE_DATA;
+			}
+			break;
+
+		case BRIDGE_DATA:
+			ptFrame->au8Data[ptFrame->received++] = u8Byte;
+
+			if( ptFrame->received == ptFrame->count )
+			{
+				I2cWrite( t, ptFrame->u8Address, ptFrame->au8Data, ptFrame->count );
+				ptFrame->state = BRIDGE_IDLE;
+			}
+			break;
+
+		case BRIDGE_REG_READ:
+			if( u8Byte == 'P' )
+			{
+				ptFrame->state = BRIDGE_IDLE;
+			}
+			else
+			{
+				Output( ( u8Byte < BRIDGE_REGISTERS ) ? gau8Registers[u8Byte] : 0, t );
+			}
+			break;
+
+		case BRIDGE_REG_WRITE:
+			// Register and value pairs, so a value can be 'P'
+			if( u8Byte == 'P' && ptFrame->received % 2 == 0 )
+			{
+				ptFrame->state = BRIDGE_IDLE;
+			}
+			else if( ++ptFrame->received % 2 == 0 )
+			{
+				U8 u8Register = ptFrame->au8Data[0];
+
+				if( u8Register < BRIDGE_REGISTERS && u8Register != I2CSTAT_REG )
+				{
+					gau8Registers[u8Register] = u8Byte;
+					Log( t, "bridge register %i = 0x%02X, %i baud", u8Register, u8Byte, BridgeBaud() );
+				}
+			}
+			else
+			{
+				ptFrame->au8Data[0] = u8Byte;
+			}
+			break;
+	}
+}
+
+//------------------------------------------------------------------------------
+// Takes what the host has sent, each byte arriving a character time after
+// the one before. Nothing gets through while the line speeds differ.
+static void HandleInput( long long now )
+{
+	U8 au8Buffer[256];
+	int n, i;
+
+	n = read( gMaster, au8Buffer, sizeof(au8Buffer) );
+
+	if( n <= 0 || !LineInSync() )
+	{
+		return;
+	}
+
+	for( i = 0; i < n; i++ )
+	{
+		gRxFreeUs = max( gRxFreeUs, now ) + CharMicros();
+		HandleByte( au8Buffer[i], gRxFreeUs );
+	}
+}
+
+//------------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	char szSlave[64];
+	struct termios tOptions;
+	int slave, opt;
+	unsigned int seed = 1;
+
+	while( ( opt = getopt( argc, argv, "t:i:l:d:c:s:qv" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 't':
+				gTurnRate = atof( optarg );
+				break;
+			case 'i':
+				if( sscanf( optarg, "%lf,%lf,%lf", &gadHardIron[0], &gadHardIron[1], &gadHardIron[2] ) != 3 )
+				{
+					fprintf (stderr, "Bad hard iron: %s\n", optarg) ;
+					return 1;
+				}
+				break;
+			case 'l':
+				gExtraLatencyMs = atoi( optarg );
+				break;
+			case 'd':
+				gDropPercent = atoi( optarg );
+				break;
+			case 'c':
+				gCorruptPercent = atoi( optarg );
+				break;
+			case 's':
+				seed = strtoul( optarg, NULL, 0 );
+				break;
+			case 'q':
+				gbQuiet = true;
+				break;
+			case 'v':
+				gbVerbose = true;
+				break;
+			default:
+				fprintf (stderr, "Usage: %s [-t deg/s] [-i x,y,z] [-l ms] [-d percent] [-c percent] [-s seed] [-q | -v]\n", argv[0]) ;
+				return 1;
+		}
+	}
+
+	if( openpty( &gMaster, &slave, szSlave, NULL, NULL ) < 0 )
+	{
+		fprintf (stderr, "Unable to open pty: %s\n", strerror (errno)) ;
+		return 1;
+	}
+
+	tcgetattr( slave, &tOptions );
+	cfmakeraw( &tOptions );
+	cfsetspeed( &tOptions, B9600 );
+	tcsetattr( slave, TCSANOW, &tOptions );
+	fcntl( gMaster, F_SETFL, fcntl( gMaster, F_GETFL ) | O_NONBLOCK );
+
+	srand( seed );
+
+	// Powered up and measuring
+	gStartUs = gRxFreeUs = gTxFreeUs = NowMicros();
+	FactoryDefaults();
+	LoadFromEeprom( gStartUs );
+
+	printf("Compass emulator on %s, %i baud\n", szSlave, BridgeBaud());
+	fflush( stdout );
+
+	while( true )
+	{
+		long long now = NowMicros();
+		struct pollfd tPoll = { gMaster, POLLIN, 0 };
+		struct timespec tTimeout = { 1, 0 };
+
+		if( gOutputLen > 0 )
+		{
+			long long wait = max( gatOutput[0].due - now, 0LL );
+
+			tTimeout.tv_sec = wait / 1000000;
+			tTimeout.tv_nsec = ( wait % 1000000 ) * 1000;
+		}
+
+		if( ppoll( &tPoll, 1, &tTimeout, NULL ) > 0 )
+		{
+			HandleInput( NowMicros() );
+		}
+
+		SendDue( NowMicros() );
+	}
+
+	return 0;
+}
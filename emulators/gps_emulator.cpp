@@ -0,0 +1,450 @@
+// gps_emulator.cpp
+// Pseudo-terminal stand-in for the MTK3339 receiver (Adafruit Ultimate GPS)
+//
+// Usage: gps_emulator [-b baud] [-p lat,lon] [-n]
+//	-b	power-on baud rate (default 9600)
+//	-p	start position in degrees (default 40.0,-105.0)
+//	-n	ignore PMTK commands, like a receiver without MTK firmware
+//
+// Prints the slave path to run gpsboat against (-g /dev/pts/N). The boat
+// holds 5 knots on 045 from the start position, and the receiver starts
+// with the MTK default sentence set at 1 Hz. PMTK220, PMTK251 and PMTK314
+// are obeyed and acknowledged as the real part does (PMTK251 without ACK).
+//
+// The host's line speed is read back from the pty. While it doesn't match
+// the emulated baud, output is garbled and input ignored, as with a real
+// UART, so baud negotiation and its fallback can be exercised.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+
+#include "includes.h"
+
+//*** local defines and typedefs **********************************************
+
+#define DEFAULT_BAUD			9600
+#define DEFAULT_LAT				40.0
+#define DEFAULT_LON				-105.0
+#define BOAT_SPEED_KNOTS		5.0
+#define BOAT_COURSE_DEG			45.0
+
+#define METERS_PER_KNOT_SEC		0.51444444
+#define EARTH_RADIUS_M			6372795.0
+
+#define MAX_SENTENCE_LENGTH		160
+#define MAX_OUTPUT_LENGTH		1024
+#define MAX_COMMAND_LENGTH		128
+
+// PMTK314 fields this receiver emits, in command order
+enum { NMEA_GLL, NMEA_RMC, NMEA_VTG, NMEA_GGA, NMEA_GSA, NMEA_GSV, NMEA_MAX };
+
+#define PMTK_ACK_INVALID		0
+#define PMTK_ACK_UNSUPPORTED	1
+#define PMTK_ACK_FAILED			2
+#define PMTK_ACK_SUCCEEDED		3
+
+//*** local data **************************************************************
+
+static int gMaster;
+static int gBaud = DEFAULT_BAUD;
+static int gIntervalMs = 1000;
+static int gaOutputEvery[NMEA_MAX] = { 0, 1, 1, 1, 1, 5 };	// MTK defaults
+static bool gbIgnoreCommands = false;
+
+static char gszOutput[MAX_OUTPUT_LENGTH];
+static int gOutputLen;
+
+//*** local function declarations *********************************************
+static void HandleInput( void );
+static void Send( void );
+
+//*** local function definitions **********************************************
+
+static long long NowMicros( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//------------------------------------------------------------------------------
+static const struct { speed_t speed; int baud; } gatBauds[] =
+{
+	{ B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+	{ B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 }
+};
+
+static int SpeedToBaud( speed_t speed )
+{
+	for( size_t i = 0; i < sizeof(gatBauds) / sizeof(gatBauds[0]); i++ )
+	{
+		if( gatBauds[i].speed == speed )
+		{
+			return gatBauds[i].baud;
+		}
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+static bool BaudSupported( int baud )
+{
+	for( size_t i = 0; i < sizeof(gatBauds) / sizeof(gatBauds[0]); i++ )
+	{
+		if( gatBauds[i].baud == baud )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------------
+// True while the host has the port at the emulated baud rate
+static bool LineInSync( void )
+{
+	struct termios tOptions;
+
+	return ( tcgetattr( gMaster, &tOptions ) == 0 && SpeedToBaud( cfgetospeed( &tOptions ) ) == gBaud );
+}
+
+//------------------------------------------------------------------------------
+// Queues $body*CS\r\n for the next Send()
+static void Emit( const char *body )
+{
+	unsigned char checksum = 0;
+	const char *p;
+
+	for( p = body; *p; p++ )
+	{
+		checksum ^= (unsigned char)*p;
+	}
+
+	if( gOutputLen + MAX_SENTENCE_LENGTH < MAX_OUTPUT_LENGTH )
+	{
+		gOutputLen += sprintf( gszOutput + gOutputLen, "$%s*%02X\r\n", body, checksum );
+	}
+}
+
+//------------------------------------------------------------------------------
+// Services host input until the given time. Commands have to be picked up
+// as they arrive: the host may change its line speed soon after sending.
+// Replies are queued by the command handlers and sent from here.
+static void Idle( long long until )
+{
+	long long now;
+
+	while( ( now = NowMicros() ) < until )
+	{
+		struct pollfd tPoll = { gMaster, POLLIN, 0 };
+
+		if( poll( &tPoll, 1, (int)( ( until - now + 999 ) / 1000 ) ) > 0 )
+		{
+			HandleInput();
+
+			if( gOutputLen > 0 )
+			{
+				Send();
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// Writes the queued output and takes as long as the UART would. Bytes the
+// host has no room for are lost, as they would be on a real line.
+static void Send( void )
+{
+	char szLine[MAX_OUTPUT_LENGTH];
+	int len = gOutputLen;
+	int i;
+
+	// Take a copy, acknowledgements may be queued while this is going out
+	memcpy( szLine, gszOutput, len );
+	gOutputLen = 0;
+
+	if( !LineInSync() )
+	{
+		for( i = 0; i < len; i++ )
+		{
+			szLine[i] ^= (char)( 0x55 | rand() );
+		}
+	}
+
+	if( write( gMaster, szLine, len ) < 0 && errno != EAGAIN )
+	{
+		perror( "write" );
+	}
+
+	Idle( NowMicros() + len * 10000000LL / gBaud );
+}
+
+//------------------------------------------------------------------------------
+// NMEA DDMM.MMMM / DDDMM.MMMM with hemisphere
+static void FormatDegrees( char *buffer, double degrees, bool bLatitude )
+{
+	double magnitude = fabs( degrees );
+	int whole = (int)magnitude;
+	double minutes = ( magnitude - whole ) * 60.0;
+	char hemisphere = bLatitude ? ( degrees < 0 ? 'S' : 'N' ) : ( degrees < 0 ? 'W' : 'E' );
+
+	sprintf( buffer, bLatitude ? "%02d%07.4f,%c" : "%03d%07.4f,%c", whole, minutes, hemisphere );
+}
+
+//------------------------------------------------------------------------------
+static void EmitFix( unsigned long fix, double start_lat, double start_lon, double elapsed )
+{
+	char szBody[MAX_SENTENCE_LENGTH], szLat[20], szLon[20], szTime[32], szDate[32];
+	double distance = BOAT_SPEED_KNOTS * METERS_PER_KNOT_SEC * elapsed;
+	double lat = start_lat + degrees( distance * cos( radians( BOAT_COURSE_DEG ) ) / EARTH_RADIUS_M );
+	double lon = start_lon + degrees( distance * sin( radians( BOAT_COURSE_DEG ) ) /
+									  ( EARTH_RADIUS_M * cos( radians( lat ) ) ) );
+	struct timespec ts;
+	struct tm tUtc;
+
+	clock_gettime( CLOCK_REALTIME, &ts );
+	gmtime_r( &ts.tv_sec, &tUtc );
+	snprintf( szTime, sizeof(szTime), "%02d%02d%02d.%03ld", tUtc.tm_hour, tUtc.tm_min, tUtc.tm_sec, ts.tv_nsec / 1000000 );
+	snprintf( szDate, sizeof(szDate), "%02d%02d%02d", tUtc.tm_mday, tUtc.tm_mon + 1, tUtc.tm_year % 100 );
+	FormatDegrees( szLat, lat, true );
+	FormatDegrees( szLon, lon, false );
+
+	if( gaOutputEvery[NMEA_GGA] && fix % gaOutputEvery[NMEA_GGA] == 0 )
+	{
+		snprintf( szBody, sizeof(szBody), "GPGGA,%s,%s,%s,1,08,0.9,10.0,M,46.9,M,,", szTime, szLat, szLon );
+		Emit( szBody );
+	}
+	if( gaOutputEvery[NMEA_GSA] && fix % gaOutputEvery[NMEA_GSA] == 0 )
+	{
+		Emit( "GPGSA,A,3,01,04,07,08,11,13,17,28,,,,,1.5,0.9,1.2" );
+	}
+	if( gaOutputEvery[NMEA_GSV] && fix % gaOutputEvery[NMEA_GSV] == 0 )
+	{
+		Emit( "GPGSV,2,1,08,01,40,083,46,04,17,308,41,07,07,344,39,08,22,228,45" );
+		Emit( "GPGSV,2,2,08,11,61,045,44,13,33,120,40,17,12,270,35,28,55,190,47" );
+	}
+	if( gaOutputEvery[NMEA_RMC] && fix % gaOutputEvery[NMEA_RMC] == 0 )
+	{
+		snprintf( szBody, sizeof(szBody), "GPRMC,%s,A,%s,%s,%.2f,%.2f,%s,,,A",
+				  szTime, szLat, szLon, BOAT_SPEED_KNOTS, BOAT_COURSE_DEG, szDate );
+		Emit( szBody );
+	}
+	if( gaOutputEvery[NMEA_VTG] && fix % gaOutputEvery[NMEA_VTG] == 0 )
+	{
+		snprintf( szBody, sizeof(szBody), "GPVTG,%.2f,T,,M,%.2f,N,%.2f,K,A",
+				  BOAT_COURSE_DEG, BOAT_SPEED_KNOTS, BOAT_SPEED_KNOTS * 1.852 );
+		Emit( szBody );
+	}
+	if( gaOutputEvery[NMEA_GLL] && fix % gaOutputEvery[NMEA_GLL] == 0 )
+	{
+		snprintf( szBody, sizeof(szBody), "GPGLL,%s,%s,%s,A,A", szLat, szLon, szTime );
+		Emit( szBody );
+	}
+
+	Send();
+}
+
+//------------------------------------------------------------------------------
+static void Acknowledge( int command, int flag )
+{
+	char szBody[32];
+
+	sprintf( szBody, "PMTK001,%d,%d", command, flag );
+	Emit( szBody );
+}
+
+//------------------------------------------------------------------------------
+// Carries out one checksummed "PMTKnnn,args" command
+static void HandleCommand( const char *body )
+{
+	int command = atoi( body + 4 );
+	const char *args = strchr( body, ',' );
+	int values[19], count = 0;
+
+	while( args != NULL && count < 19 )
+	{
+		values[count++] = atoi( args + 1 );
+		args = strchr( args + 1, ',' );
+	}
+
+	switch( command )
+	{
+		case 220:	// fix interval in ms
+			if( count < 1 )
+			{
+				Acknowledge( command, PMTK_ACK_INVALID );
+			}
+			else if( values[0] < 100 || values[0] > 10000 )
+			{
+				Acknowledge( command, PMTK_ACK_FAILED );
+			}
+			else
+			{
+				gIntervalMs = values[0];
+				Acknowledge( command, PMTK_ACK_SUCCEEDED );
+			}
+			break;
+
+		case 251:	// baud rate, takes effect at once and isn't acknowledged
+			if( count >= 1 && BaudSupported( values[0] ) )
+			{
+				gBaud = values[0];
+			}
+			break;
+
+		case 314:	// sentence output rates, -1 restores the defaults
+			if( count == 1 && values[0] == -1 )
+			{
+				static const int aDefaults[NMEA_MAX] = { 0, 1, 1, 1, 1, 5 };
+				memcpy( gaOutputEvery, aDefaults, sizeof(gaOutputEvery) );
+				Acknowledge( command, PMTK_ACK_SUCCEEDED );
+			}
+			else if( count < NMEA_MAX )
+			{
+				Acknowledge( command, PMTK_ACK_INVALID );
+			}
+			else
+			{
+				memcpy( gaOutputEvery, values, sizeof(gaOutputEvery) );
+				Acknowledge( command, PMTK_ACK_SUCCEEDED );
+			}
+			break;
+
+		default:
+			Acknowledge( command, PMTK_ACK_UNSUPPORTED );
+			break;
+	}
+
+	printf("%s -> %i baud, %i ms\n", body, gBaud, gIntervalMs);
+	fflush( stdout );
+}
+
+//------------------------------------------------------------------------------
+// Collects host input into sentences and checks them before acting
+static void HandleInput( void )
+{
+	static char szLine[MAX_COMMAND_LENGTH];
+	static int len = 0;
+	char buffer[256];
+	int n, i;
+
+	n = read( gMaster, buffer, sizeof(buffer) );
+
+	if( n <= 0 || gbIgnoreCommands || !LineInSync() )
+	{
+		return;
+	}
+
+	for( i = 0; i < n; i++ )
+	{
+		char c = buffer[i];
+
+		if( c == '$' )
+		{
+			len = 0;
+		}
+		else if( c == '\n' )
+		{
+			char *star;
+			unsigned char checksum = 0;
+			int j;
+
+			szLine[len] = '\0';
+			star = strchr( szLine, '*' );
+
+			if( star != NULL && strncmp( szLine, "PMTK", 4 ) == 0 )
+			{
+				for( j = 0; szLine + j < star; j++ )
+				{
+					checksum ^= (unsigned char)szLine[j];
+				}
+
+				*star = '\0';
+				if( strtol( star + 1, NULL, 16 ) == checksum )
+				{
+					HandleCommand( szLine );
+				}
+			}
+			len = 0;
+		}
+		else if( c != '\r' && len < MAX_COMMAND_LENGTH - 1 )
+		{
+			szLine[len++] = c;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+int main( int argc, char **argv )
+{
+	double start_lat = DEFAULT_LAT, start_lon = DEFAULT_LON;
+	char szSlave[64];
+	struct termios tOptions;
+	long long start, next_fix;
+	unsigned long fix = 0;
+	int slave, opt;
+
+	while( ( opt = getopt( argc, argv, "b:p:n" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'b':
+				gBaud = atoi( optarg );
+				break;
+			case 'p':
+				if( sscanf( optarg, "%lf,%lf", &start_lat, &start_lon ) != 2 )
+				{
+					fprintf (stderr, "Bad position: %s\n", optarg) ;
+					return 1;
+				}
+				break;
+			case 'n':
+				gbIgnoreCommands = true;
+				break;
+			default:
+				fprintf (stderr, "Usage: %s [-b baud] [-p lat,lon] [-n]\n", argv[0]) ;
+				return 1;
+		}
+	}
+
+	if( openpty( &gMaster, &slave, szSlave, NULL, NULL ) < 0 )
+	{
+		fprintf (stderr, "Unable to open pty: %s\n", strerror (errno)) ;
+		return 1;
+	}
+
+	tcgetattr( slave, &tOptions );
+	cfmakeraw( &tOptions );
+	tcsetattr( slave, TCSANOW, &tOptions );
+	fcntl( gMaster, F_SETFL, fcntl( gMaster, F_GETFL ) | O_NONBLOCK );
+
+	printf("GPS emulator on %s, %i baud%s\n", szSlave, gBaud, gbIgnoreCommands ? ", ignoring PMTK" : "");
+	fflush( stdout );
+
+	start = next_fix = NowMicros();
+
+	while( true )
+	{
+		EmitFix( fix++, start_lat, start_lon, ( NowMicros() - start ) / 1000000.0 );
+		next_fix += gIntervalMs * 1000LL;
+
+		// Output overran the interval, as it does when the baud is too low
+		if( next_fix < NowMicros() )
+		{
+			next_fix = NowMicros();
+		}
+
+		Idle( next_fix );
+	}
+
+	return 0;
+}
@@ -24,6 +24,9 @@
 // Port for millis()
 #define millis()		TOOLS_millis()
 
+// Port for micros(), monotonic and wrapping at 32 bits like the Arduino one
+#define micros()		TOOLS_micros()
+
 typedef char			S8;
 typedef unsigned char	U8;
 typedef int				S16;
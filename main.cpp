@@ -10,16 +10,25 @@
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <time.h>
 
 // Wiring Pi library
 #include <wiringPi.h>
-#include <wiringSerial.h>
 
 #include "includes.h"
 #include "config.h" // defines I/O pins, operational parameters, etc.
 #include "tools.h"
 #include "TinyGPS++.h"
 #include "HMC6343.h"
+#include "NavFrame.h"
+#include "SeqLock.h"
+#include "Heading.h"
+#include "MagCal.h"
+#include "Deviation.h"
+#include "Wmm.h"
+#include "GpsReader.h"
+#include "GpsConfig.h"
+#include "Transport.h"
 #include "Arduino.h"
 
 #if USE_PI_PLATE
@@ -51,6 +60,7 @@
 #define MSG_IDLE				"Idle            "
 
 #define LOOP_UPDATE_RATE_MS		200		// How often the main update loop runs
+#define METERS_PER_SEC_PER_MPH	0.44704
 
 typedef enum
 {
@@ -85,14 +95,27 @@ typedef struct
     U8 minute;
     U8 second;
 	bool bGpsLocked;
+	U32 u32FixArrival;	// micros() when the fix sentence arrived
+	U32 u32Sequence;	// snapshot number, filled in by the reader
 } tGPS_INFO;
 
-#define GPS_DATA_KEY	0
+typedef struct
+{
+	float fheading;		// degrees, magnetic
+	float fpitch;		// degrees, + nose up
+	float froll;		// degrees
+	S16 as16Accel[3];	// X, Y, Z, raw counts
+	S16 as16Mag[3];		// X, Y, Z, raw counts
+	bool bValid;		// false until the first good sample
+	U32 u32SampleTime;	// micros() when the sample was requested
+	U32 u32Sequence;	// snapshot number, filled in by the reader
+} tCOMPASS_INFO;
 
 typedef struct
 {
 	float dist_to_waypoint;
 	float bear_to_waypoint;
+	float cross_track;
 	float current_heading;
 } tNAV_INFO;
 
@@ -108,13 +131,39 @@ typedef struct
 // Global program state
 E_NAV_STATE geNavState;
 
+// Device links, overridden from the command line (see Transport.h for specs)
+const char *gszGpsPort = GPS_SERIAL_PORT;
+const char *gszCompassPort = COMPASS_SERIAL_PORT;
+
 // GPS
-int gSerial_fd;
+Transport *gptGpsPort;
 TinyGPSPlus cGps;
 
-// GPS info is volatile because it will be updated in its own thread
+// GPS info is published by THREAD_UpdateGps. gtGpsInfo is the nav loop's
+// own copy, refreshed from the snapshot at the top of every loop()
+SeqLock<tGPS_INFO> gGpsSnapshot;
 tGPS_INFO gtGpsInfo;
-//volatile tGPS_INFO gtGpsInfo;
+
+#if USE_COMPASS_THREAD
+// Compass readings are published by THREAD_UpdateCompass. gtCompassInfo is
+// the nav loop's own copy, refreshed at the top of every loop()
+SeqLock<tCOMPASS_INFO> gCompassSnapshot;
+tCOMPASS_INFO gtCompassInfo;
+
+// Magnetometer calibration. gtMagCal is loaded in setup() and then only
+// touched by THREAD_UpdateCompass; gtMagCalData collects a new one (-C)
+bool gbCalibrating = false;
+MAGCAL_RESULT gtMagCal;
+MAGCAL gtMagCalData;
+#endif
+
+#if USE_DEVIATION_TABLE
+// Deviation correction, applied in GetCompassHeading(). gtDeviationData
+// collects samples for a new table (-D)
+bool gbDeviationRun = false;
+DEVIATION_TABLE gtDeviation;
+DEVIATION_BUILDER gtDeviationData;
+#endif
 
 // Arduino on I2C bus
 Arduino cArduino;
@@ -122,6 +171,17 @@ Arduino cArduino;
 // Navigation Info
 tNAV_INFO gtNavInfo;
 
+// Declination, in MAG_VAR's sense (subtracted from magnetic headings, so
+// east is negative). From gtDeclinationGrid at the current fix if there's
+// a magnetic model.
+float gfMagVar = MAG_VAR;
+#if USE_WMM_DECLINATION
+WMM_GRID gtDeclinationGrid;
+#endif
+
+// Local frame for the current leg (set in E_NAV_SET_NEXT_WAYPOINT)
+NAV_FRAME gtNavFrame;
+
 #if USE_PI_PLATE
 // Global button variable used by the THREAD_PiPlateButtons
 Button gtActiveButton;
@@ -154,6 +214,9 @@ tWAY_POINT gtWayPoint[] = {
 
 // Threads
 PI_THREAD 	(THREAD_UpdateGps);
+#if USE_COMPASS_THREAD
+PI_THREAD 	(THREAD_UpdateCompass);
+#endif
 #if USE_PI_PLATE
 PI_THREAD	(THREAD_PiPlateButtons);
 #endif
@@ -170,6 +233,16 @@ E_DIRECTION DirectionToBearing( float DestinationBearing, float CurrentBearing,
 void    	SetSpeed( int new_speed );
 void		SetRudder( int new_setting );
 float 		GetCompassHeading( float declination );
+void		UpdateNavInfo( void );
+void		ExtrapolateGpsInfo( tGPS_INFO *ptGpsInfo );
+#if USE_COMPASS_THREAD
+void		CompassToBoatFrame( const S16 as16Compass[3], float afBoat[3] );
+void		BoatToCompassFrame( const float afBoat[3], S16 as16Compass[3] );
+void		CalibrateCompass( const float afMag[3] );
+#endif
+#if USE_DEVIATION_TABLE
+void		SampleDeviation( float fCompass );
+#endif
 
 void		setup( void );
 void		loop( void );
@@ -181,6 +254,36 @@ int main(int argc, char **argv)
 {
 	E_NAV_STATE last_nav_state;
 	int DisplayUpdateCounter = 0;
+	int opt;
+
+	while( ( opt = getopt( argc, argv, "g:c:CD" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'g':
+				gszGpsPort = optarg;
+				break;
+			case 'c':
+				gszCompassPort = optarg;
+				break;
+#if USE_COMPASS_THREAD
+			case 'C':
+				gbCalibrating = true;
+				break;
+#endif
+#if USE_DEVIATION_TABLE
+			case 'D':
+				gbDeviationRun = true;
+				break;
+#endif
+			default:
+				fprintf (stderr, "Usage: %s [-g gps_port] [-c compass_port] [-C] [-D]\n", argv[0]) ;
+				fprintf (stderr, "\tport: /dev/ttyX, pty, file:capture.nmea or tcp:host:port\n") ;
+				fprintf (stderr, "\t-C: calibrate the compass; turn a slow full circle\n") ;
+				fprintf (stderr, "\t-D: build a deviation table; drive straight legs on all headings\n") ;
+				return 1;
+		}
+	}
 
 	system("clear");
 	printf("GpsBoat - Version %s\n\n", SOFTWARE_VERSION);
@@ -227,6 +330,7 @@ int main(int argc, char **argv)
 			printf("*** Navigation Info ***\n");
 			printf("Bearing to Target: %i\n", gtNavInfo.bear_to_waypoint);
 			printf("Distance to Target: %.1f meters\n", gtNavInfo.dist_to_waypoint);
+			printf("Cross Track: %.1f meters\n", gtNavInfo.cross_track);
 			printf("Heading: %i\n", (U16)gtNavInfo.current_heading);
 			printf("\n*** GPS Status ***\n");
 			printf("GPS Locked: %s\n", (gtGpsInfo.bGpsLocked) ? "YES" : "NO");
@@ -331,17 +435,23 @@ void setup()
 	//-----------------------
 	printf("GPS ...\n");
 
-	if ((gSerial_fd = serialOpen (GPS_SERIAL_PORT, GPS_BAUD)) < 0)
+	if ((gptGpsPort = TRANSPORT_Open (gszGpsPort, GPS_BAUD)) == NULL)
 	{
 		fprintf (stderr, "\tUnable to open serial device: %s\n", strerror (errno)) ;
 		return;
 	}
 	else
 	{
-		printf("Comm port to GPS opened. GPS Baud: %i\n", GPS_BAUD);
+		printf("Comm port to GPS opened on %s. GPS Baud: %i\n", gptGpsPort->GetName(), GPS_BAUD);
 
 		// Start the GPS thread
-		piThreadCreate( THREAD_UpdateGps );
+		if( GPSREADER_Init( gptGpsPort->GetFd(), GPS_BAUD ) )
+		{
+#if USE_GPS_NEGOTIATION
+			GPSCONFIG_Negotiate( gptGpsPort, &cGps, GPS_BAUD );
+#endif
+			piThreadCreate( THREAD_UpdateGps );
+		}
 	}
 
 	printf("OK\n");
@@ -349,9 +459,63 @@ void setup()
 	//-----------------------
 	printf("Compass ... ");
 
-	HMC6343_Setup();
+	HMC6343_Setup( gszCompassPort );
+
+#if USE_COMPASS_THREAD
+	if( gbCalibrating )
+	{
+		MAGCAL_Identity( &gtMagCal );
+		MAGCAL_Init( &gtMagCalData );
+		printf("Calibrating: turn a slow full circle ... ");
+	}
+	else if( !MAGCAL_Load( MAGCAL_FILE, &gtMagCal ) )
+	{
+		printf("Not calibrated (run with -C) ... ");
+	}
+
+	piThreadCreate( THREAD_UpdateCompass );
+#endif
+
+#if USE_DEVIATION_TABLE
+	// A new table is measured from uncorrected headings
+	if( gbDeviationRun )
+	{
+		DEVIATION_Identity( &gtDeviation );
+		DEVIATION_BuilderInit( &gtDeviationData );
+		printf("Building deviation table ... ");
+	}
+	else if( !DEVIATION_Load( DEVIATION_FILE, &gtDeviation ) )
+	{
+		printf("No deviation table (run with -D) ... ");
+	}
+#endif
 
 	printf("OK\n");
+
+#if USE_WMM_DECLINATION
+	//-----------------------
+	printf("Magnetic model ... ");
+	{
+		WMM_MODEL tModel;
+		double year = WMM_DecimalYear( time( NULL ) );
+
+		if( WMM_Load( WMM_FILE, &tModel ) )
+		{
+			// The clock may be off with no network; the model is only
+			// good for its own five years anyway
+			if( WMM_BuildGrid( &tModel, year, &gtDeclinationGrid ) != year )
+			{
+				printf("clock says %.1f, using %.1f ... ", year, gtDeclinationGrid.fYear);
+			}
+
+			printf("%s OK\n", tModel.szName);
+		}
+		else
+		{
+			printf("no %s, using MAG_VAR %d\n", WMM_FILE, MAG_VAR);
+		}
+	}
+#endif
      
     // Navigation state machine init
     geNavState = E_NAV_INIT;
@@ -375,8 +539,16 @@ void loop( void )
     // **********************************
     static float initial_dist_to_waypoint;
     float bearing_tolerance;
-    static U8 update_counter = 0;  // 100ms x 10 == 1 second update since loop runs about every 100ms
     static S16 gps_delay = 0;
+
+    // Take a consistent copy of the latest GPS data
+    gtGpsInfo.u32Sequence = gGpsSnapshot.Read( gtGpsInfo );
+#if USE_GPS_EXTRAPOLATION
+    ExtrapolateGpsInfo( &gtGpsInfo );
+#endif
+#if USE_COMPASS_THREAD
+    gtCompassInfo.u32Sequence = gCompassSnapshot.Read( gtCompassInfo );
+#endif
     
 	// **********************
 	// Update compass heading
@@ -388,7 +560,23 @@ void loop( void )
 //      }
 //      else
 	{    
-		gtNavInfo.current_heading = GetCompassHeading( MAG_VAR );
+#if USE_WMM_DECLINATION
+		if( gtDeclinationGrid.bValid && gtGpsInfo.bGpsLocked )
+		{
+			gfMagVar = -WMM_GridDeclination( &gtDeclinationGrid, gtGpsInfo.flat, gtGpsInfo.flon );
+		}
+#endif
+
+		gtNavInfo.current_heading = GetCompassHeading( gfMagVar );
+
+#if USE_DEVIATION_TABLE
+		// There's no correction while building a table, so this is the
+		// compass's own heading
+		if( gbDeviationRun )
+		{
+			SampleDeviation( gtNavInfo.current_heading + gfMagVar );
+		}
+#endif
 	}
 
 	// ******************
@@ -437,12 +625,12 @@ void loop( void )
           gTargetWP++;
           gTargetWP = gTargetWP % NUM_WAY_POINTS;
           
-          // Calculate inital bearing to waypoint
-          gtNavInfo.bear_to_waypoint = cGps.courseTo( gtGpsInfo.flat, gtGpsInfo.flon,
-          				    gtWayPoint[gTargetWP].flat, gtWayPoint[gTargetWP].flon );
+          // Build the navigation frame for this leg
+          NAVFRAME_Init( &gtNavFrame, gtGpsInfo.flat, gtGpsInfo.flon,
+                         gtWayPoint[gTargetWP].flat, gtWayPoint[gTargetWP].flon );
 
-		  gtNavInfo.dist_to_waypoint = cGps.distanceBetween( gtGpsInfo.flat, gtGpsInfo.flon,
-   						    gtWayPoint[gTargetWP].flat, gtWayPoint[gTargetWP].flon );
+          // Calculate inital bearing and distance to waypoint
+          UpdateNavInfo();
 
           geNavState = E_NAV_START;
           break;
@@ -484,24 +672,17 @@ void loop( void )
               SetSpeed( SPEED_50_PERCENT );
 
               // Calculate initial distance to next point
-              initial_dist_to_waypoint = cGps.distanceBetween( gtGpsInfo.flat, gtGpsInfo.flon,
-    						       gtWayPoint[gTargetWP].flat, gtWayPoint[gTargetWP].flon );
-              gtNavInfo.dist_to_waypoint = initial_dist_to_waypoint;
+              UpdateNavInfo();
+              initial_dist_to_waypoint = gtNavInfo.dist_to_waypoint;
               printf("Distance to waypoint: %f\n", gtNavInfo.dist_to_waypoint);
               break;
           }
           break;
           
       case E_NAV_RUN:
-          if( 0 == (update_counter++ % 10) )
-          {
-              // Update range and bearing to waypoint
-              gtNavInfo.dist_to_waypoint = cGps.distanceBetween( gtGpsInfo.flat, gtGpsInfo.flon,
-    						     gtWayPoint[gTargetWP].flat, gtWayPoint[gTargetWP].flon );
-    
-              gtNavInfo.bear_to_waypoint = cGps.courseTo( gtGpsInfo.flat, gtGpsInfo.flon,
-              				     gtWayPoint[gTargetWP].flat, gtWayPoint[gTargetWP].flon );
-          }
+          // Update range and bearing to waypoint. Cheap enough in the leg's
+          // local frame to do on every pass.
+          UpdateNavInfo();
           
           // Is GPS still locked?
           if( false == gtGpsInfo.bGpsLocked )
@@ -568,14 +749,60 @@ void loop( void )
     LED_OFF;
 }
 
+//------------------------------------------------------------------------------
+// Updates distance, bearing and cross-track error to the target waypoint
+void UpdateNavInfo( void )
+{
+	NAV_FRAME_FIX tFix;
+
+	NAVFRAME_Update( &gtNavFrame, gtGpsInfo.flat, gtGpsInfo.flon, &tFix );
+
+	gtNavInfo.dist_to_waypoint = tFix.fDistance;
+	gtNavInfo.bear_to_waypoint = tFix.fBearing;
+	gtNavInfo.cross_track = tFix.fCrossTrack;
+}
+
+//------------------------------------------------------------------------------
+// Moves the fix on from when its sentence arrived to now at the current
+// speed and course, so steering and arrival checks aren't working from
+// where the boat was up to a second ago
+void ExtrapolateGpsInfo( tGPS_INFO *ptGpsInfo )
+{
+	double elapsed, distance, course;
+
+	if( !ptGpsInfo->bGpsLocked || ptGpsInfo->fmph < GPS_MIN_EXTRAPOLATION_MPH )
+	{
+		return;
+	}
+
+	elapsed = (uint32_t)( micros() - ptGpsInfo->u32FixArrival ) / 1000000.0;
+	elapsed = min( elapsed, GPS_MAX_EXTRAPOLATION_S );
+
+	distance = ptGpsInfo->fmph * METERS_PER_SEC_PER_MPH * elapsed;
+	course = radians( ptGpsInfo->fcourse );
+
+	ptGpsInfo->flat += degrees( distance * cos( course ) / _GPS_EARTH_RADIUS_M );
+	ptGpsInfo->flon += degrees( distance * sin( course ) / ( _GPS_EARTH_RADIUS_M * cos( radians( ptGpsInfo->flat ) ) ) );
+}
+
 //------------------------------------------------------------------------------
 float GetCompassHeading( float declination )
 {
+#if USE_COMPASS_THREAD
+	// Latest sample from THREAD_UpdateCompass, taken at the top of loop()
+	float heading = gtCompassInfo.bValid ? gtCompassInfo.fheading : COMPASS_HEADING_INVALID / 10.0;
+#else
 	float heading = (float)(HMC6343_GetHeading()) / 10.0;
+#endif
 
     // If you have an EAST declination, use + declinationAngle, if you
     // have a WEST declination, use - declinationAngle 
 
+#if USE_DEVIATION_TABLE
+	// Per heading correction for the boat's own iron
+	heading = DEVIATION_Correct( &gtDeviation, heading );
+#endif
+
 	heading -= declination;
 
     // Correct for when signs are reversed. 
@@ -593,6 +820,56 @@ float GetCompassHeading( float declination )
 	return heading;
 }
 
+#if USE_DEVIATION_TABLE
+//-----------------------------------------------------------------------------------
+// Pairs the compass heading with the GPS course on each new fix while the boat
+// is making way on a steady course, and saves the table every
+// DEVIATION_SAVE_SAMPLES
+void SampleDeviation( float fCompass )
+{
+	static U32 u32LastSequence = 0;
+	static double fLastCourse = -1;
+	DEVIATION_TABLE tTable;
+	double fTurn;
+	int measured;
+
+	if( gtGpsInfo.u32Sequence == u32LastSequence || !gtGpsInfo.bGpsLocked )
+	{
+		return;
+	}
+
+	u32LastSequence = gtGpsInfo.u32Sequence;
+	fTurn = fabs( fmod( gtGpsInfo.fcourse - fLastCourse + 540.0, 360.0 ) - 180.0 );
+	fLastCourse = gtGpsInfo.fcourse;
+
+#if USE_COMPASS_THREAD
+	if( !gtCompassInfo.bValid )
+	{
+		return;
+	}
+#endif
+
+	if( gtGpsInfo.fmph < DEVIATION_MIN_MPH || fTurn > DEVIATION_MAX_TURN_DEG )
+	{
+		return;
+	}
+
+	// GPS course is true; the table is by magnetic heading
+	if( !DEVIATION_AddSample( &gtDeviationData, fmod( fCompass + 360.0, 360.0 ), fmod( gtGpsInfo.fcourse + gfMagVar + 360.0, 360.0 ) )
+		|| gtDeviationData.u32Samples % DEVIATION_SAVE_SAMPLES != 0 )
+	{
+		return;
+	}
+
+	// Not put to use until the next start, so headings stay uncorrected
+	measured = DEVIATION_Build( &gtDeviationData, &tTable );
+	DEVIATION_Save( DEVIATION_FILE, &tTable );
+
+	printf("Deviation: %lu samples, %i of %i headings measured\n",
+		(unsigned long)gtDeviationData.u32Samples, measured, DEVIATION_ENTRIES);
+}
+#endif
+
 //-----------------------------------------------------------------------------------
 // Gradually sets the new ESC speed setting unless its STOP
 // Assumes LOWER settings == faster
@@ -684,24 +961,26 @@ PI_THREAD (THREAD_UpdateGps )
 	
 	while( true )
 	{
-		delay( 200 );
-
 		// *******************************    
 		// Grab GPS data from serial input
 		// *******************************
-		while( serialDataAvail(gSerial_fd) )
-		{
-		    char c;
-			c = serialGetchar(gSerial_fd);
+		// Wakes as soon as bytes arrive and parses them straight away
+		int sentences = GPSREADER_Service( &cGps, GPS_POLL_TIMEOUT_MS );
 
-#if DO_GPS_TEST        
-		    printf("%c", c);
-			fflush( stdout );
-#endif
-		    if (cGps.encode(c))
-		    {
-		        bNewGpsData = true;
-		    }
+		if( sentences > 0 )
+		{
+			bNewGpsData = true;
+		}
+		else if( sentences == GPS_READER_END_OF_STREAM )
+		{
+			// e.g. the end of a replayed log; nothing more will arrive
+			printf("GPS stream ended, no further fixes\n");
+			break;
+		}
+		else if( sentences < 0 )
+		{
+			fprintf (stderr, "GPS read error: %s\n", strerror (errno)) ;
+			delay( GPS_POLL_TIMEOUT_MS );
 		}
 		
 		// ********************
@@ -709,42 +988,220 @@ PI_THREAD (THREAD_UpdateGps )
 		// ********************
 		if( bNewGpsData )
 		{
-			// Lock the GPS data for updating
-			piLock( GPS_DATA_KEY );
-        
+			tGPS_INFO tGpsInfo;
+
+			memset( &tGpsInfo, 0, sizeof(tGpsInfo) );
+
 		    // GPS Position
 		    // retrieves +/- lat/long in 100000ths of a degree
-			gtGpsInfo.flat = cGps.location.lat();
-			gtGpsInfo.flon = cGps.location.lng();
+			tGpsInfo.flat = cGps.location.lat();
+			tGpsInfo.flon = cGps.location.lng();
 
 		    if( cGps.location.isValid() )
 		    {
-		        gtGpsInfo.bGpsLocked = true;
+		        tGpsInfo.bGpsLocked = true;
+		        tGpsInfo.u32FixArrival = cGps.location.arrivalTime();
 		    }
 		    else
 		    {
-		        gtGpsInfo.bGpsLocked = false;
+		        tGpsInfo.bGpsLocked = false;
 		    }
 		        
 #if USE_GPS_TIME_INFO
 		    // GPS Time
-		    cGps.crack_datetime(&year, &month, &day, &gtGpsInfo.hour, &gtGpsInfo.minute, &gtGpsInfo.second, &hundredths, &fix_age);
+		    cGps.crack_datetime(&year, &month, &day, &tGpsInfo.hour, &tGpsInfo.minute, &tGpsInfo.second, &hundredths, &fix_age);
 #endif // USE_GPS_TIME_INFO
 
 		    // GPS Speed
-		    gtGpsInfo.fmph = cGps.speed.mph(); // speed in miles/hr
+		    tGpsInfo.fmph = cGps.speed.mph(); // speed in miles/hr
 		    // course in 100ths of a degree
-		    gtGpsInfo.fcourse = cGps.course.deg();
+		    tGpsInfo.fcourse = cGps.course.deg();
 
-			// Unlock the GPS data for updating
-			piUnlock( GPS_DATA_KEY );
+			// Publish to the nav loop, display, etc. Never blocks on readers
+			gGpsSnapshot.Publish( tGpsInfo );
 
 			// reset new data flag			
 			bNewGpsData = false;
 		}
     }
+
+	return NULL;
 }
 
+#if USE_COMPASS_THREAD
+//-----------------------------------------------------------------------------------
+// Samples the compass every 1/COMPASS_SAMPLE_RATE_HZ and publishes each good
+// reading. A failed read keeps the last one, whose u32SampleTime shows its age.
+PI_THREAD (THREAD_UpdateCompass)
+{
+	U32 u32Period = 1000000 / COMPASS_SAMPLE_RATE_HZ;
+	U32 u32Next = micros();
+	tCOMPASS_INFO tCompassInfo;
+	HMC6343_ATTITUDE tAttitude;
+	float afMag[3];
+	int wait;
+#if USE_SOFTWARE_HEADING
+	HEADING_FILTER tFilter;
+	HEADING_ATTITUDE tHeading;
+	float afAccel[3];
+
+	HEADING_FilterInit( &tFilter, HEADING_GRAVITY_TAU_S, HEADING_TAU_S );
+#endif
+
+	printf("THREAD_UpdateCompass started\n");
+
+	memset( &tCompassInfo, 0, sizeof(tCompassInfo) );
+
+	while( true )
+	{
+		// Heading, pitch, roll, accel and mag in one pass
+		if( HMC6343_GetAttitude( &tAttitude ) )
+		{
+			CompassToBoatFrame( tAttitude.as16Mag, afMag );
+
+			if( gbCalibrating )
+			{
+				CalibrateCompass( afMag );
+			}
+
+#if USE_SOFTWARE_HEADING
+			CompassToBoatFrame( tAttitude.as16Accel, afAccel );
+			MAGCAL_Apply( &gtMagCal, afMag, afMag );
+			HEADING_FilterUpdate( &tFilter, afAccel, afMag, tAttitude.u32SampleTime, &tHeading );
+
+			tCompassInfo.fheading = tHeading.fHeading;
+			tCompassInfo.fpitch = tHeading.fPitch;
+			tCompassInfo.froll = tHeading.fRoll;
+#else
+			tCompassInfo.fheading = tAttitude.s16Heading / 10.0;
+			tCompassInfo.fpitch = tAttitude.s16Pitch / 10.0;
+			tCompassInfo.froll = tAttitude.s16Roll / 10.0;
+#endif
+			memcpy( tCompassInfo.as16Accel, tAttitude.as16Accel, sizeof(tCompassInfo.as16Accel) );
+			memcpy( tCompassInfo.as16Mag, tAttitude.as16Mag, sizeof(tCompassInfo.as16Mag) );
+			tCompassInfo.bValid = true;
+			tCompassInfo.u32SampleTime = tAttitude.u32SampleTime;
+
+			// Publish to the nav loop. Never blocks on readers
+			gCompassSnapshot.Publish( tCompassInfo );
+		}
+
+		// Stay on the sample grid; if a read overran it, start again from now
+		u32Next += u32Period;
+		wait = (int)( u32Next - micros() );
+
+		if( wait > 0 )
+		{
+			delayMicroseconds( wait );
+		}
+		else
+		{
+			u32Next = micros();
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------------
+// Reorders a raw compass vector into the boat's forward, starboard, down axes
+void CompassToBoatFrame( const S16 as16Compass[3], float afBoat[3] )
+{
+	static const int aAxis[3] = { COMPASS_AXIS_FORWARD, COMPASS_AXIS_STARBOARD, COMPASS_AXIS_DOWN };
+	int i;
+
+	for( i = 0; i < 3; i++ )
+	{
+		afBoat[i] = ( aAxis[i] > 0 ) ? as16Compass[aAxis[i] - 1] : -as16Compass[-aAxis[i] - 1];
+	}
+}
+
+//-----------------------------------------------------------------------------------
+// The reverse of CompassToBoatFrame(), rounded to counts
+void BoatToCompassFrame( const float afBoat[3], S16 as16Compass[3] )
+{
+	static const int aAxis[3] = { COMPASS_AXIS_FORWARD, COMPASS_AXIS_STARBOARD, COMPASS_AXIS_DOWN };
+	int i;
+
+	for( i = 0; i < 3; i++ )
+	{
+		S16 s16Value = (S16)lroundf( afBoat[i] );
+
+		as16Compass[abs( aAxis[i] ) - 1] = ( aAxis[i] > 0 ) ? s16Value : -s16Value;
+	}
+}
+
+//-----------------------------------------------------------------------------------
+// Adds a raw magnetometer sample to the calibration and, about once a second,
+// fits it. Once the fit is good enough it's saved and put to use.
+void CalibrateCompass( const float afMag[3] )
+{
+	static int samples = 0;
+	MAGCAL_RESULT tResult;
+
+	if( !MAGCAL_AddSample( &gtMagCalData, afMag ) || ++samples < COMPASS_SAMPLE_RATE_HZ )
+	{
+		return;
+	}
+
+	samples = 0;
+
+	if( !MAGCAL_Fit( &gtMagCalData, &tResult ) )
+	{
+		return;
+	}
+
+	printf("Calibration: %lu samples, %.0f%% of headings, residual %.1f%%%s\n",
+		(unsigned long)tResult.u32Samples, tResult.fCoverage * 100, tResult.fResidual * 100,
+		tResult.bPlanar ? ", level only" : "");
+
+	if( tResult.u32Samples < MAGCAL_MIN_SAMPLES
+		|| tResult.fCoverage < MAGCAL_MIN_COVERAGE
+		|| tResult.fResidual > MAGCAL_MAX_RESIDUAL )
+	{
+		return;
+	}
+
+	printf("Calibrated: offset %.1f %.1f %.1f\n", tResult.afOffset[0], tResult.afOffset[1], tResult.afOffset[2]);
+
+#if MAGCAL_WRITE_EEPROM
+	{
+		S16 as16Offset[3], as16Current[3];
+		int i;
+
+		// The samples already had the chip's offsets taken off, so the fit
+		// is what's left on top of them
+		BoatToCompassFrame( tResult.afOffset, as16Offset );
+
+		if( !HMC6343_GetOffsets( &as16Current[0], &as16Current[1], &as16Current[2] ) )
+		{
+			fprintf (stderr, "Unable to read compass offsets\n") ;
+			return;
+		}
+
+		for( i = 0; i < 3; i++ )
+		{
+			as16Offset[i] += as16Current[i];
+		}
+
+		if( HMC6343_SetOffsets( as16Offset[0], as16Offset[1], as16Offset[2] ) )
+		{
+			// The chip takes them off its readings from now on, leaving
+			// only the soft iron for the software heading
+			memset( tResult.afOffset, 0, sizeof(tResult.afOffset) );
+		}
+		else
+		{
+			fprintf (stderr, "Unable to write compass offsets\n") ;
+		}
+	}
+#endif
+
+	MAGCAL_Save( MAGCAL_FILE, &tResult );
+
+	gtMagCal = tResult;
+	gbCalibrating = false;
+}
+#endif
+
 //-----------------------------------------------------------------------------------
 E_DIRECTION DirectionToBearing( float DestinationBearing, float CurrentBearing, float BearingTolerance )
 {
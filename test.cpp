@@ -4,7 +4,6 @@
 #include <math.h>       /* sin */
 
 #include <wiringPi.h>
-#include <wiringSerial.h>
 
 #include "includes.h"
 #include "HMC6343.h"
@@ -16,6 +15,8 @@ int main ()
 {
 	char id_str[3];
 	unsigned int counter = 0;
+	HMC6343_LATENCY tLatency;
+	int i;
 
 	printf("sizeof float: %i\n", sizeof(float) );
 	printf("sizeof int: %i\n", sizeof(int) );
@@ -27,7 +28,7 @@ int main ()
 
     // Init compass
 	printf("Compass ... ");
-	HMC6343_Setup();
+	HMC6343_Setup( COMPASS_SERIAL_PORT );
 	printf("OK\n");
 
 	while(1)
@@ -37,6 +38,16 @@ int main ()
 		printf("True Heading (with deviation): %.1f\n", GetCompassHeading( -13.0 ) );
 //		printf("Heading (without deviation): %.1f\n", GetCompassHeading( 0.0 ) );
 
+		HMC6343_GetLatency( &tLatency );
+		printf("Response latency (max %.1f ms, %i timeouts):\n", tLatency.u32MaxUs / 1000.0, (int)tLatency.u32Timeouts );
+		for( i = 0; i < HMC6343__LATENCY_BUCKETS; i++ )
+		{
+			if( tLatency.au32Count[i] )
+			{
+				printf("  %2i ms: %u\n", i, (unsigned)tLatency.au32Count[i] );
+			}
+		}
+
 		delay( 250 );
 	}
 
@@ -2,6 +2,9 @@
 // Various function "tools" for projects
 
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
 #include "tools.h"
 
 int TOOLS_millis()
@@ -11,6 +14,27 @@ int TOOLS_millis()
 	return (tv.tv_sec) * 1000 + (tv.tv_usec)/1000;
 }
 
+//-----------------------------------------------------------------------------
+// Monotonic microseconds, truncated to 32 bits so differences wrap cleanly
+// (about every 71 minutes) on both 32 and 64 bit builds
+U32 TOOLS_micros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+//-----------------------------------------------------------------------------
+// Sleeps for ms milliseconds, carrying on after signals
+void TOOLS_delay( unsigned int ms )
+{
+	struct timespec ts = { (time_t)( ms / 1000 ), (long)( ms % 1000 ) * 1000000 };
+
+	while( nanosleep( &ts, &ts ) < 0 && errno == EINTR )
+	{
+	}
+}
+
 //-----------------------------------------------------------------------------
 //
 // LowPassFilter
@@ -31,5 +31,7 @@ void 	TOOLS_RA_Signed_Init( U8 u8SampleCount, RUNNING_SIGNED_AVERAGE_TYPE *ptSam
 S16 	TOOLS_RA_ComputeSingedAverage( S16 s16Sample, RUNNING_SIGNED_AVERAGE_TYPE *ptSamples );
 
 int TOOLS_millis();
+U32 TOOLS_micros();
+void TOOLS_delay( unsigned int ms );
 
 #endif
@@ -0,0 +1,99 @@
+// gpslog.cpp
+// Decodes a recorded NMEA capture on all cores and prints the fixes as CSV
+//
+// Usage: gpslog [-j threads] [-q] capture.nmea
+//	-j	number of threads (default one per online CPU, 1 for a single pass)
+//	-q	print only the summary
+//
+// The summary (fixes, checksums, throughput) goes to stderr so the CSV on
+// stdout can be redirected on its own.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "GpsLog.h"
+
+//-----------------------------------------------------------------------------
+static void PrintNanodegrees( int64_t s64Nano )
+{
+	uint64_t u64Magnitude = s64Nano < 0 ? 0 - (uint64_t)s64Nano : (uint64_t)s64Nano;
+
+	printf( "%s%" PRIu64 ".%09" PRIu64, s64Nano < 0 ? "-" : "", u64Magnitude / 1000000000, u64Magnitude % 1000000000 );
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char *argv[] )
+{
+	GPSLOG_RESULT tResult;
+	struct timespec tStart, tEnd;
+	double dSeconds;
+	int threads = 0;
+	bool bQuiet = false;
+	size_t i;
+	int opt;
+
+	while( ( opt = getopt( argc, argv, "j:q" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'j':
+				threads = atoi( optarg );
+				break;
+
+			case 'q':
+				bQuiet = true;
+				break;
+
+			default:
+				fprintf( stderr, "Usage: %s [-j threads] [-q] capture.nmea\n", argv[0] );
+				return 1;
+		}
+	}
+
+	if( optind != argc - 1 )
+	{
+		fprintf( stderr, "Usage: %s [-j threads] [-q] capture.nmea\n", argv[0] );
+		return 1;
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &tStart );
+
+	if( !GPSLOG_Decode( argv[optind], threads, &tResult ) )
+	{
+		return 1;
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &tEnd );
+	dSeconds = ( tEnd.tv_sec - tStart.tv_sec ) + ( tEnd.tv_nsec - tStart.tv_nsec ) / 1e9;
+
+	if( !bQuiet )
+	{
+		printf( "offset,date,time,lat,lon,altitude_m,speed_kn,course_deg,satellites,hdop\n" );
+
+		for( i = 0; i < tResult.nFixes; i++ )
+		{
+			GPSLOG_FIX *ptFix = &tResult.ptFixes[i];
+
+			printf( "%" PRIu64 ",%06" PRIu32 ",%08" PRIu32 ",", ptFix->u64Offset, ptFix->u32Date, ptFix->u32Time );
+			PrintNanodegrees( ptFix->s64LatNano );
+			printf( "," );
+			PrintNanodegrees( ptFix->s64LngNano );
+			printf( ",%.2f,%.2f,%.2f,%" PRIu32 ",%.2f\n",
+				ptFix->s32Altitude / 100.0, ptFix->s32Speed / 100.0, ptFix->s32Course / 100.0,
+				ptFix->u32Satellites, ptFix->s32Hdop / 100.0 );
+		}
+	}
+
+	fprintf( stderr, "%zu fixes, %" PRIu32 " sentences passed, %" PRIu32 " failed checksum\n",
+		tResult.nFixes, tResult.u32PassedChecksum, tResult.u32FailedChecksum );
+	fprintf( stderr, "%.1f MB in %.1f ms on %d thread%s (%.1f MB/s)\n",
+		tResult.u64Chars / 1e6, dSeconds * 1e3, tResult.nChunks, tResult.nChunks == 1 ? "" : "s",
+		dSeconds > 0 ? tResult.u64Chars / 1e6 / dSeconds : 0.0 );
+
+	GPSLOG_Free( &tResult );
+
+	return 0;
+}